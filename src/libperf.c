@@ -23,14 +23,19 @@
  ******************************************************************************/
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stropts.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -39,42 +44,94 @@
 #include <linux/perf_event.h>
 
 #include "libperf.h"
+#include "libperf_private.h"
 
 #define __LIBPERF_MAX_COUNTERS 32 
 #define __LIBPERF_ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#define __LIBPERF_SPEC_MAX 256
+
+/* every counter reports how long it was enabled and actually running */
+#define __LIBPERF_READ_FORMAT \
+  (PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+/* PERF_FORMAT_GROUP | PERF_FORMAT_ID layout: nr, time_enabled,
+   time_running, then { value, id } pairs */
+#define __LIBPERF_GROUP_READ_SIZE(nr) (3 + 2 * (nr))
+#define __LIBPERF_CACHELINE 64
+
+/* stats section */
+struct stats
+{
+  double n, mean, M2, min, max;
+};
+
+/* a named region and the running stats of its counter deltas */
+struct region
+{
+  char *name;
+  uint64_t start[LIBPERF_NR_COUNTERS];
+  struct stats *stats;                  /* LIBPERF_NR_COUNTERS entries */
+  uint64_t *added_start;                /* events added by spec, by slot */
+  struct stats *added_stats;
+  int nr_added;
+};
+
+/* one perf event; builtin counters sit in the slot of their enum value,
+   events added by spec follow from __LIBPERF_MAX_COUNTERS on */
+struct counter
+{
+  int fd;
+  uint64_t id;
+  struct perf_event_mmap_page *page;
+  const struct perf_event_attr *attr;   /* shared default_attrs entry, or
+                                           owned for added events */
+  char *name;                           /* added events only */
+  struct libperf_count count;           /* scattered by read_group */
+};
 
 /* lib struct */
 struct libperf_data
 {
   int group;
-  int fds[__LIBPERF_MAX_COUNTERS];
-  struct perf_event_attr *attrs;
+  int flags;
+  struct counter *counters;
+  int nr_slots;
+  uint64_t *groupbuf;                   /* __LIBPERF_GROUP_READ_SIZE */
   FILE *log;
   pid_t pid;
   int cpu;
+  uint64_t mask;
   unsigned long long wall_start;
+  struct region *regions;
+  int nr_regions;
+  struct __libperf_logqueue *queue;     /* LIBPERF_FLAG_ASYNCLOG only */
+  int log_events[LIBPERF_NR_COUNTERS];  /* counters in queued records */
+  int nr_log_events;
+  struct __libperf_metric **metrics;
+  int nr_metrics;
+  struct libperf_pool *pool;            /* __LIBPERF_FLAG_POOLED only */
 };
 
-/* rdclock() function */
-static inline unsigned long long rdclock(void)
-{
-  struct timespec ts;
-
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-}
-
-/* stats section */
-struct stats
-{
-  double n, mean, M2;
-};
+/* a pool block holds the context, its builtin slots and its group read
+   buffer back to back, each part starting on a cache line */
+#define __LIBPERF_ALIGN(n) (((n) + __LIBPERF_CACHELINE - 1) & \
+                            ~(size_t) (__LIBPERF_CACHELINE - 1))
+#define __LIBPERF_BLOCK_COUNTERS __LIBPERF_ALIGN(sizeof(struct libperf_data))
+#define __LIBPERF_BLOCK_GROUPBUF (__LIBPERF_BLOCK_COUNTERS + \
+  __LIBPERF_ALIGN(__LIBPERF_MAX_COUNTERS * sizeof(struct counter)))
+#define __LIBPERF_BLOCK_SIZE (__LIBPERF_BLOCK_GROUPBUF + __LIBPERF_ALIGN( \
+  __LIBPERF_GROUP_READ_SIZE(__LIBPERF_MAX_COUNTERS) * sizeof(uint64_t)))
 
 static void
 update_stats(struct stats *stats, uint64_t val)
 {
   double delta;
 
+  if (stats->n == 0 || val < stats->min)
+    stats->min = val;
+  if (stats->n == 0 || val > stats->max)
+    stats->max = val;
+
   stats->n++;
   delta = val - stats->mean;
   stats->mean += delta / stats->n;
@@ -87,25 +144,117 @@ avg_stats(struct stats *stats)
   return stats->mean;
 }
 
-/* perf_event_open syscall wrapper */
-static long
-sys_perf_event_open(struct perf_event_attr *hw_event,
-                    pid_t pid, int cpu, int group_fd,
-                    unsigned long flags)
+static double
+var_stats(struct stats *stats)
+{
+  if (stats->n < 2)
+    return 0.0;
+
+  return stats->M2 / (stats->n - 1);
+}
+
+/* rdpmc() function, only meaningful for self-monitoring counters */
+static inline uint64_t
+rdpmc(uint32_t counter)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t low, high;
+
+  __asm__ volatile ("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+  return low | ((uint64_t) high << 32);
+#else
+  (void) counter;
+  return 0;
+#endif
+}
+
+/* rdtsc() function, used to extrapolate the mmap'd page times */
+static inline uint64_t
+rdtsc(void)
 {
-  return syscall(__NR_perf_event_open, hw_event, pid, cpu,
-                 group_fd, flags);
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t low, high;
+
+  __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+  return low | ((uint64_t) high << 32);
+#else
+  return 0;
+#endif
+}
+
+/* fills in the scaled estimate from the raw value and times */
+static inline void
+scale_count(struct libperf_count *count)
+{
+  if (count->time_running == 0)
+    count->value = 0;
+  else if (count->time_running >= count->time_enabled)
+    count->value = count->raw;
+  else
+    count->value = (uint64_t) ((double) count->raw *
+                               count->time_enabled / count->time_running);
 }
 
-/* gettid syscall wrapper */
-static inline pid_t
-gettid()
+/* reads a counter from its mmap'd page following the seqlock protocol */
+/* returns -1 if the caller has to fall back to read( ) */
+static inline int
+mmap_read(struct perf_event_mmap_page *pc, struct libperf_count *count)
 {
-  return syscall(SYS_gettid);
+  uint32_t seq, idx;
+
+  uint64_t raw, pmc, enabled, running, cyc, quot, rem, delta;
+
+  uint16_t width;
+
+  do
+    {
+      seq = pc->lock;
+      barrier();
+
+      idx = pc->index;
+      if (!pc->cap_user_rdpmc || idx == 0)
+        return -1;
+
+      enabled = pc->time_enabled;
+      running = pc->time_running;
+
+      /* times are as of the last schedule in, extend them to now */
+      if (pc->cap_user_time)
+        {
+          cyc = rdtsc();
+          if (pc->cap_user_time_short)
+            cyc = pc->time_cycles + ((cyc - pc->time_cycles) & pc->time_mask);
+
+          quot = cyc >> pc->time_shift;
+          rem = cyc & (((uint64_t) 1 << pc->time_shift) - 1);
+          delta = pc->time_offset + quot * pc->time_mult +
+                  ((rem * pc->time_mult) >> pc->time_shift);
+
+          enabled += delta;
+          running += delta;
+        }
+
+      raw = pc->offset;
+      width = pc->pmc_width;
+      pmc = rdpmc(idx - 1);
+
+      /* sign extend the pmc_width wide hardware value */
+      pmc <<= 64 - width;
+      raw += (int64_t) pmc >> (64 - width);
+
+      barrier();
+    }
+  while (pc->lock != seq);
+
+  count->raw = raw;
+  count->time_enabled = enabled;
+  count->time_running = running;
+  scale_count(count);
+  return 0;
 }
 
 /* perf specific */
-static struct perf_event_attr default_attrs[] = {
+static const struct perf_event_attr default_attrs[] = {
 
   { .type = PERF_TYPE_SOFTWARE, .config = PERF_COUNT_SW_CPU_CLOCK          },
   { .type = PERF_TYPE_SOFTWARE, .config = PERF_COUNT_SW_TASK_CLOCK         },
@@ -145,172 +294,1534 @@ static struct perf_event_attr default_attrs[] = {
 
 };
 
+int
+__libperf_defaultattr(int counter, struct perf_event_attr *attr)
+{
+  if (counter < 0 || counter >= __LIBPERF_ARRAY_SIZE(default_attrs))
+    return -1;
+
+  *attr = default_attrs[counter];
+  attr->size = sizeof(*attr);
+  return 0;
+}
+
+/* event names, perf tool style and enum libperf_tracepoint style */
+static const struct
+{
+  const char *perf;
+  const char *libperf;
+} event_names[] = {
+
+  { "cpu-clock",              "CPU_CLOCK"             },
+  { "task-clock",             "TASK_CLOCK"            },
+  { "context-switches",       "CONTEXT_SWITCHES"      },
+  { "cpu-migrations",         "CPU_MIGRATIONS"        },
+  { "page-faults",            "PAGE_FAULTS"           },
+  { "minor-faults",           "PAGE_FAULTS_MIN"       },
+  { "major-faults",           "PAGE_FAULTS_MAJ"       },
+
+  { "cycles",                 "CPU_CYCLES"            },
+  { "instructions",           "INSTRUCTIONS"          },
+  { "cache-references",       "CACHE_REFERENCES"      },
+  { "cache-misses",           "CACHE_MISSES"          },
+  { "branches",               "BRANCH_INSTRUCTIONS"   },
+  { "branch-misses",          "BRANCH_MISSES"         },
+  { "bus-cycles",             "BUS_CYCLES"            },
+
+  { "L1-dcache-loads",        "L1D_LOADS"             },
+  { "L1-dcache-load-misses",  "L1D_LOADS_MISSES"      },
+  { "L1-dcache-stores",       "L1D_STORES"            },
+  { "L1-dcache-store-misses", "L1D_STORES_MISSES"     },
+  { "L1-dcache-prefetches",   "L1D_PREFETCHES"        },
+  { "L1-icache-loads",        "L1I_LOADS"             },
+  { "L1-icache-load-misses",  "L1I_LOADS_MISSES"      },
+  { "LLC-loads",              "LL_LOADS"              },
+  { "LLC-load-misses",        "LL_LOADS_MISSES"       },
+  { "LLC-stores",             "LL_STORES"             },
+  { "LLC-store-misses",       "LL_STORES_MISSES"      },
+  { "dTLB-loads",             "DTLB_LOADS"            },
+  { "dTLB-load-misses",       "DTLB_LOADS_MISSES"     },
+  { "dTLB-stores",            "DTLB_STORES"           },
+  { "dTLB-store-misses",      "DTLB_STORES_MISSES"    },
+  { "iTLB-loads",             "ITLB_LOADS"            },
+  { "iTLB-load-misses",       "ITLB_LOADS_MISSES"     },
+  { "branch-loads",           "BPU_LOADS"             },
+  { "branch-load-misses",     "BPU_LOADS_MISSES"      },
+
+};
+
+/* fills in what every counter of a context shares */
+static void
+setup_attr(struct libperf_data *pd, struct perf_event_attr *attr)
+{
+  attr->size = sizeof(struct perf_event_attr);
+  attr->inherit = 1;          /* default */
+  attr->disabled = 1;         /* disable them now... */
+  attr->enable_on_exec = 0;
+  attr->read_format = __LIBPERF_READ_FORMAT;
+
+  if (pd->flags & LIBPERF_FLAG_GROUP)
+    attr->read_format |= PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+
+  /* user space reads cannot see counts of inherited children */
+  if (pd->flags & (LIBPERF_FLAG_MMAP | __LIBPERF_FLAG_SYSTEMWIDE))
+    attr->inherit = 0;
+
+  if (pd->flags & __LIBPERF_FLAG_NOINHERIT)
+    attr->inherit = 0;
+
+  if (pd->flags & __LIBPERF_FLAG_ENABLE_ON_EXEC)
+    attr->enable_on_exec = 1;
+}
+
+/* opens a single counter, joining the group leader in group mode */
+static int
+open_counter(struct libperf_data *pd, int counter)
+{
+  struct perf_event_attr copy = *pd->counters[counter].attr, *attr = &copy;
+
+  unsigned long flags = 0;
+
+  int fd;
+
+  setup_attr(pd, attr);
+
+  if (pd->flags & __LIBPERF_FLAG_CGROUP)
+    flags |= PERF_FLAG_PID_CGROUP;
+
+  fd = sys_perf_event_open(attr, pd->pid, pd->cpu, pd->group, flags);
+
+  /* unprivileged users may only count user space */
+  if (fd < 0 && (errno == EACCES || errno == EPERM) && !attr->exclude_kernel)
+    {
+      attr->exclude_kernel = attr->exclude_hv = 1;
+      fd = sys_perf_event_open(attr, pd->pid, pd->cpu, pd->group, flags);
+    }
+
+  /* older kernels refuse to combine inherit with PERF_FORMAT_GROUP */
+  if (fd < 0 && pd->group == -1 && (pd->flags & LIBPERF_FLAG_GROUP) &&
+      attr->inherit)
+    {
+      attr->inherit = 0;
+      fd = sys_perf_event_open(attr, pd->pid, pd->cpu, pd->group, flags);
+    }
+
+  if (fd < 0)
+    return -1;
+
+  pd->counters[counter].fd = fd;
+
+  if (pd->flags & LIBPERF_FLAG_GROUP)
+    {
+      if (ioctl(fd, PERF_EVENT_IOC_ID, &pd->counters[counter].id) == -1)
+        {
+          close(fd);
+          pd->counters[counter].fd = -1;
+          return -1;
+        }
+
+      if (pd->group == -1)
+        pd->group = fd;
+    }
+
+  /* a failed mmap just leaves this counter on the read( ) path */
+  if (pd->flags & LIBPERF_FLAG_MMAP)
+    {
+      void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                        fd, 0);
+
+      if (page != MAP_FAILED)
+        pd->counters[counter].page = page;
+    }
+
+  return fd;
+}
+
+/* checks whether p is the part of a pool block at offset, which is not
+   ours to realloc or free */
+static int
+in_block(struct libperf_data *pd, const void *p, size_t offset)
+{
+  return (pd->flags & __LIBPERF_FLAG_POOLED) && p == (char *) pd + offset;
+}
+
+/* reallocs a table, moving it out of the pool block when it outgrows it */
+static void *
+grow(struct libperf_data *pd, void *p, size_t offset, size_t size,
+     size_t new_size)
+{
+  void *copy;
+
+  if (!in_block(pd, p, offset))
+    return realloc(p, new_size);
+
+  copy = malloc(new_size);
+  if (copy != NULL)
+    memcpy(copy, p, size);
+
+  return copy;
+}
+
+/* grows the counter table by nr closed slots */
+static int
+add_slots(struct libperf_data *pd, int nr)
+{
+  struct counter *counters;
+
+  uint64_t *groupbuf;
+
+  int i;
+
+  counters = grow(pd, pd->counters, __LIBPERF_BLOCK_COUNTERS,
+                  pd->nr_slots * sizeof(*counters),
+                  (pd->nr_slots + nr) * sizeof(*counters));
+  if (counters == NULL)
+    return -1;
+  pd->counters = counters;
+
+  groupbuf = grow(pd, pd->groupbuf, __LIBPERF_BLOCK_GROUPBUF,
+                  __LIBPERF_GROUP_READ_SIZE(pd->nr_slots) * sizeof(*groupbuf),
+                  __LIBPERF_GROUP_READ_SIZE(pd->nr_slots + nr)
+                  * sizeof(*groupbuf));
+  if (groupbuf == NULL)
+    return -1;
+  pd->groupbuf = groupbuf;
+
+  for (i = pd->nr_slots; i < pd->nr_slots + nr; i++)
+    {
+      memset(&counters[i], 0, sizeof(counters[i]));
+      counters[i].fd = -1;
+    }
+
+  pd->nr_slots += nr;
+  return 0;
+}
+
+/* slot of a counter id, -1 for wall time and counters without one */
+static int
+counter_slot(struct libperf_data *pd, int counter)
+{
+  int slot = counter;
+
+  if (counter >= LIBPERF_NR_COUNTERS)
+    slot = counter - LIBPERF_NR_COUNTERS + __LIBPERF_MAX_COUNTERS;
+  else if (counter >= __LIBPERF_MAX_COUNTERS)
+    return -1;
+
+  return (slot >= 0 && slot < pd->nr_slots) ? slot : -1;
+}
+
+int
+__libperf_openoverflow(struct libperf_data *pd, int counter, uint64_t period)
+{
+  int slot = counter_slot(pd, counter);
+
+  struct perf_event_attr attr;
+
+  unsigned long flags = 0;
+
+  int fd;
+
+  if (slot < 0 || period == 0 ||
+      (slot < __LIBPERF_MAX_COUNTERS &&
+       !(libperf_capabilities()->supported & LIBPERF_MASK(counter))))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  attr = *pd->counters[slot].attr;
+  attr.size = sizeof(attr);
+  attr.disabled = 0;
+  attr.inherit = 0;
+  attr.enable_on_exec = 0;
+  attr.read_format = 0;
+  attr.freq = 0;
+  attr.sample_period = period;
+  attr.sample_type = 0;
+  attr.wakeup_events = 1;
+
+  if (pd->flags & __LIBPERF_FLAG_CGROUP)
+    flags |= PERF_FLAG_PID_CGROUP;
+
+  fd = sys_perf_event_open(&attr, pd->pid, pd->cpu, -1, flags);
+
+  /* unprivileged users may only count user space */
+  if (fd < 0 && (errno == EACCES || errno == EPERM) && !attr.exclude_kernel)
+    {
+      attr.exclude_kernel = attr.exclude_hv = 1;
+      fd = sys_perf_event_open(&attr, pd->pid, pd->cpu, -1, flags);
+    }
+
+  return fd;
+}
+
+/* queued records carry every selected counter, then wall time */
+static int
+open_queue(struct libperf_data *pd)
+{
+  const char *names[LIBPERF_NR_COUNTERS];
+
+  int i, nr = 0;
+
+  for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+    if (pd->mask & LIBPERF_MASK(i))
+      pd->log_events[nr++] = i;
+  pd->log_events[nr++] = LIBPERF_LIB_SW_WALL_TIME;
+  pd->nr_log_events = nr;
+
+  for (i = 0; i < nr; i++)
+    names[i] = libperf_eventname(pd->log_events[i]);
+
+  pd->queue = __libperf_logqueue_create(pd->pid, nr, names);
+  return pd->queue == NULL ? -1 : 0;
+}
+
+/* copies the queued counters of values into the next ring slot */
+static void
+queue_values(struct libperf_data *pd, uint32_t region, uint64_t id,
+             const uint64_t *values)
+{
+  uint64_t *slot = __libperf_logqueue_push(pd->queue, region, id);
+
+  int i;
+
+  if (slot == NULL)
+    return;
+
+  for (i = 0; i < pd->nr_log_events; i++)
+    slot[i] = values[pd->log_events[i]];
+
+  __libperf_logqueue_commit(pd->queue);
+}
+
 /* thread safe */
 /* sets up a set of fd's for profiling code to read from */
 struct libperf_data *
 libperf_initialize(pid_t pid, int cpu)
 {
-  int nr_counters = __LIBPERF_ARRAY_SIZE(default_attrs);
-
-  int i;
+  return libperf_initialize_flags(pid, cpu, 0);
+}
 
-  struct libperf_data *pd = malloc(sizeof(struct libperf_data));
+struct libperf_data *
+libperf_initialize_flags(pid_t pid, int cpu, int flags)
+{
+  struct libperf_data *pd =
+    libperf_initialize_mask(pid, cpu, LIBPERF_MASK_ALL, flags);
 
   if (pd == NULL)
     {
-      perror("malloc");
+      perror("libperf_initialize");
       exit(EXIT_FAILURE);
     }
 
-  if (pid == -1)
-    pid = gettid();
+  return pd;
+}
 
-  pd->group = -1;
+/* builtin names of a list select counters, anything else is added */
+static int
+builtin_event(const char *spec)
+{
+  int counter = libperf_eventbyname(spec);
 
-  for (i = 0; i < __LIBPERF_ARRAY_SIZE(pd->fds); i++)
-    pd->fds[i] = -1;
+  return counter >= 0 && counter < __LIBPERF_MAX_COUNTERS ? counter : -1;
+}
 
-  pd->pid = pid;
-  pd->cpu = cpu;
+struct libperf_data *
+libperf_initialize_events(pid_t pid, int cpu, const char *events, int flags)
+{
+  char spec[__LIBPERF_SPEC_MAX];
+
+  struct perf_event_attr attr;
+
+  struct libperf_data *pd;
 
-  char logname[256];
+  const char *p = events;
 
-  struct perf_event_attr *attrs =
-    malloc(nr_counters * sizeof(struct perf_event_attr));
+  uint64_t mask = 0;
 
-  if(attrs == NULL)
+  int counter, result, saved_errno;
+
+  /* check the whole list before opening anything */
+  while ((result = __libperf_nextevent(&p, spec, sizeof(spec))) == 1)
     {
-      perror("malloc");
-      exit(EXIT_FAILURE);
+      counter = builtin_event(spec);
+      if (counter >= 0)
+        mask |= LIBPERF_MASK(counter);
+      else if (libperf_parseattr(spec, &attr) == -1)
+        return NULL;
     }
 
-  memcpy(attrs, default_attrs, sizeof(default_attrs));
-  pd->attrs = attrs;
-  assert(snprintf(logname, sizeof(logname), "%d", pid) >= 0);
+  if (result == -1)
+    return NULL;
 
-  int fd =
-    open(logname, O_WRONLY | O_APPEND | O_CREAT,
-         S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  pd = libperf_initialize_mask(pid, cpu, mask, flags);
+  if (pd == NULL)
+    return NULL;
 
-  assert(fd != -1);
-  pd->log = fdopen(fd, "a");
+  for (p = events; __libperf_nextevent(&p, spec, sizeof(spec)) == 1; )
+    if (builtin_event(spec) < 0 && libperf_addevent(pd, spec) == -1)
+      {
+        saved_errno = errno;
+        libperf_close(pd);
+        errno = saved_errno;
+        return NULL;
+      }
 
-  assert(pd->log != NULL);
+  return pd;
+}
 
-  for (i = 0; i < nr_counters; i++)
-    {
-      attrs[i].size = sizeof(struct perf_event_attr);
-      attrs[i].inherit = 1;          /* default */
-      attrs[i].disabled = 1;         /* disable them now... */
-      attrs[i].enable_on_exec = 0;
-      pd->fds[i] = sys_perf_event_open(&attrs[i], pid, cpu, -1, 0);
-      if (pd->fds[i] < 0)
-	{
-	  fprintf(stderr, "At event %d/%d\n", i, nr_counters);
-	  perror("sys_perf_event_open");
-	  exit(EXIT_FAILURE);
-	}
+int
+libperf_addevent(struct libperf_data *pd, const char *spec)
+{
+  struct perf_event_attr attr, *copy;
+
+  struct counter *c;
+
+  int slot = pd->nr_slots;
+
+  if (libperf_parseattr(spec, &attr) == -1 || add_slots(pd, 1) == -1)
+    return -1;
 
+  c = &pd->counters[slot];
+  copy = malloc(sizeof(*copy));
+  if (copy != NULL)
+    *copy = attr;
+  c->attr = copy;
+  c->name = strdup(spec);
+
+  if (copy == NULL || c->name == NULL ||
+      (!(pd->flags & LIBPERF_FLAG_LAZY) && open_counter(pd, slot) == -1))
+    {
+      free(copy);
+      free(c->name);
+      pd->nr_slots--;
+      return -1;
     }
 
-  pd->wall_start = rdclock();
-  return pd;
+  return slot - __LIBPERF_MAX_COUNTERS + LIBPERF_NR_COUNTERS;
 }
 
-/* thread safe */
-/* pass in int* from initialize function */
-/* reads from fd's, prints out stats, and closes them all */
-void
-libperf_finalize(struct libperf_data *pd, void *id)
+int
+libperf_nrcounters(struct libperf_data *pd)
+{
+  return LIBPERF_NR_COUNTERS + pd->nr_slots - __LIBPERF_MAX_COUNTERS;
+}
+
+const char *
+libperf_countername(struct libperf_data *pd, int counter)
 {
-  int i, result, nr_counters = __LIBPERF_ARRAY_SIZE(default_attrs);
+  int slot = counter_slot(pd, counter);
+
+  if (slot >= __LIBPERF_MAX_COUNTERS)
+    return pd->counters[slot].name;
+
+  return libperf_eventname(counter);
+}
+
+/* opens the counters of a context whose slots are already set up */
+static struct libperf_data *
+init_context(struct libperf_data *pd, pid_t pid, int cpu, uint64_t mask,
+             int flags)
+{
+  int nr_counters = __LIBPERF_ARRAY_SIZE(default_attrs);
+
+  int i, saved_errno;
+
+  const struct libperf_capabilities *caps = libperf_capabilities();
 
-  int *fds = pd->fds;
+  /* cpu-wide contexts really mean "any task" by -1 */
+  if (pid == -1 && !(flags & __LIBPERF_FLAG_SYSTEMWIDE))
+    pid = sys_gettid();
 
-  uint64_t count[3];                 /* potentially 3 values */
+  pd->group = -1;
+
+  /* rdpmc only reads the calling thread's counters */
+  if (!caps->rdpmc || (pid != 0 && pid != sys_gettid()) || cpu != -1)
+    flags &= ~LIBPERF_FLAG_MMAP;
+  pd->flags = flags;
 
-  struct stats event_stats[nr_counters];
+  pd->pid = pid;
+  pd->cpu = cpu;
+  /* counters the probe could not open are skipped without a syscall */
+  pd->mask = mask & LIBPERF_MASK_ALL & caps->supported;
+  pd->log = NULL;
+  pd->regions = NULL;
+  pd->nr_regions = 0;
+  pd->queue = NULL;
+  pd->nr_log_events = 0;
+  pd->metrics = NULL;
+  pd->nr_metrics = 0;
 
-  struct stats walltime_nsecs_stats;
+  /* a context without a single counter would silently read zeros */
+  if ((mask & LIBPERF_MASK_ALL) != 0 && pd->mask == 0)
+    {
+      errno = caps->error != 0 ? caps->error : ENOENT;
+      goto fail;
+    }
 
+  /* every context points at the same attrs, setup_attr applies its own
+     flags to a copy when a counter is opened */
   for (i = 0; i < nr_counters; i++)
-  {
-    assert(fds[i] >= 0);
-    result = read(fds[i], count, sizeof(uint64_t));
-    assert(result == sizeof(uint64_t));
+    {
+      pd->counters[i].attr = &default_attrs[i];
 
-    update_stats(&event_stats[i], count[0]);
+      /* lazy counters are opened by their first enable */
+      if (!(pd->mask & LIBPERF_MASK(i)) || (flags & LIBPERF_FLAG_LAZY))
+        continue;
 
-    close(fds[i]);
-    fds[i] = -1;
+      if (open_counter(pd, i) < 0)
+        goto fail;
+    }
 
-    fprintf(pd->log, "Stats[%p, %d]: %14.0f\n", id, i,
-            avg_stats(&event_stats[i]));
-  }
+  if ((flags & LIBPERF_FLAG_ASYNCLOG) && !(flags & __LIBPERF_FLAG_SYSTEMWIDE) &&
+      open_queue(pd) == -1)
+    goto fail;
+
+  pd->wall_start = rdclock();
+  return pd;
 
-  update_stats(&walltime_nsecs_stats, rdclock() - pd->wall_start);
-  fprintf(pd->log, "Stats[%p, %d]: %14.9f\n", id, i,
-          avg_stats(&walltime_nsecs_stats) / 1e9);
-  fclose(pd->log);
-  free(pd->attrs);
-  free(pd);
+fail:
+  saved_errno = errno;
+  libperf_close(pd);
+  errno = saved_errno;
+  return NULL;
 }
 
-uint64_t
-libperf_readcounter(struct libperf_data *pd, int counter)
+struct libperf_data *
+libperf_initialize_mask(pid_t pid, int cpu, uint64_t mask, int flags)
 {
-  uint64_t value;
+  struct libperf_data *pd = malloc(sizeof(struct libperf_data));
 
-  assert(counter >= 0 && counter < __LIBPERF_MAX_COUNTERS);
+  if (pd == NULL)
+    return NULL;
 
-  if (counter == __LIBPERF_MAX_COUNTERS)
-    return (uint64_t) (rdclock() - pd->wall_start);
+  pd->flags = flags & ~__LIBPERF_FLAG_POOLED;
+  pd->pool = NULL;
+  pd->counters = NULL;
+  pd->nr_slots = 0;
+  pd->groupbuf = NULL;
 
-  assert(read(pd->fds[counter], &value, sizeof(uint64_t)) ==
-         sizeof(uint64_t));
-  
-  return value;
+  if (add_slots(pd, __LIBPERF_MAX_COUNTERS) == -1)
+    {
+      free(pd->counters);
+      free(pd->groupbuf);
+      free(pd);
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  return init_context(pd, pid, cpu, mask, pd->flags);
 }
 
-int
-libperf_enablecounter(struct libperf_data *pd, int counter)
+size_t
+__libperf_blocksize(void)
+{
+  return __LIBPERF_BLOCK_SIZE;
+}
+
+struct libperf_data *
+__libperf_initialize_block(void *block, struct libperf_pool *pool, pid_t pid,
+                           int cpu, uint64_t mask, int flags)
 {
-  assert(counter >= 0 && counter < __LIBPERF_MAX_COUNTERS);
-  if (pd->fds[counter] == -1)
-    assert((pd->fds[counter] = sys_perf_event_open(&(pd->attrs[counter]), pd->pid, pd->cpu, pd->group, 0)) != -1);
+  struct libperf_data *pd = block;
+
+  int i;
+
+  pd->flags = flags | __LIBPERF_FLAG_POOLED;
+  pd->pool = pool;
+  pd->counters = (struct counter *) ((char *) block +
+                                     __LIBPERF_BLOCK_COUNTERS);
+  pd->groupbuf = (uint64_t *) ((char *) block + __LIBPERF_BLOCK_GROUPBUF);
+  pd->nr_slots = __LIBPERF_MAX_COUNTERS;
 
-  return ioctl(pd->fds[counter], PERF_EVENT_IOC_ENABLE);
+  for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+    {
+      memset(&pd->counters[i], 0, sizeof(pd->counters[i]));
+      pd->counters[i].fd = -1;
+    }
+
+  return init_context(pd, pid, cpu, mask, pd->flags);
 }
 
 int
-libperf_disablecounter(struct libperf_data *pd, int counter)
+libperf_eventbyname(const char *name)
 {
-  assert(counter >= 0 && counter < __LIBPERF_MAX_COUNTERS);
-  if (pd->fds[counter] == -1)
-    return 0;
-  
-  return ioctl(pd->fds[counter], PERF_EVENT_IOC_DISABLE);
+  int i;
+
+  for (i = 0; i < __LIBPERF_ARRAY_SIZE(event_names); i++)
+    if (strcasecmp(name, event_names[i].perf) == 0 ||
+        strcasecmp(name, event_names[i].libperf) == 0)
+      return i;
+
+  return -1;
 }
 
-void
-libperf_close(struct libperf_data *pd)
+const char *
+libperf_eventname(int counter)
 {
-  int i, nr_counters = __LIBPERF_ARRAY_SIZE(default_attrs);
+  if (counter == LIBPERF_LIB_SW_WALL_TIME)
+    return "wall-time";
 
-  for (i = 0; i < nr_counters; i++)
-  {
-    assert(pd->fds[i] >= 0);
-    close(pd->fds[i]);
-  }
-  
-  fclose(pd->log);
-  free(pd->attrs);
-  free(pd);
+  if (counter < 0 || counter >= __LIBPERF_ARRAY_SIZE(event_names))
+    return NULL;
+
+  return event_names[counter].perf;
+}
+
+int
+libperf_parseevents(const char *events, uint64_t *mask)
+{
+  char name[64];
+
+  const char *p = events, *end;
+
+  size_t len;
+
+  int counter;
+
+  *mask = 0;
+
+  while (*p != '\0')
+    {
+      end = p + strcspn(p, ",");
+      len = end - p;
+
+      /* tolerate blanks around names */
+      while (len > 0 && isspace((unsigned char) *p))
+        p++, len--;
+      while (len > 0 && isspace((unsigned char) p[len - 1]))
+        len--;
+
+      if (len >= sizeof(name))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      if (len > 0)
+        {
+          memcpy(name, p, len);
+          name[len] = '\0';
+
+          counter = libperf_eventbyname(name);
+          if (counter < 0 || counter >= __LIBPERF_MAX_COUNTERS)
+            {
+              errno = EINVAL;
+              return -1;
+            }
+
+          *mask |= LIBPERF_MASK(counter);
+        }
+
+      p = (*end == ',') ? end + 1 : end;
+    }
+
+  return 0;
+}
+
+/* reads the whole group with one syscall, scattering counts into the
+   count of each slot */
+static int
+read_group(struct libperf_data *pd)
+{
+  uint64_t *buf = pd->groupbuf, i, nr, enabled, running;
+
+  int j = 0, k;
+
+  struct libperf_count *out;
+
+  ssize_t result = read(pd->group, buf, __LIBPERF_GROUP_READ_SIZE(pd->nr_slots)
+                        * sizeof(*buf));
+
+  if (result < (ssize_t) (3 * sizeof(uint64_t)))
+    return -1;
+
+  nr = buf[0];
+  if (nr > pd->nr_slots ||
+      result < (ssize_t) ((3 + 2 * nr) * sizeof(uint64_t)))
+    return -1;
+
+  /* the whole group is scheduled together, so it shares one pair of times */
+  enabled = buf[1];
+  running = buf[2];
+
+  /* the kernel reports members in the order they joined the group */
+  for (i = 0; i < nr; i++)
+    {
+      uint64_t value = buf[3 + 2 * i], id = buf[4 + 2 * i];
+
+      while (j < pd->nr_slots &&
+             (pd->counters[j].fd == -1 || pd->counters[j].id != id))
+        j++;
+
+      if (j == pd->nr_slots)
+        {
+          for (k = 0; k < pd->nr_slots; k++)
+            if (pd->counters[k].fd != -1 && pd->counters[k].id == id)
+              break;
+          if (k == pd->nr_slots)
+            continue;
+          j = k;
+        }
+
+      out = &pd->counters[j].count;
+      out->raw = value;
+      out->time_enabled = enabled;
+      out->time_running = running;
+      scale_count(out);
+      j++;
+    }
+
+  return 0;
+}
+
+/* reads one counter on its own */
+static int
+read_one(struct libperf_data *pd, int counter, struct libperf_count *count)
+{
+  uint64_t buf[3];
+
+  if (pd->counters[counter].page != NULL && mmap_read(pd->counters[counter].page, count) == 0)
+    return 0;
+
+  if (read(pd->counters[counter].fd, buf, sizeof(buf)) != sizeof(buf))
+    return -1;
+
+  count->raw = buf[0];
+  count->time_enabled = buf[1];
+  count->time_running = buf[2];
+  scale_count(count);
+  return 0;
+}
+
+int
+__libperf_readsyscall(struct libperf_data *pd, uint64_t *out)
+{
+  struct libperf_count count;
+
+  uint64_t stackbuf[__LIBPERF_GROUP_READ_SIZE(__LIBPERF_MAX_COUNTERS)];
+
+  uint64_t *buf = stackbuf, i, nr;
+
+  size_t size = sizeof(stackbuf);
+
+  ssize_t result;
+
+  int j;
+
+  memset(out, 0, LIBPERF_NR_COUNTERS * sizeof(*out));
+
+  if ((pd->flags & LIBPERF_FLAG_GROUP) && pd->group != -1)
+    {
+      /* added events lengthen the reply past the builtin counters */
+      if (pd->nr_slots > __LIBPERF_MAX_COUNTERS)
+        {
+          size = __LIBPERF_GROUP_READ_SIZE(pd->nr_slots) * sizeof(*buf);
+          buf = malloc(size);
+          if (buf == NULL)
+            return -1;
+        }
+
+      result = read(pd->group, buf, size);
+      nr = result >= (ssize_t) (3 * sizeof(uint64_t)) ? buf[0] : 0;
+      if (result < (ssize_t) ((3 + 2 * nr) * sizeof(uint64_t)))
+        {
+          if (buf != stackbuf)
+            free(buf);
+          return -1;
+        }
+
+      count.time_enabled = buf[1];
+      count.time_running = buf[2];
+
+      for (i = 0; i < nr; i++)
+        for (j = 0; j < __LIBPERF_MAX_COUNTERS; j++)
+          if (pd->counters[j].fd != -1 && pd->counters[j].id == buf[4 + 2 * i])
+            {
+              count.raw = buf[3 + 2 * i];
+              scale_count(&count);
+              out[j] = count.value;
+              break;
+            }
+
+      if (buf != stackbuf)
+        free(buf);
+    }
+  else if (!(pd->flags & LIBPERF_FLAG_GROUP))
+    {
+      for (j = 0; j < __LIBPERF_MAX_COUNTERS; j++)
+        {
+          if (pd->counters[j].fd == -1)
+            continue;
+
+          if (read(pd->counters[j].fd, buf, 3 * sizeof(uint64_t)) !=
+              3 * sizeof(uint64_t))
+            return -1;
+
+          count.raw = buf[0];
+          count.time_enabled = buf[1];
+          count.time_running = buf[2];
+          scale_count(&count);
+          out[j] = count.value;
+        }
+    }
+
+  out[LIBPERF_LIB_SW_WALL_TIME] = rdclock() - pd->wall_start;
+  return 0;
+}
+
+uint64_t
+__libperf_openmask(struct libperf_data *pd)
+{
+  uint64_t mask = 0;
+
+  int i;
+
+  for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+    if (pd->counters[i].fd != -1)
+      mask |= LIBPERF_MASK(i);
+
+  return mask;
+}
+
+pid_t
+__libperf_pid(struct libperf_data *pd)
+{
+  return pd->pid;
+}
+
+int
+__libperf_cpu(struct libperf_data *pd)
+{
+  return pd->cpu;
+}
+
+/* encodes the final counts and region stats as binary log records */
+static void
+encode_log(struct libperf_data *pd, void *id, const struct libperf_count *count,
+           struct __libperf_logbuf *b)
+{
+  const char **names = malloc((pd->nr_slots + 1) * sizeof(*names));
+
+  int *events = malloc((pd->nr_slots + 1) * sizeof(*events)), nr = 0, i, j;
+
+  struct libperf_count *counts = malloc((pd->nr_slots + 1) * sizeof(*counts));
+
+  uint64_t timestamp = __libperf_realtime(), *values;
+
+  struct libperf_stats *stats;
+
+  double deltas[LIBPERF_NR_COUNTERS];
+
+  if (names == NULL || events == NULL || counts == NULL)
+    {
+      b->error = 1;
+      goto out;
+    }
+
+  /* the schema lists the open counters, then wall time, then the open
+     events added by spec */
+  for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+    if (pd->counters[i].fd != -1)
+      counts[nr] = count[i], events[nr++] = i;
+  counts[nr] = count[LIBPERF_LIB_SW_WALL_TIME];
+  events[nr++] = LIBPERF_LIB_SW_WALL_TIME;
+
+  /* the group read behind count[] already covered the added events */
+  for (; i < pd->nr_slots; i++)
+    if (pd->counters[i].fd != -1)
+      {
+        if (pd->flags & LIBPERF_FLAG_GROUP)
+          counts[nr] = pd->counters[i].count;
+        else if (read_one(pd, i, &counts[nr]) == -1)
+          memset(&counts[nr], 0, sizeof(counts[nr]));
+        events[nr++] = i - __LIBPERF_MAX_COUNTERS + LIBPERF_NR_COUNTERS;
+      }
+
+  for (i = 0; i < nr; i++)
+    names[i] = libperf_countername(pd, events[i]);
+
+  __libperf_logbuf_schema(b, nr, names);
+
+  for (j = 0; j < pd->nr_regions; j++)
+    __libperf_logbuf_region(b, j, pd->regions[j].name);
+
+  values = __libperf_logbuf_record(b, LIBPERF_LOG_VALUES, timestamp, pd->pid,
+                                   LIBPERF_LOG_NOREGION, (uintptr_t) id,
+                                   nr * sizeof(uint64_t));
+  if (values != NULL)
+    for (i = 0; i < nr; i++)
+      values[i] = counts[i].value;
+
+  values = __libperf_logbuf_record(b, LIBPERF_LOG_TIMES, timestamp, pd->pid,
+                                   LIBPERF_LOG_NOREGION, (uintptr_t) id,
+                                   2 * nr * sizeof(uint64_t));
+  if (values != NULL)
+    for (i = 0; i < nr; i++)
+      {
+        values[i] = counts[i].time_enabled;
+        values[nr + i] = counts[i].time_running;
+      }
+
+  for (j = 0; j < pd->nr_regions; j++)
+    {
+      stats = __libperf_logbuf_record(b, LIBPERF_LOG_STATS, timestamp,
+                                      pd->pid, j, (uintptr_t) id,
+                                      nr * sizeof(*stats));
+      if (stats != NULL)
+        for (i = 0; i < nr; i++)
+          libperf_region_stats(pd, j, events[i], &stats[i]);
+    }
+
+  /* metrics over the whole run, then over each region's mean deltas */
+  for (i = 0; i < pd->nr_metrics; i++)
+    {
+      for (j = 0; j < LIBPERF_NR_COUNTERS; j++)
+        deltas[j] = count[j].value;
+
+      __libperf_logbuf_metric(b, timestamp, pd->pid, LIBPERF_LOG_NOREGION,
+                              (uintptr_t) id,
+                              __libperf_metric_name(pd->metrics[i]),
+                              __libperf_metric_eval(pd->metrics[i], deltas));
+
+      for (j = 0; j < pd->nr_regions; j++)
+        __libperf_logbuf_metric(b, timestamp, pd->pid, j, (uintptr_t) id,
+                                __libperf_metric_name(pd->metrics[i]),
+                                libperf_region_metric(pd, j, i));
+    }
+
+out:
+  free(names);
+  free(events);
+  free(counts);
+}
+
+/* appends the final counts and region stats to the binary log */
+static int
+write_log(struct libperf_data *pd, void *id, const struct libperf_count *count)
+{
+  struct __libperf_logbuf b = { NULL, 0, 0, 0 };
+
+  char path[PATH_MAX];
+
+  int result;
+
+  encode_log(pd, id, count, &b);
+
+  /* the logger thread writes them after the last queued record */
+  if (pd->queue != NULL)
+    {
+      __libperf_logqueue_close(pd->queue, &b);
+      pd->queue = NULL;
+      return 0;
+    }
+
+  /* pooled contexts share the process's log, records carry their tid */
+  result = __libperf_logpath(path, sizeof(path),
+                             (pd->flags & __LIBPERF_FLAG_POOLED) ?
+                             getpid() : pd->pid, ".libperf");
+  if (result == 0)
+    result = __libperf_logbuf_append(&b, path);
+
+  __libperf_logbuf_free(&b);
+  return result;
+}
+
+/* thread safe */
+/* pass in int* from initialize function */
+/* reads from fd's, logs them, and closes them all */
+void
+libperf_finalize(struct libperf_data *pd, void *id)
+{
+  struct libperf_count count[LIBPERF_NR_COUNTERS];
+
+  int result;
+
+  result = libperf_readcounts(pd, count);
+  assert(result == 0);
+
+  result = write_log(pd, id, count);
+  if (result == -1)
+    perror("libperf_finalize");
+
+  libperf_close(pd);
+}
+
+uint64_t
+libperf_readcounter(struct libperf_data *pd, int counter)
+{
+  struct libperf_count count;
+
+  int result;
+
+  result = libperf_readcount(pd, counter, &count);
+  assert(result == 0);
+
+  return count.value;
+}
+
+int
+libperf_readcount(struct libperf_data *pd, int counter,
+                  struct libperf_count *count)
+{
+  int slot = counter_slot(pd, counter);
+
+  assert(counter >= 0 && counter < libperf_nrcounters(pd));
+
+  memset(count, 0, sizeof(*count));
+
+  if (counter == LIBPERF_LIB_SW_WALL_TIME)
+    {
+      count->raw = count->value = rdclock() - pd->wall_start;
+      count->time_enabled = count->time_running = count->raw;
+      return 0;
+    }
+
+  if (slot == -1 || pd->counters[slot].fd == -1)
+    return 0;
+
+  if (pd->flags & LIBPERF_FLAG_GROUP)
+    {
+      if (pd->counters[slot].page != NULL &&
+          mmap_read(pd->counters[slot].page, count) == 0)
+        return 0;
+
+      memset(&pd->counters[slot].count, 0, sizeof(*count));
+      if (read_group(pd) == -1)
+        return -1;
+      *count = pd->counters[slot].count;
+      return 0;
+    }
+
+  return read_one(pd, slot, count);
+}
+
+int
+libperf_readall(struct libperf_data *pd, uint64_t *out)
+{
+  struct libperf_count counts[LIBPERF_NR_COUNTERS];
+
+  int i;
+
+  if (libperf_readcounts(pd, counts) == -1)
+    return -1;
+
+  for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+    out[i] = counts[i].value;
+
+  return 0;
+}
+
+int
+libperf_readcounts(struct libperf_data *pd, struct libperf_count *out)
+{
+  int i;
+
+  uint64_t wall;
+
+  /* counters that are not open read as zero */
+  memset(out, 0, LIBPERF_NR_COUNTERS * sizeof(*out));
+
+  if (pd->flags & LIBPERF_FLAG_GROUP)
+    {
+      if (pd->group != -1 && read_group(pd) == -1)
+        return -1;
+
+      for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+        if (pd->counters[i].fd != -1)
+          out[i] = pd->counters[i].count;
+    }
+  else
+    {
+      for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+        if (pd->counters[i].fd != -1 && read_one(pd, i, &out[i]) == -1)
+          return -1;
+    }
+
+  wall = rdclock() - pd->wall_start;
+  out[LIBPERF_LIB_SW_WALL_TIME].raw = wall;
+  out[LIBPERF_LIB_SW_WALL_TIME].value = wall;
+  out[LIBPERF_LIB_SW_WALL_TIME].time_enabled = wall;
+  out[LIBPERF_LIB_SW_WALL_TIME].time_running = wall;
+  return 0;
+}
+
+double
+libperf_countratio(const struct libperf_count *count)
+{
+  if (count->time_enabled == 0)
+    return 0.0;
+
+  return (double) count->time_running / count->time_enabled;
+}
+
+int
+libperf_enablecounter(struct libperf_data *pd, int counter)
+{
+  int slot = counter_slot(pd, counter);
+
+  assert(slot >= 0);
+  if (slot < __LIBPERF_MAX_COUNTERS &&
+      !(libperf_capabilities()->supported & LIBPERF_MASK(counter)))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+
+  if (pd->counters[slot].fd == -1 && open_counter(pd, slot) == -1)
+    return -1;
+
+  return ioctl(pd->counters[slot].fd, PERF_EVENT_IOC_ENABLE);
+}
+
+int
+libperf_disablecounter(struct libperf_data *pd, int counter)
+{
+  int slot = counter_slot(pd, counter);
+
+  assert(slot >= 0);
+  if (pd->counters[slot].fd == -1)
+    return 0;
+  
+  return ioctl(pd->counters[slot].fd, PERF_EVENT_IOC_DISABLE);
+}
+
+/* applies an ioctl to the whole group, or to every open counter */
+static int
+ioctl_all(struct libperf_data *pd, unsigned long request)
+{
+  int i, result = 0;
+
+  if (pd->flags & LIBPERF_FLAG_GROUP)
+    {
+      if (pd->group == -1)
+        return 0;
+      return ioctl(pd->group, request, PERF_IOC_FLAG_GROUP);
+    }
+
+  for (i = 0; i < pd->nr_slots; i++)
+    if (pd->counters[i].fd != -1 && ioctl(pd->counters[i].fd, request) == -1)
+      result = -1;
+
+  return result;
+}
+
+int
+libperf_enableall(struct libperf_data *pd)
+{
+  int i;
+
+  /* open whatever LIBPERF_FLAG_LAZY left closed */
+  for (i = 0; i < pd->nr_slots; i++)
+    if ((i >= __LIBPERF_MAX_COUNTERS || (pd->mask & LIBPERF_MASK(i))) &&
+        pd->counters[i].fd == -1 && open_counter(pd, i) == -1)
+      return -1;
+
+  return ioctl_all(pd, PERF_EVENT_IOC_ENABLE);
+}
+
+int
+libperf_disableall(struct libperf_data *pd)
+{
+  return ioctl_all(pd, PERF_EVENT_IOC_DISABLE);
+}
+
+int
+libperf_resetall(struct libperf_data *pd)
+{
+  return ioctl_all(pd, PERF_EVENT_IOC_RESET);
+}
+
+void
+libperf_close(struct libperf_data *pd)
+{
+  int i;
+
+  /* members first so the leader is the last one torn down */
+  for (i = pd->nr_slots - 1; i >= 0; i--)
+  {
+    if (pd->counters[i].page != NULL)
+      munmap(pd->counters[i].page, sysconf(_SC_PAGESIZE));
+    if (pd->counters[i].fd >= 0)
+      close(pd->counters[i].fd);
+    if (i >= __LIBPERF_MAX_COUNTERS)
+      free((void *) pd->counters[i].attr);
+    free(pd->counters[i].name);
+  }
+  
+  for (i = 0; i < pd->nr_regions; i++)
+    {
+      free(pd->regions[i].name);
+      free(pd->regions[i].stats);
+      free(pd->regions[i].added_start);
+      free(pd->regions[i].added_stats);
+    }
+  free(pd->regions);
+
+  if (pd->queue != NULL)
+    {
+      struct __libperf_logbuf none = { NULL, 0, 0, 0 };
+
+      __libperf_logqueue_close(pd->queue, &none);
+    }
+
+  if (pd->log != NULL)
+    fclose(pd->log);
+  for (i = 0; i < pd->nr_metrics; i++)
+    __libperf_metric_free(pd->metrics[i]);
+  free(pd->metrics);
+
+  if (!in_block(pd, pd->counters, __LIBPERF_BLOCK_COUNTERS))
+    free(pd->counters);
+  if (!in_block(pd, pd->groupbuf, __LIBPERF_BLOCK_GROUPBUF))
+    free(pd->groupbuf);
+
+  if (pd->flags & __LIBPERF_FLAG_POOLED)
+    __libperf_pool_release(pd->pool, pd);
+  else
+    free(pd);
+}
+
+int
+libperf_region_id(struct libperf_data *pd, const char *name)
+{
+  struct region *regions, *r;
+
+  int i;
+
+  for (i = 0; i < pd->nr_regions; i++)
+    if (strcmp(pd->regions[i].name, name) == 0)
+      return i;
+
+  regions = realloc(pd->regions, (pd->nr_regions + 1) * sizeof(*regions));
+  if (regions == NULL)
+    return -1;
+  pd->regions = regions;
+
+  r = &regions[pd->nr_regions];
+  memset(r->start, 0, sizeof(r->start));
+  r->name = strdup(name);
+  r->stats = calloc(LIBPERF_NR_COUNTERS, sizeof(*r->stats));
+  r->added_start = NULL;
+  r->added_stats = NULL;
+  r->nr_added = 0;
+
+  if (r->name == NULL || r->stats == NULL)
+    {
+      free(r->name);
+      free(r->stats);
+      return -1;
+    }
+
+  if (pd->queue != NULL &&
+      __libperf_logqueue_region(pd->queue, pd->nr_regions, name) == -1)
+    {
+      free(r->name);
+      free(r->stats);
+      return -1;
+    }
+
+  return pd->nr_regions++;
+}
+
+const char *
+libperf_region_name(struct libperf_data *pd, int region)
+{
+  if (region < 0 || region >= pd->nr_regions)
+    return NULL;
+
+  return pd->regions[region].name;
+}
+
+/* makes room in a region for the events added since it was last used */
+static int
+region_added(struct libperf_data *pd, struct region *r)
+{
+  int nr = pd->nr_slots - __LIBPERF_MAX_COUNTERS;
+
+  uint64_t *start;
+
+  struct stats *stats;
+
+  if (r->nr_added >= nr)
+    return 0;
+
+  start = realloc(r->added_start, nr * sizeof(*start));
+  if (start == NULL)
+    return -1;
+  r->added_start = start;
+
+  stats = realloc(r->added_stats, nr * sizeof(*stats));
+  if (stats == NULL)
+    return -1;
+  r->added_stats = stats;
+
+  memset(&start[r->nr_added], 0, (nr - r->nr_added) * sizeof(*start));
+  memset(&stats[r->nr_added], 0, (nr - r->nr_added) * sizeof(*stats));
+  r->nr_added = nr;
+  return 0;
+}
+
+/* value of an added event right after libperf_readall, whose group read
+   already covered it */
+static int
+added_value(struct libperf_data *pd, int slot, uint64_t *value)
+{
+  struct libperf_count count;
+
+  if (pd->flags & LIBPERF_FLAG_GROUP)
+    count = pd->counters[slot].count;
+  else if (read_one(pd, slot, &count) == -1)
+    return -1;
+
+  *value = count.value;
+  return 0;
+}
+
+int
+libperf_region_begin(struct libperf_data *pd, int region)
+{
+  struct region *r;
+
+  int i;
+
+  assert(region >= 0 && region < pd->nr_regions);
+  r = &pd->regions[region];
+
+  if (libperf_readall(pd, r->start) == -1)
+    return -1;
+
+  if (pd->nr_slots == __LIBPERF_MAX_COUNTERS)
+    return 0;
+
+  if (region_added(pd, r) == -1)
+    return -1;
+
+  for (i = __LIBPERF_MAX_COUNTERS; i < pd->nr_slots; i++)
+    if (pd->counters[i].fd != -1 &&
+        added_value(pd, i, &r->added_start[i - __LIBPERF_MAX_COUNTERS]) == -1)
+      return -1;
+
+  return 0;
+}
+
+int
+libperf_region_end(struct libperf_data *pd, int region)
+{
+  uint64_t now[LIBPERF_NR_COUNTERS];
+
+  struct region *r;
+
+  uint64_t value;
+
+  int i, k;
+
+  assert(region >= 0 && region < pd->nr_regions);
+  r = &pd->regions[region];
+
+  if (libperf_readall(pd, now) == -1)
+    return -1;
+
+  /* scaled estimates can step backwards slightly, clamp those at zero */
+  for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+    {
+      now[i] = now[i] > r->start[i] ? now[i] - r->start[i] : 0;
+      if (pd->counters[i].fd != -1)
+        update_stats(&r->stats[i], now[i]);
+    }
+
+  now[LIBPERF_LIB_SW_WALL_TIME] -= r->start[LIBPERF_LIB_SW_WALL_TIME];
+  update_stats(&r->stats[LIBPERF_LIB_SW_WALL_TIME],
+               now[LIBPERF_LIB_SW_WALL_TIME]);
+
+  /* events added after the region began count from zero this time */
+  if (pd->nr_slots > __LIBPERF_MAX_COUNTERS && region_added(pd, r) == -1)
+    return -1;
+
+  for (i = __LIBPERF_MAX_COUNTERS; i < pd->nr_slots; i++)
+    {
+      if (pd->counters[i].fd == -1)
+        continue;
+
+      if (added_value(pd, i, &value) == -1)
+        return -1;
+
+      k = i - __LIBPERF_MAX_COUNTERS;
+      update_stats(&r->added_stats[k], value > r->added_start[k] ?
+                   value - r->added_start[k] : 0);
+    }
+
+  /* every iteration becomes a record when logging asynchronously */
+  if (pd->queue != NULL)
+    queue_values(pd, region, 0, now);
+  return 0;
+}
+
+int
+libperf_logsnapshot(struct libperf_data *pd, uint64_t id)
+{
+  uint64_t now[LIBPERF_NR_COUNTERS];
+
+  if (pd->queue == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (libperf_readall(pd, now) == -1)
+    return -1;
+
+  queue_values(pd, LIBPERF_LOG_NOREGION, id, now);
+  return 0;
+}
+
+int
+libperf_region_stats(struct libperf_data *pd, int region, int counter,
+                     struct libperf_stats *stats)
+{
+  static struct stats none;
+
+  struct region *r;
+
+  struct stats *st;
+
+  int slot = counter_slot(pd, counter);
+
+  if (region < 0 || region >= pd->nr_regions || counter < 0 ||
+      (counter >= LIBPERF_NR_COUNTERS && slot == -1))
+    return -1;
+
+  r = &pd->regions[region];
+
+  if (counter < LIBPERF_NR_COUNTERS)
+    st = &r->stats[counter];
+  else if (slot - __LIBPERF_MAX_COUNTERS < r->nr_added)
+    st = &r->added_stats[slot - __LIBPERF_MAX_COUNTERS];
+  else
+    st = &none;
+  stats->n = st->n;
+  stats->mean = avg_stats(st);
+  stats->variance = var_stats(st);
+  stats->min = st->min;
+  stats->max = st->max;
+  return 0;
+}
+
+int
+libperf_addmetric(struct libperf_data *pd, const char *metric)
+{
+  struct __libperf_metric *m = __libperf_metric_compile(metric), **metrics;
+
+  uint64_t need;
+
+  int i;
+
+  if (m == NULL)
+    return -1;
+
+  /* wall time needs no counter */
+  need = __libperf_metric_mask(m) & LIBPERF_MASK_ALL;
+  if (need & ~libperf_capabilities()->supported)
+    {
+      errno = ENOENT;
+      goto fail;
+    }
+
+  for (i = 0; i < __LIBPERF_MAX_COUNTERS; i++)
+    if ((need & LIBPERF_MASK(i)) && pd->counters[i].fd == -1)
+      {
+        pd->mask |= LIBPERF_MASK(i);
+        if (!(pd->flags & LIBPERF_FLAG_LAZY) && open_counter(pd, i) == -1)
+          goto fail;
+      }
+
+  metrics = realloc(pd->metrics, (pd->nr_metrics + 1) * sizeof(*metrics));
+  if (metrics == NULL)
+    goto fail;
+  pd->metrics = metrics;
+
+  metrics[pd->nr_metrics] = m;
+  return pd->nr_metrics++;
+
+fail:
+  __libperf_metric_free(m);
+  return -1;
+}
+
+int
+libperf_nrmetrics(struct libperf_data *pd)
+{
+  return pd->nr_metrics;
+}
+
+const char *
+libperf_metricname(struct libperf_data *pd, int metric)
+{
+  if (metric < 0 || metric >= pd->nr_metrics)
+    return NULL;
+
+  return __libperf_metric_name(pd->metrics[metric]);
+}
+
+double
+libperf_evalmetric(struct libperf_data *pd, int metric,
+                   const uint64_t *before, const uint64_t *after)
+{
+  double deltas[LIBPERF_NR_COUNTERS];
+
+  uint64_t start;
+
+  int i;
+
+  if (metric < 0 || metric >= pd->nr_metrics)
+    return NAN;
+
+  for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+    {
+      start = before != NULL ? before[i] : 0;
+      deltas[i] = after[i] > start ? after[i] - start : 0;
+    }
+
+  return __libperf_metric_eval(pd->metrics[metric], deltas);
+}
+
+double
+libperf_region_metric(struct libperf_data *pd, int region, int metric)
+{
+  double deltas[LIBPERF_NR_COUNTERS];
+
+  struct stats *st;
+
+  int i;
+
+  if (region < 0 || region >= pd->nr_regions ||
+      metric < 0 || metric >= pd->nr_metrics)
+    return NAN;
+
+  st = pd->regions[region].stats;
+  if (st[LIBPERF_LIB_SW_WALL_TIME].n == 0)
+    return NAN;
+
+  for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+    deltas[i] = avg_stats(&st[i]);
+
+  return __libperf_metric_eval(pd->metrics[metric], deltas);
 }
 
 FILE *
 libperf_getlogger(struct libperf_data *pd)
 {
+  char path[PATH_MAX];
+
+  if (pd->flags & __LIBPERF_FLAG_POOLED)
+    return __libperf_pool_logger(pd->pool);
+
+  /* only contexts that actually log text pay for a FILE* */
+  if (pd->log == NULL &&
+      __libperf_logpath(path, sizeof(path), pd->pid, "") == 0)
+    pd->log = fopen(path, "a");
+
   return pd->log;
 }
 
@@ -326,7 +1837,7 @@ libperf_unit_test(void *n)
   for (i = 0; i < 1024 * 1024 * 1024L; i++)
     x[i] = (char) i;
 
-  fprintf(pd->log, "libperf_readcounter[0]: %" PRIu64 "\n",
+  fprintf(libperf_getlogger(pd), "libperf_readcounter[0]: %" PRIu64 "\n",
           libperf_readcounter(pd, 0));
   
   libperf_finalize(pd, 0);
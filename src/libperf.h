@@ -53,6 +53,9 @@ extern "C" {
 /* lib struct */
 struct libperf_data;
 
+/* <linux/perf_event.h> */
+struct perf_event_attr;
+
 /* lib constants */
 enum libperf_tracepoint
 {
@@ -112,9 +115,59 @@ enum libperf_tracepoint
 	LIBPERF_LIB_SW_WALL_TIME = 33
 };
 
+/* number of values filled in by libperf_readall */
+#define LIBPERF_NR_COUNTERS (LIBPERF_LIB_SW_WALL_TIME + 1)
+
+/* counter selection masks for libperf_initialize_mask */
+#define LIBPERF_MASK(counter) (1ULL << (counter))
+#define LIBPERF_MASK_ALL (LIBPERF_MASK(LIBPERF_COUNT_HW_CACHE_BPU_LOADS_MISSES) - 1)
+
+/* a counter value together with how long it was enabled and how long it
+ * was actually running on the PMU; when the kernel multiplexes more events
+ * than the PMU has counters, value is the raw count extrapolated by
+ * time_enabled / time_running */
+struct libperf_count
+{
+	uint64_t value;             /* scaled estimate */
+	uint64_t raw;               /* count while running */
+	uint64_t time_enabled;      /* ns the counter was enabled */
+	uint64_t time_running;      /* ns the counter was on the PMU */
+};
+
+/* running statistics of a counter over many samples */
+struct libperf_stats
+{
+	uint64_t n;                 /* number of samples */
+	double mean;
+	double variance;            /* sample variance, 0 below two samples */
+	double min;
+	double max;
+};
+
+/* initialization flags */
+enum libperf_flags
+{
+	/* open all counters as one group read with a single syscall */
+	LIBPERF_FLAG_GROUP = 1 << 0,
+
+	/* read counters from user space via the mmap'd event page and rdpmc,
+	 * falling back to read( ) when the kernel does not allow rdpmc; only
+	 * honored when monitoring the calling thread on any cpu, and turns
+	 * off inheritance since children's counts are not visible there */
+	LIBPERF_FLAG_MMAP = 1 << 1,
+
+	/* do not open selected counters until they are first enabled */
+	LIBPERF_FLAG_LAZY = 1 << 2,
+
+	/* hand binary log records to the background logger instead of
+	 * writing them from the measured thread, see libperf_logger_start */
+	LIBPERF_FLAG_ASYNCLOG = 1 << 3
+};
+
 /* libperf_initialize
  *
- * This function initializes the library.
+ * This function initializes the library with every counter this kernel
+ * and PMU support, see libperf_capabilities.
  *
  * int pid - pass in gettid()/getpid() value, -1 for current process
  * int cpu - pass in cpuid to track, -1 for any
@@ -124,12 +177,217 @@ enum libperf_tracepoint
 struct libperf_data *
 libperf_initialize(int pid, int cpu);
 
+/* libperf_initialize_flags
+ *
+ * This function initializes the library like libperf_initialize, but
+ * accepts flags from enum libperf_flags.  With LIBPERF_FLAG_GROUP the
+ * first counter becomes a group leader and the rest join its group, so
+ * libperf_readall takes one consistent snapshot in one read( ).  Note
+ * that the kernel only schedules a group if all of its hardware events
+ * fit on the PMU at once.
+ *
+ * int pid - pass in gettid()/getpid() value, -1 for current process
+ * int cpu - pass in cpuid to track, -1 for any
+ * int flags - bitwise or of values from enum libperf_flags
+ *
+ * return - libperf_data structure for use in future library calls
+ */
+struct libperf_data *
+libperf_initialize_flags(int pid, int cpu, int flags);
+
+/* libperf_initialize_mask
+ *
+ * This function initializes the library with only the selected counters
+ * open, instead of every counter in enum libperf_tracepoint.  Counters
+ * this kernel or PMU does not support according to libperf_capabilities
+ * are skipped without a system call and read as zero.  Unlike
+ * libperf_initialize it never exits the process: if a supported counter
+ * fails to open it returns NULL with errno set by sys_perf_event_open( ).
+ *
+ * int pid - pass in gettid()/getpid() value, -1 for current process
+ * int cpu - pass in cpuid to track, -1 for any
+ * uint64_t mask - bitwise or of LIBPERF_MASK(counter) values
+ * int flags - bitwise or of values from enum libperf_flags
+ *
+ * return - libperf_data structure, or NULL with errno set
+ */
+struct libperf_data *
+libperf_initialize_mask(int pid, int cpu, uint64_t mask, int flags);
+
+/* what the kernel and PMU of this machine can do, probed once */
+struct libperf_capabilities
+{
+	uint64_t supported;         /* LIBPERF_MASK bits of counters that open */
+	int paranoid;               /* perf_event_paranoid, INT_MAX if unknown */
+	int rdpmc;                  /* user space may read counters by rdpmc */
+	int error;                  /* errno of the last counter that failed */
+};
+
+/* libperf_capabilities
+ *
+ * This function probes every counter in enum libperf_tracepoint on the
+ * calling thread the first time any thread calls it, and returns the
+ * cached result after that.  Every initialization uses it.
+ *
+ * Counters the kernel refuses with EACCES or EPERM, as it does under
+ * perf_event_paranoid 2 and up, are probed again for user space only,
+ * and contexts then count them the same way.  The probe counts a thread
+ * with the credentials of its first caller; cpu-wide and cgroup contexts,
+ * or a caller that changes its credentials later, may still fail to open
+ * a counter it reported as supported.  A context whose requested counters
+ * are all unsupported fails with the error of the probe.
+ *
+ * return - capabilities of this process, never NULL
+ */
+const struct libperf_capabilities *
+libperf_capabilities(void);
+
+/* libperf_initialize_events
+ *
+ * This function initializes the library with the counters named in a
+ * comma separated list, for example "cycles,instructions,L1D_LOADS_MISSES".
+ * Names are matched case insensitively against both the perf tool names
+ * and the enum libperf_tracepoint names without their LIBPERF_COUNT_*_
+ * prefix.  Any other entry is an event spec (see libperf_parseattr) added
+ * with libperf_addevent, in list order, so "cycles,msr/tsc/,r01c2:u"
+ * works too.
+ *
+ * int pid - pass in gettid()/getpid() value, -1 for current process
+ * int cpu - pass in cpuid to track, -1 for any
+ * const char* events - comma separated list of counter names and specs
+ * int flags - bitwise or of values from enum libperf_flags
+ *
+ * return - libperf_data structure, or NULL with errno set (EINVAL for
+ *          an unknown name or a malformed spec)
+ */
+struct libperf_data *
+libperf_initialize_events(int pid, int cpu, const char *events, int flags);
+
+/* libperf_parseevents
+ *
+ * This function turns a comma separated list of counter names into a
+ * mask for libperf_initialize_mask.
+ *
+ * const char* events - comma separated list of counter names
+ * uint64_t* mask - filled in with the selected counters
+ *
+ * return - 0 on success, -1 with errno set to EINVAL for an unknown name
+ */
+int
+libperf_parseevents(const char *events, uint64_t *mask);
+
+/* libperf_parseattr
+ *
+ * This function turns a perf tool style event spec into a perf_event_attr,
+ * without opening anything.  Accepted forms are:
+ *
+ *   cycles, LL_LOADS_MISSES      - builtin counter names
+ *   r01c2                        - raw PERF_TYPE_RAW config in hex
+ *   4:0x3c                       - numeric type:config
+ *   cpu/event=0x3c,umask=0x1/    - pmu terms, placed by the pmu's sysfs
+ *                                  format/ bit ranges; config, config1,
+ *                                  config2, period and exclude_user,
+ *                                  exclude_kernel, exclude_hv, exclude_idle
+ *                                  are understood directly
+ *   msr/tsc/, tsc                - sysfs events/ aliases of a pmu, the bare
+ *                                  name being looked up in every pmu
+ *   sched:sched_switch           - kernel tracepoint subsystem:name, its
+ *                                  id read from tracefs events/; counts
+ *                                  hits, which normally needs root or a
+ *                                  perf_event_paranoid of -1
+ *
+ * followed by optional modifiers, ":ukh" or, for pmu specs, directly after
+ * the closing slash: u, k and h count only the privilege levels given, G
+ * and H exclude the host or the guest, I excludes idle and each p raises
+ * precise_ip.  Vendor event names from the perf tool's JSON tables are not
+ * known, use their pmu/event=..,umask=../ form.
+ *
+ * const char* spec - event spec
+ * struct perf_event_attr* attr - filled in, read_format and the flags
+ *                                libperf sets itself are left zero
+ *
+ * return - 0 on success, -1 with errno set to EINVAL for a spec that does
+ *          not parse or names an unknown pmu, event or format term, or
+ *          ENOENT for an unknown tracepoint or no tracefs
+ */
+int
+libperf_parseattr(const char *spec, struct perf_event_attr *attr);
+
+/* libperf_addevent
+ *
+ * This function adds an event spec (see libperf_parseattr) to a context.
+ * The event gets a counter id of its own, from LIBPERF_NR_COUNTERS on,
+ * that libperf_readcounter, libperf_readcount, libperf_enablecounter and
+ * libperf_disablecounter accept.  It joins the group, is opened now unless
+ * the context is LIBPERF_FLAG_LAZY, starts disabled and is covered by
+ * libperf_enableall and friends, and regions gather statistics for it.
+ * libperf_finalize logs it after wall time; queued LIBPERF_FLAG_ASYNCLOG
+ * records only cover the builtin counters.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * const char* spec - event spec
+ *
+ * return - counter id, or -1 with errno set
+ */
+int
+libperf_addevent(struct libperf_data *pd, const char *spec);
+
+/* libperf_nrcounters
+ *
+ * This function returns the number of counter ids of a context, that is
+ * LIBPERF_NR_COUNTERS plus the events added with libperf_addevent.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ *
+ * return - one past the highest counter id
+ */
+int
+libperf_nrcounters(struct libperf_data *pd);
+
+/* libperf_countername
+ *
+ * This function names a counter id of a context: libperf_eventname for
+ * builtin counters, the spec for added events.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int counter - counter id
+ *
+ * return - string owned by the context, or NULL for an invalid id
+ */
+const char *
+libperf_countername(struct libperf_data *pd, int counter);
+
+/* libperf_eventbyname
+ *
+ * This function looks up a counter by name.
+ *
+ * const char* name - perf tool or enum libperf_tracepoint style name
+ *
+ * return - constant from enum libperf_tracepoint, or -1 if unknown
+ */
+int
+libperf_eventbyname(const char *name);
+
+/* libperf_eventname
+ *
+ * This function returns the perf tool style name of a counter.
+ *
+ * int counter - pass in a constant value defined in enum libperf_tracepoint
+ *
+ * return - static string, or NULL for an invalid counter
+ */
+const char *
+libperf_eventname(int counter);
+
 /* libperf_finalize
  *
  * This function performs cleanup and logs all counters for
- * debugging/logging purposes. Log files are named after the
- * pid/tid that was used when calling libperf_initialize, and
- * they are saved in the same location where the binary is run from.
+ * debugging/logging purposes.  It appends binary records (see the
+ * "binary log" section below) with the final counts and every region's
+ * statistics to a file named <pid>.libperf after the pid/tid that was
+ * used when calling libperf_initialize, in the directory set with
+ * libperf_setlogdir, $LIBPERF_LOGDIR, or the current directory.  Use the
+ * libperf-decode tool to turn it into CSV or JSON.
  *
  * struct libperf_data* pd - library structure obtained from libperf_initialize()
  * void* id - a unique identifier to tag log messages
@@ -139,7 +397,8 @@ libperf_finalize(struct libperf_data *pd, void *id);
 
 /* libperf_readcounter
  *
- * This function reads an individual counter.
+ * This function reads an individual counter.  With LIBPERF_FLAG_MMAP it
+ * does not enter the kernel as long as the counter is live on the PMU.
  *
  * struct libperf_data* pd - library structure obtained from libperf_initialize()
  * int counter - pass in a constant value defined in enum libperf_tracepoint
@@ -156,11 +415,69 @@ libperf_finalize(struct libperf_data *pd, void *id);
  *      fprintf(stdout, "%" PRIu64 "\n", value);
  *
  *
- * return - 64 bit counter value
+ * return - 64 bit counter value, scaled for multiplexing
  */
 uint64_t
 libperf_readcounter(struct libperf_data *pd, int counter);
 
+/* libperf_readcount
+ *
+ * This function reads an individual counter along with its enabled and
+ * running times, so callers can tell measured values from extrapolated
+ * ones.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int counter - pass in a constant value defined in enum libperf_tracepoint
+ * struct libperf_count* count - filled in with the value and times
+ *
+ * return - 0 on success, -1 on a failed read
+ */
+int
+libperf_readcount(struct libperf_data *pd, int counter,
+                  struct libperf_count *count);
+
+/* libperf_readall
+ *
+ * This function reads every counter at once.  In group mode this is a
+ * single read( ) of the group leader, otherwise one read( ) per counter.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * uint64_t* out - array of LIBPERF_NR_COUNTERS scaled values indexed by
+ *                 enum libperf_tracepoint; counters that are not open
+ *                 read as 0, and LIBPERF_LIB_SW_WALL_TIME holds the
+ *                 nanoseconds since initialization
+ *
+ * return - 0 on success, -1 on a failed read
+ */
+int
+libperf_readall(struct libperf_data *pd, uint64_t *out);
+
+/* libperf_readcounts
+ *
+ * This function is libperf_readall with enabled and running times.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * struct libperf_count* out - array of LIBPERF_NR_COUNTERS counts indexed
+ *                             by enum libperf_tracepoint
+ *
+ * return - 0 on success, -1 on a failed read
+ */
+int
+libperf_readcounts(struct libperf_data *pd, struct libperf_count *out);
+
+/* libperf_countratio
+ *
+ * This function returns the share of its enabled time a counter was
+ * actually counting.  1.0 means the value was measured exactly, lower
+ * values mean it was extrapolated, and 0.0 means it never ran.
+ *
+ * const struct libperf_count* count - count from libperf_readcount(s)
+ *
+ * return - time_running / time_enabled
+ */
+double
+libperf_countratio(const struct libperf_count *count);
+
 /* libperf_enablecounter
  *
  * This function enables an individual counter.
@@ -168,7 +485,7 @@ libperf_readcounter(struct libperf_data *pd, int counter);
  * struct libperf_data* pd - library structure obtained from libperf_initialize()
  * int counter - pass in a constant value defined in enum libperf_tracepoint
  *
- * return - same semantics as ioctl 
+ * return - same semantics as ioctl, -1 if a lazy counter failed to open
  */
 int
 libperf_enablecounter(struct libperf_data *pd, int counter);
@@ -185,6 +502,209 @@ libperf_enablecounter(struct libperf_data *pd, int counter);
 int
 libperf_disablecounter(struct libperf_data *pd, int counter);
 
+/* libperf_enableall
+ *
+ * This function enables every counter, opening any that LIBPERF_FLAG_LAZY
+ * left closed.  In group mode this is a single ioctl on the group leader
+ * with PERF_IOC_FLAG_GROUP.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ *
+ * return - same semantics as ioctl
+ */
+int
+libperf_enableall(struct libperf_data *pd);
+
+/* libperf_disableall
+ *
+ * This function disables every counter, as a group in group mode.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ *
+ * return - same semantics as ioctl
+ */
+int
+libperf_disableall(struct libperf_data *pd);
+
+/* libperf_resetall
+ *
+ * This function resets every counter to zero, as a group in group mode.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ *
+ * return - same semantics as ioctl
+ */
+int
+libperf_resetall(struct libperf_data *pd);
+
+/* libperf_region_id
+ *
+ * This function looks up a named region, registering it on first use.
+ * Call it once outside the measured code and pass the id to
+ * libperf_region_begin/libperf_region_end, which then neither allocate
+ * nor compare strings.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * const char* name - region name, copied by the library
+ *
+ * return - region id, or -1 if out of memory
+ */
+int
+libperf_region_id(struct libperf_data *pd, const char *name);
+
+/* libperf_region_name
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int region - id obtained from libperf_region_id()
+ *
+ * return - name of the region, or NULL for an invalid id
+ */
+const char *
+libperf_region_name(struct libperf_data *pd, int region);
+
+/* libperf_region_begin
+ *
+ * This function snapshots all counters at the start of a region.
+ * Different regions may nest; re-entering a region before its end
+ * restarts it.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int region - id obtained from libperf_region_id()
+ *
+ * return - 0 on success, -1 on a failed read
+ */
+int
+libperf_region_begin(struct libperf_data *pd, int region);
+
+/* libperf_region_end
+ *
+ * This function adds the counter deltas since libperf_region_begin to the
+ * region's running count, mean, variance, min and max.  The deltas of
+ * LIBPERF_LIB_SW_WALL_TIME are in nanoseconds.  With LIBPERF_FLAG_ASYNCLOG
+ * the deltas are also queued as a values record for the region.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int region - id obtained from libperf_region_id()
+ *
+ * return - 0 on success, -1 on a failed read
+ */
+int
+libperf_region_end(struct libperf_data *pd, int region);
+
+/* libperf_region_stats
+ *
+ * This function returns the statistics gathered for one counter of a
+ * region.  libperf_finalize also logs them for every region.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int region - id obtained from libperf_region_id()
+ * int counter - constant from enum libperf_tracepoint or an id from
+ *               libperf_addevent
+ * struct libperf_stats* stats - filled in with the statistics
+ *
+ * return - 0 on success, -1 for an invalid region or counter
+ */
+int
+libperf_region_stats(struct libperf_data *pd, int region, int counter,
+                     struct libperf_stats *stats);
+
+/* derived metrics
+ *
+ * A metric is a builtin name (see libperf_builtinmetric) or a
+ * "name=expression" using +, -, *, /, parentheses, numbers and the counter
+ * names of libperf_eventbyname plus "wall-time", for example
+ * "fault-rate=page-faults*1e9/wall-time".  Metrics are always evaluated on
+ * counter deltas taken from one consistent snapshot pair, never on counts
+ * read at different moments.  A division by zero yields NAN.
+ */
+
+/* libperf_builtinmetric
+ *
+ * This function lists the builtin metrics: ipc, cpi, branch-miss-rate,
+ * cache-miss-ratio, l1d-, llc-, dtlb- and itlb-miss-ratio, branch-, l1d-,
+ * llc- and dtlb-mpki (misses per 1000 instructions) and ghz.
+ *
+ * int index - 0 and up
+ *
+ * return - static name, or NULL past the last one
+ */
+const char *
+libperf_builtinmetric(int index);
+
+/* libperf_metricmask
+ *
+ * This function returns the counters a metric needs, for example to pass
+ * to libperf_initialize_mask.
+ *
+ * const char* metric - builtin name or "name=expression"
+ * uint64_t* mask - filled in with LIBPERF_MASK bits
+ *
+ * return - 0 on success, -1 with errno set to EINVAL if it does not parse
+ */
+int
+libperf_metricmask(const char *metric, uint64_t *mask);
+
+/* libperf_addmetric
+ *
+ * This function adds a metric to a context and opens the counters it
+ * needs that are not open yet (or leaves them to the first enable with
+ * LIBPERF_FLAG_LAZY).  libperf_finalize logs every metric over the whole
+ * run and over the mean deltas of every region.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * const char* metric - builtin name or "name=expression"
+ *
+ * return - metric id, or -1 with errno set (EINVAL if it does not parse,
+ *          ENOENT if a needed counter is not supported here)
+ */
+int
+libperf_addmetric(struct libperf_data *pd, const char *metric);
+
+/* libperf_nrmetrics
+ *
+ * return - number of metrics added to pd, ids run from 0 to this - 1
+ */
+int
+libperf_nrmetrics(struct libperf_data *pd);
+
+/* libperf_metricname
+ *
+ * return - name of a metric of pd, NULL for an invalid id
+ */
+const char *
+libperf_metricname(struct libperf_data *pd, int metric);
+
+/* libperf_evalmetric
+ *
+ * This function evaluates a metric over the deltas between two snapshots
+ * taken with libperf_readall; scaled estimates that step backwards count
+ * as zero.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int metric - id obtained from libperf_addmetric()
+ * const uint64_t* before - earlier libperf_readall snapshot, NULL for zeros
+ * const uint64_t* after - later libperf_readall snapshot
+ *
+ * return - metric value, NAN for an invalid id
+ */
+double
+libperf_evalmetric(struct libperf_data *pd, int metric,
+                   const uint64_t *before, const uint64_t *after);
+
+/* libperf_region_metric
+ *
+ * This function evaluates a metric over the mean deltas of a region, which
+ * for ratios equals the ratio of the region's totals.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * int region - id obtained from libperf_region_id()
+ * int metric - id obtained from libperf_addmetric()
+ *
+ * return - metric value, NAN for an invalid id or a region never ended
+ */
+double
+libperf_region_metric(struct libperf_data *pd, int region, int metric);
+
 /* libperf_close
  *
  * This function shuts down the library performing cleanup.
@@ -198,15 +718,1212 @@ libperf_close(struct libperf_data *pd);
 
 /* libperf_getlogger
  *
- * This function returns a file descriptor to the libperf log file.
+ * This function returns a stream to a text log file for custom messages,
+ * named after the pid/tid in the log directory.  The file is only opened
+ * on the first call.
  *
  * struct libperf_data* pd - library structure obtained from libperf_initialize()
  *
- * return - file descriptor to the log file associated with pd
+ * return - stream to the text log file associated with pd, NULL on error
  */
 FILE *
 libperf_getlogger(struct libperf_data *pd);
 
+/* context pools */
+struct libperf_pool;
+
+/* libperf_pool_create
+ *
+ * This function creates a pool that hands out contexts for many threads
+ * cheaply.  Contexts come from cache line aligned arena blocks, each
+ * holding the context with its counter table, and all of them share one
+ * read-only table of default perf_event_attrs.  libperf_close and
+ * libperf_finalize put a pooled context's block back for reuse, and
+ * finalize appends to the process's binary log, <pid>.libperf, instead of
+ * one file per thread.  libperf_getlogger returns one text log shared by
+ * the pool.
+ *
+ * uint64_t mask - counters every context opens, see libperf_initialize_mask
+ * int flags - bitwise or of values from enum libperf_flags
+ * size_t reserve - blocks allocated up front, so the first reserve
+ *                  contexts cost no allocation
+ *
+ * return - pool for use in future library calls, or NULL with errno set
+ */
+struct libperf_pool *
+libperf_pool_create(uint64_t mask, int flags, size_t reserve);
+
+/* libperf_pool_initialize
+ *
+ * This function is libperf_initialize_mask for a pooled context.
+ *
+ * struct libperf_pool* pool - pool from libperf_pool_create()
+ * int pid - task to count, -1 for the calling thread
+ * int cpu - cpu to count on, -1 for any
+ *
+ * return - context, or NULL with errno set
+ */
+struct libperf_data *
+libperf_pool_initialize(struct libperf_pool *pool, int pid, int cpu);
+
+/* libperf_pool_thread
+ *
+ * This function returns the calling thread's context, creating and
+ * enabling it on the first call.  When the thread exits, the context is
+ * finalized, logging its counts, and its block recycled.  Finalizing it
+ * earlier from the same thread is fine; another thread must not.
+ *
+ * struct libperf_pool* pool - pool from libperf_pool_create()
+ *
+ * return - context, or NULL with errno set
+ */
+struct libperf_data *
+libperf_pool_thread(struct libperf_pool *pool);
+
+/* libperf_pool_destroy
+ *
+ * This function frees the pool's memory.  Every context it handed out
+ * must be closed first.
+ *
+ * struct libperf_pool* pool - pool from libperf_pool_create()
+ */
+void
+libperf_pool_destroy(struct libperf_pool *pool);
+
+/* sampling */
+struct libperf_sampler;
+
+/* one sample as delivered to callbacks and written to sample files */
+struct libperf_sample
+{
+	uint64_t time;              /* perf clock timestamp, ns */
+	uint64_t ip;                /* instruction pointer */
+	uint32_t pid;
+	uint32_t tid;
+};
+
+/* sample file header, followed by struct libperf_sample records */
+#define LIBPERF_SAMPLE_MAGIC "LPSM"
+#define LIBPERF_SAMPLE_VERSION 1
+
+struct libperf_sample_header
+{
+	char magic[4];              /* LIBPERF_SAMPLE_MAGIC */
+	uint32_t version;           /* LIBPERF_SAMPLE_VERSION */
+	uint32_t record_size;       /* sizeof(struct libperf_sample) */
+	uint32_t reserved;
+	uint64_t period;            /* sample period or frequency */
+};
+
+/* sampler flags */
+enum libperf_sampler_flags
+{
+	/* period is a frequency in Hz rather than an event count */
+	LIBPERF_SAMPLER_FREQ = 1 << 0,
+
+	/* only sample user space (otherwise used as a fallback when the
+	 * perf_event_paranoid setting forbids kernel samples) */
+	LIBPERF_SAMPLER_USER = 1 << 1
+};
+
+typedef void (*libperf_sample_fn)(const struct libperf_sample *sample,
+                                  void *arg);
+
+/* libperf_sampler_open
+ *
+ * This function opens a sampling event that records the instruction
+ * pointer, pid/tid and time every period events into a ring buffer mmap'd
+ * into this process.  The software LIBPERF_COUNT_SW_CPU_CLOCK event works
+ * on machines without a PMU.  The sampler starts disabled.
+ *
+ * int pid - pass in gettid()/getpid() value, -1 for current thread
+ * int cpu - pass in cpuid to track, -1 for any
+ * int counter - pass in a constant value defined in enum libperf_tracepoint
+ * uint64_t period - events between samples, or Hz with LIBPERF_SAMPLER_FREQ
+ * int pages - ring buffer size in pages, a power of two, 0 for default
+ * int flags - bitwise or of values from enum libperf_sampler_flags
+ *
+ * return - sampler for use in future library calls, or NULL with errno set
+ */
+struct libperf_sampler *
+libperf_sampler_open(int pid, int cpu, int counter, uint64_t period,
+                     int pages, int flags);
+
+/* libperf_sampler_enable
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ *
+ * return - same semantics as ioctl
+ */
+int
+libperf_sampler_enable(struct libperf_sampler *s);
+
+/* libperf_sampler_disable
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ *
+ * return - same semantics as ioctl
+ */
+int
+libperf_sampler_disable(struct libperf_sampler *s);
+
+/* libperf_sampler_drain
+ *
+ * This function consumes every record currently in the ring buffer,
+ * calling fn for each sample.  It takes no locks and makes no syscalls;
+ * a single thread should drain a given sampler.  Drain often enough that
+ * the buffer does not fill, or the kernel drops samples (see
+ * libperf_sampler_lost).
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ * libperf_sample_fn fn - callback invoked once per sample
+ * void* arg - passed through to fn
+ *
+ * return - number of samples delivered
+ */
+int
+libperf_sampler_drain(struct libperf_sampler *s, libperf_sample_fn fn,
+                      void *arg);
+
+/* libperf_sampler_writeheader
+ *
+ * This function writes a struct libperf_sample_header to start a sample
+ * file.
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ * int fd - file descriptor to write to
+ *
+ * return - 0 on success, -1 on a failed write
+ */
+int
+libperf_sampler_writeheader(struct libperf_sampler *s, int fd);
+
+/* libperf_sampler_write
+ *
+ * This function drains the ring buffer into a file as fixed size
+ * struct libperf_sample records, batching the writes.
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ * int fd - file descriptor to write to
+ *
+ * return - number of samples written, or -1 on a failed write
+ */
+int
+libperf_sampler_write(struct libperf_sampler *s, int fd);
+
+/* libperf_sampler_fd
+ *
+ * This function returns the event file descriptor, which polls readable
+ * once the ring buffer is half full.
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ *
+ * return - file descriptor of the sampling event
+ */
+int
+libperf_sampler_fd(struct libperf_sampler *s);
+
+/* libperf_sampler_lost
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ *
+ * return - number of samples the kernel dropped because the buffer was full
+ */
+uint64_t
+libperf_sampler_lost(struct libperf_sampler *s);
+
+/* libperf_sampler_close
+ *
+ * This function unmaps the ring buffer and closes the event.
+ *
+ * struct libperf_sampler* s - sampler obtained from libperf_sampler_open()
+ */
+void
+libperf_sampler_close(struct libperf_sampler *s);
+
+/* counter overflow notification */
+struct libperf_overflow;
+
+/* runs in a signal handler, so it may only use async-signal-safe calls;
+   a nonzero return stops further notifications */
+typedef int (*libperf_overflow_fn)(struct libperf_data *pd, int counter,
+                                   void *arg);
+
+/* libperf_on_overflow
+ *
+ * This function calls fn every period events of a counter, from now on,
+ * without polling: a copy of the counter with that sample period raises
+ * the realtime signal SIGRTMIN + 3 when it overflows.  The signal goes to
+ * the counted thread when it belongs to this process, so fn can stop the
+ * work it interrupts, and otherwise to the process.  The program must not
+ * block or otherwise use that signal.  The copy counts whether or not the
+ * context's counters are enabled and does not follow children.
+ *
+ * struct libperf_data* pd - library structure
+ * int counter - builtin counter, or id returned by libperf_addevent
+ * uint64_t period - events between calls, for example 10000000
+ *                   instructions or 1000 page faults
+ * libperf_overflow_fn fn - callback
+ * void* arg - passed to fn
+ *
+ * return - handle for libperf_overflow_cancel, or NULL with errno set to
+ *          EINVAL for a bad counter or period, or ENOSPC when too many
+ *          notifications are armed
+ */
+struct libperf_overflow *
+libperf_on_overflow(struct libperf_data *pd, int counter, uint64_t period,
+                    libperf_overflow_fn fn, void *arg);
+
+/* libperf_overflow_count
+ *
+ * struct libperf_overflow* o - handle from libperf_on_overflow()
+ *
+ * return - number of times fn has been called
+ */
+uint64_t
+libperf_overflow_count(struct libperf_overflow *o);
+
+/* libperf_overflow_cancel
+ *
+ * This function stops the notifications and waits for a running fn to
+ * return and for signals already queued to be handled, so it must not be
+ * called from fn.  Cancel before libperf_close.
+ *
+ * struct libperf_overflow* o - handle from libperf_on_overflow()
+ */
+void
+libperf_overflow_cancel(struct libperf_overflow *o);
+
+/* call-graph profiling */
+struct libperf_profiler;
+
+/* libperf_profiler_open
+ *
+ * This function samples the call stacks of a process and folds them into
+ * a table in memory, keyed by stack, holding at most max_stacks distinct
+ * stacks; when it is full, rarely seen stacks are evicted into one
+ * "[evicted]" entry so totals stay right.  One sampling event per cpu
+ * follows the process's main thread and the threads and children it
+ * creates from now on.  The profiler starts disabled.
+ *
+ * int pid - process to profile, 0 for the calling one
+ * const char* event - event spec as for libperf_addevent, NULL for
+ *                     "cpu-clock", which works without a hardware PMU
+ * uint64_t period - events between samples, or Hz with LIBPERF_SAMPLER_FREQ
+ * size_t max_stacks - distinct stacks kept, 0 for 4096
+ * int flags - bitwise or of values from enum libperf_sampler_flags
+ *
+ * return - profiler for use in future library calls, or NULL with errno set
+ */
+struct libperf_profiler *
+libperf_profiler_open(int pid, const char *event, uint64_t period,
+                      size_t max_stacks, int flags);
+
+/* libperf_profiler_enable, libperf_profiler_disable
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ *
+ * return - 0 on success, -1 if an ioctl failed
+ */
+int
+libperf_profiler_enable(struct libperf_profiler *p);
+
+int
+libperf_profiler_disable(struct libperf_profiler *p);
+
+/* libperf_profiler_drain
+ *
+ * This function folds the samples waiting in the ring buffers into the
+ * table.  libperf_profiler_dump and the autodump thread drain as well.
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ *
+ * return - number of samples folded
+ */
+int
+libperf_profiler_drain(struct libperf_profiler *p);
+
+/* libperf_profiler_dump
+ *
+ * This function drains, then writes one "root;caller;...;leaf count" line
+ * per stack, the folded format flame graph tools read.  Frames are named
+ * from /proc/<pid>/maps and the ELF symbol tables of the mapped files when
+ * dumped, as "[kernel]" for kernel frames, or as file+0xoffset when no
+ * symbol covers them.  Stacks are kept by address and added up by their
+ * names when dumped, so every line is distinct.
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ * FILE* out - stream to write to
+ *
+ * return - number of stacks written, or -1 with errno set
+ */
+int
+libperf_profiler_dump(struct libperf_profiler *p, FILE *out);
+
+/* libperf_profiler_autodump
+ *
+ * This function starts a thread that drains the ring buffers as they fill
+ * and replaces path with a fresh dump every interval_ms milliseconds, so
+ * the file always holds a complete profile since the start or the last
+ * libperf_profiler_reset.
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ * const char* path - file to dump to, NULL to stop the thread
+ * unsigned int interval_ms - time between dumps, at least 1
+ *
+ * return - 0 on success, -1 with errno set
+ */
+int
+libperf_profiler_autodump(struct libperf_profiler *p, const char *path,
+                          unsigned int interval_ms);
+
+/* libperf_profiler_reset
+ *
+ * This function drops every stack folded so far.
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ */
+void
+libperf_profiler_reset(struct libperf_profiler *p);
+
+/* libperf_profiler_lost
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ *
+ * return - number of samples the kernel dropped because a buffer was full
+ */
+uint64_t
+libperf_profiler_lost(struct libperf_profiler *p);
+
+/* libperf_profiler_close
+ *
+ * This function stops the autodump thread, closes the events and frees
+ * the table.
+ *
+ * struct libperf_profiler* p - profiler from libperf_profiler_open()
+ */
+void
+libperf_profiler_close(struct libperf_profiler *p);
+
+/* system-wide collection */
+struct libperf_collector;
+
+/* identity of a cpu monitored by a collector */
+struct libperf_cpuinfo
+{
+	int cpu;
+	int socket;                 /* physical package id */
+	int online;                 /* 0 once the cpu was hot-unplugged */
+};
+
+/* libperf_collector_open
+ *
+ * This function opens the selected counters for every task (pid -1) on
+ * every online cpu, or on the cpus of a list such as "0-3,8".  This
+ * normally needs root or a perf_event_paranoid setting of 0 or less.
+ * Pass LIBPERF_FLAG_GROUP to read each cpu with a single read( ).  The
+ * counters start disabled.
+ *
+ * const char* events - comma separated counter names, NULL for all
+ * const char* cpus - cpu list, NULL for all online cpus
+ * int flags - bitwise or of values from enum libperf_flags
+ *
+ * return - collector for use in future library calls, or NULL with errno set
+ */
+struct libperf_collector *
+libperf_collector_open(const char *events, const char *cpus, int flags);
+
+/* libperf_collector_open_cgroup
+ *
+ * This function is libperf_collector_open restricted to the tasks of one
+ * cgroup v2, however they come and go: each cpu's counters only count
+ * while a task of the cgroup or its descendants runs there.  The
+ * collector is read, enabled and summed like any other.
+ *
+ * const char* cgroup - cgroup as in /proc/<pid>/cgroup, such as
+ *                      "/system.slice/foo.service", or a path under the
+ *                      cgroup2 mount
+ * const char* events - comma separated counter names, NULL for all
+ * const char* cpus - cpu list, NULL for all online cpus
+ * int flags - bitwise or of values from enum libperf_flags
+ *
+ * return - collector for use in future library calls, or NULL with errno set
+ */
+struct libperf_collector *
+libperf_collector_open_cgroup(const char *cgroup, const char *events,
+                              const char *cpus, int flags);
+
+/* libperf_collector_rescan
+ *
+ * This function handles cpu hotplug: cpus that came online are opened
+ * (and enabled if the collector is), and cpus that went offline are
+ * marked so while their last counts stay in the totals.
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ *
+ * return - 0 on success, -1 with errno set
+ */
+int
+libperf_collector_rescan(struct libperf_collector *c);
+
+/* libperf_collector_enable, libperf_collector_disable,
+ * libperf_collector_reset
+ *
+ * These functions enable, disable or reset the counters on every cpu.
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ *
+ * return - 0 on success, -1 if any cpu failed
+ */
+int
+libperf_collector_enable(struct libperf_collector *c);
+
+int
+libperf_collector_disable(struct libperf_collector *c);
+
+int
+libperf_collector_reset(struct libperf_collector *c);
+
+/* libperf_collector_read
+ *
+ * This function snapshots the counters of every cpu.  The per-cpu,
+ * per-socket and total queries report this snapshot.
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ *
+ * return - 0 on success, -1 if any cpu failed
+ */
+int
+libperf_collector_read(struct libperf_collector *c);
+
+/* libperf_collector_nrcpus
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ *
+ * return - number of cpus, valid indices are 0 .. nrcpus - 1
+ */
+int
+libperf_collector_nrcpus(struct libperf_collector *c);
+
+/* libperf_collector_nrsockets
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ *
+ * return - number of sockets, valid ids are 0 .. nrsockets - 1
+ */
+int
+libperf_collector_nrsockets(struct libperf_collector *c);
+
+/* libperf_collector_cpuinfo
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ * int index - cpu index, 0 .. libperf_collector_nrcpus() - 1
+ * struct libperf_cpuinfo* info - filled in with the cpu's identity
+ *
+ * return - 0 on success, -1 for an invalid index
+ */
+int
+libperf_collector_cpuinfo(struct libperf_collector *c, int index,
+                          struct libperf_cpuinfo *info);
+
+/* libperf_collector_percpu
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ * int index - cpu index, 0 .. libperf_collector_nrcpus() - 1
+ * uint64_t* out - LIBPERF_NR_COUNTERS values as in libperf_readall
+ *
+ * return - 0 on success, -1 for an invalid index
+ */
+int
+libperf_collector_percpu(struct libperf_collector *c, int index,
+                         uint64_t *out);
+
+/* libperf_collector_persocket
+ *
+ * This function sums the last snapshot over the cpus of one socket.
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ * int socket - socket id, 0 .. libperf_collector_nrsockets() - 1
+ * uint64_t* out - LIBPERF_NR_COUNTERS values as in libperf_readall
+ *
+ * return - 0 on success, -1 for an invalid socket
+ */
+int
+libperf_collector_persocket(struct libperf_collector *c, int socket,
+                            uint64_t *out);
+
+/* libperf_collector_total
+ *
+ * This function sums the last snapshot over all cpus.
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ * uint64_t* out - LIBPERF_NR_COUNTERS values as in libperf_readall
+ *
+ * return - always 0
+ */
+int
+libperf_collector_total(struct libperf_collector *c, uint64_t *out);
+
+/* libperf_collector_close
+ *
+ * struct libperf_collector* c - collector from libperf_collector_open()
+ */
+void
+libperf_collector_close(struct libperf_collector *c);
+
+/* per-thread collection */
+struct libperf_threads;
+
+/* identity of a thread monitored by a registry */
+struct libperf_threadinfo
+{
+	int tid;
+	int alive;                  /* 0 if it exited before the last scan */
+	char name[16];              /* comm at the time it was attached */
+};
+
+/* libperf_threads_open
+ *
+ * This function attaches the selected counters to every thread of the
+ * calling process, each with its own context.  Unlike libperf_initialize
+ * the counters are not inherited, so every thread reports only its own
+ * counts.  Threads created later are attached by libperf_threads_rescan,
+ * or by a watcher thread scanning /proc/self/task every interval_ms.
+ * Threads that live shorter than one interval can be missed.  The
+ * counters start disabled.
+ *
+ * const char* events - comma separated counter names, NULL for all
+ * unsigned int interval_ms - watcher scan interval, 0 for no watcher
+ * int flags - bitwise or of values from enum libperf_flags
+ *
+ * return - registry for use in future library calls, or NULL with errno set
+ */
+struct libperf_threads *
+libperf_threads_open(const char *events, unsigned int interval_ms, int flags);
+
+/* libperf_threads_rescan
+ *
+ * This function attaches threads created since the last scan, including
+ * one that reuses the tid of an exited thread, which /proc start times
+ * tell apart.  Threads that exited are read a last time, their contexts
+ * are closed and their final counts go into libperf_threads_total; they
+ * stay listed with alive 0 until the following scan drops them.
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ *
+ * return - 0 on success, -1 with errno set
+ */
+int
+libperf_threads_rescan(struct libperf_threads *t);
+
+/* libperf_threads_enable, libperf_threads_disable, libperf_threads_reset
+ *
+ * These functions enable, disable or reset the counters of every thread.
+ * Threads attached while the registry is enabled start enabled.
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ *
+ * return - 0 on success, -1 if any thread failed
+ */
+int
+libperf_threads_enable(struct libperf_threads *t);
+
+int
+libperf_threads_disable(struct libperf_threads *t);
+
+int
+libperf_threads_reset(struct libperf_threads *t);
+
+/* libperf_threads_read
+ *
+ * This function snapshots the counters of every thread for the per-thread
+ * and total queries below.
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ *
+ * return - 0 on success, -1 if any read failed
+ */
+int
+libperf_threads_read(struct libperf_threads *t);
+
+/* libperf_threads_count
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ *
+ * return - number of threads listed, see libperf_threads_rescan
+ */
+int
+libperf_threads_count(struct libperf_threads *t);
+
+/* libperf_threads_info
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ * int index - thread index, 0 .. libperf_threads_count() - 1
+ * struct libperf_threadinfo* info - filled in with the thread's identity
+ *
+ * return - 0 on success, -1 for an invalid index
+ */
+int
+libperf_threads_info(struct libperf_threads *t, int index,
+                     struct libperf_threadinfo *info);
+
+/* libperf_threads_values
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ * int index - thread index, 0 .. libperf_threads_count() - 1
+ * uint64_t* out - LIBPERF_NR_COUNTERS values as in libperf_readall
+ *
+ * return - 0 on success, -1 for an invalid index
+ */
+int
+libperf_threads_values(struct libperf_threads *t, int index, uint64_t *out);
+
+/* libperf_threads_total
+ *
+ * This function sums the last snapshot over all threads, and the final
+ * counts of every thread that exited.
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ * uint64_t* out - LIBPERF_NR_COUNTERS values as in libperf_readall
+ *
+ * return - always 0
+ */
+int
+libperf_threads_total(struct libperf_threads *t, uint64_t *out);
+
+/* libperf_threads_close
+ *
+ * struct libperf_threads* t - registry from libperf_threads_open()
+ */
+void
+libperf_threads_close(struct libperf_threads *t);
+
+/* libperf_spawn
+ *
+ * This function starts a program with counters attached before it runs.
+ * The forked child blocks on a pipe until its counters are open with
+ * enable_on_exec, then execs argv[0] (searched in $PATH), so counting
+ * starts exactly at the exec and inherits into the program's children.
+ * LIBPERF_FLAG_MMAP, LIBPERF_FLAG_LAZY and LIBPERF_FLAG_ASYNCLOG are
+ * ignored.  Wait for the child with waitpid, then read the context, and
+ * close it with libperf_close or libperf_finalize.
+ *
+ * char* const* argv - NULL terminated program and arguments
+ * const char* events - list as for libperf_initialize_events, NULL for
+ *                      every supported counter
+ * int flags - bitwise or of values from enum libperf_flags
+ * int* pid - filled in with the child's pid
+ *
+ * return - context counting the child, or NULL with errno set; a failed
+ *          exec reports the exec's errno and leaves no child behind
+ */
+struct libperf_data *
+libperf_spawn(char *const argv[], const char *events, int flags, int *pid);
+
+/* time series of counter deltas */
+struct libperf_series;
+
+/* one sampling interval */
+struct libperf_interval
+{
+	uint64_t timestamp;         /* CLOCK_REALTIME at the end, ns */
+	uint64_t duration;          /* ns since the previous snapshot */
+	uint64_t deltas[LIBPERF_NR_COUNTERS];  /* zero for counters not open */
+};
+
+typedef void (*libperf_interval_fn)(const struct libperf_interval *interval,
+                                    void *arg);
+
+/* libperf_series_start
+ *
+ * This function starts a background thread that snapshots the builtin
+ * counters of a context every interval_ms milliseconds and keeps the
+ * deltas of the last capacity intervals in a fixed ring, overwriting the
+ * oldest.  Each snapshot is one read( ) of the group, or of each counter
+ * without LIBPERF_FLAG_GROUP, so it is cheap enough to leave on.  The
+ * context keeps working as usual meanwhile, but must not be closed or
+ * have events added until libperf_series_stop returns.
+ *
+ * struct libperf_data* pd - context from libperf_initialize(), enabled or
+ *                           not
+ * unsigned int interval_ms - sampling interval in ms, at least 1
+ * size_t capacity - number of intervals kept, at least 1
+ *
+ * return - series, or NULL with errno set
+ */
+struct libperf_series *
+libperf_series_start(struct libperf_data *pd, unsigned int interval_ms,
+                     size_t capacity);
+
+/* libperf_series_last
+ *
+ * This function copies the most recent intervals, oldest first.
+ *
+ * struct libperf_series* s - series from libperf_series_start()
+ * struct libperf_interval* out - receives up to n intervals
+ * size_t n - size of out
+ *
+ * return - number of intervals copied, at most the ring capacity
+ */
+size_t
+libperf_series_last(struct libperf_series *s, struct libperf_interval *out,
+                    size_t n);
+
+/* libperf_series_count
+ *
+ * struct libperf_series* s - series from libperf_series_start()
+ *
+ * return - number of intervals sampled since the start, including those
+ *          the ring has since overwritten
+ */
+uint64_t
+libperf_series_count(struct libperf_series *s);
+
+/* libperf_series_stream
+ *
+ * This function calls fn for every new interval from the sampling
+ * thread.  fn must not call libperf_series_stream, libperf_series_tofile
+ * or libperf_series_stop; once this function returns the previous
+ * callback is no longer running.
+ *
+ * struct libperf_series* s - series from libperf_series_start()
+ * libperf_interval_fn fn - callback, NULL to stop streaming
+ * void* arg - passed to fn
+ */
+void
+libperf_series_stream(struct libperf_series *s, libperf_interval_fn fn,
+                      void *arg);
+
+/* libperf_series_tofile
+ *
+ * This function appends every new interval to a file as binary log
+ * records: a schema of the open counters and wall time, then one values
+ * record of deltas per interval, readable with libperf-decode.
+ *
+ * struct libperf_series* s - series from libperf_series_start()
+ * const char* path - file to append to, NULL to stop writing
+ *
+ * return - 0 on success, -1 with errno set
+ */
+int
+libperf_series_tofile(struct libperf_series *s, const char *path);
+
+/* libperf_series_stop
+ *
+ * This function stops the sampling thread, closes the file and frees the
+ * series; the context is left as it is.
+ *
+ * struct libperf_series* s - series from libperf_series_start()
+ */
+void
+libperf_series_stop(struct libperf_series *s);
+
+/* shared memory export
+ *
+ * An export segment is a POSIX shared memory object holding the latest
+ * published counts of a context, so other processes can read them
+ * without involving the monitored process.  The segment starts with a
+ * struct libperf_export_header; the arrays it points to follow it at the
+ * given byte offsets.  The writer bumps seq to odd before it changes the
+ * segment and to even after, so a reader copies the segment between two
+ * reads of the same even seq.  A grown segment (new regions) has a
+ * larger size; readers remap it.  All fields are in host byte order.
+ */
+#define LIBPERF_EXPORT_MAGIC "LPRFSHM"
+#define LIBPERF_EXPORT_VERSION 1
+#define LIBPERF_EXPORT_NAME_MAX 48
+#define LIBPERF_EXPORT_PREFIX "libperf."      /* of default segment names */
+
+struct libperf_export_header
+{
+	char magic[8];              /* LIBPERF_EXPORT_MAGIC */
+	uint32_t version;           /* LIBPERF_EXPORT_VERSION */
+	uint32_t header_size;       /* sizeof(struct libperf_export_header) */
+	uint64_t size;              /* bytes of the whole segment */
+	uint64_t seq;               /* odd while the writer is updating */
+	int32_t pid;                /* process that publishes */
+	int32_t tid;                /* task counted as passed to
+	                               libperf_initialize, -1 for a whole cpu */
+	int32_t cpu;                /* cpu counted, -1 for any */
+	uint32_t nr_events;
+	uint32_t nr_regions;
+	uint32_t nr_metrics;
+	uint64_t start_time;        /* CLOCK_REALTIME at creation, ns */
+	uint64_t update_time;       /* CLOCK_REALTIME of the last publish, ns */
+	uint64_t nr_updates;
+	uint64_t events_offset;     /* struct libperf_export_event[nr_events] */
+	uint64_t regions_offset;    /* struct libperf_export_region
+	                               [nr_regions] */
+	uint64_t metrics_offset;    /* struct libperf_export_metric
+	                               [nr_metrics] */
+};
+
+struct libperf_export_event
+{
+	char name[LIBPERF_EXPORT_NAME_MAX];
+	struct libperf_count count;
+};
+
+struct libperf_export_region
+{
+	char name[LIBPERF_EXPORT_NAME_MAX];
+	uint64_t stats_offset;      /* struct libperf_stats[nr_events] in the
+	                               order of the events */
+};
+
+struct libperf_export_metric
+{
+	char name[LIBPERF_EXPORT_NAME_MAX];
+	double value;               /* over the whole run, NAN if undefined */
+};
+
+struct libperf_export;
+struct libperf_export_reader;
+
+/* libperf_export_open
+ *
+ * This function creates an export segment for a context and publishes
+ * its current counts.  Names longer than LIBPERF_EXPORT_NAME_MAX - 1 are
+ * truncated in the segment.  A default name left behind by an earlier
+ * process with the same pid is replaced, an explicit name that already
+ * exists fails with EEXIST.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * const char* name - shared memory object name without the leading '/',
+ *                    NULL for LIBPERF_EXPORT_PREFIX "<pid>.<n>"
+ *
+ * return - export, or NULL with errno set
+ */
+struct libperf_export *
+libperf_export_open(struct libperf_data *pd, const char *name);
+
+/* libperf_export_name
+ *
+ * return - name of the segment, as libperf_export_attach takes it
+ */
+const char *
+libperf_export_name(struct libperf_export *e);
+
+/* libperf_export_publish
+ *
+ * This function reads the context and copies its counts, region stats
+ * and metrics into the segment.  Call it from the thread that uses the
+ * context, as often as readers should see fresh values; it costs one
+ * libperf_readcounts plus a copy.
+ *
+ * struct libperf_export* e - export from libperf_export_open()
+ *
+ * return - 0 on success, -1 with errno set
+ */
+int
+libperf_export_publish(struct libperf_export *e);
+
+/* libperf_export_close
+ *
+ * This function unlinks the segment and frees the export; attached
+ * readers keep their mapping.
+ *
+ * struct libperf_export* e - export from libperf_export_open()
+ */
+void
+libperf_export_close(struct libperf_export *e);
+
+/* libperf_export_attach
+ *
+ * This function maps an export segment read-only.
+ *
+ * const char* name - segment name, with or without the leading '/'
+ *
+ * return - reader, or NULL with errno set (EPROTO for a segment that is
+ *          not a libperf export of this version)
+ */
+struct libperf_export_reader *
+libperf_export_attach(const char *name);
+
+/* libperf_export_snapshot
+ *
+ * This function copies a consistent snapshot of the segment.
+ *
+ * struct libperf_export_reader* r - reader from libperf_export_attach()
+ *
+ * return - the copy, valid until the next call on r, or NULL with errno
+ *          set (EAGAIN if the writer kept updating)
+ */
+const struct libperf_export_header *
+libperf_export_snapshot(struct libperf_export_reader *r);
+
+/* libperf_export_detach
+ *
+ * struct libperf_export_reader* r - reader from libperf_export_attach()
+ */
+void
+libperf_export_detach(struct libperf_export_reader *r);
+
+/* benchmark harness */
+typedef void (*libperf_bench_fn)(void *arg);
+
+/* how libperf_bench_run repeats a function */
+struct libperf_bench_opts
+{
+	uint64_t mask;              /* counters, 0 for all supported */
+	int flags;                  /* values from enum libperf_flags */
+	int warmup;                 /* untimed runs before the trials */
+	int min_trials;
+	int max_trials;
+	double rel_error;           /* stop once the wall time confidence
+	                               interval is within this share of the
+	                               mean, for example 0.01 */
+	double confidence;          /* 0.90, 0.95 or 0.99 */
+	int cpu;                    /* cpu to pin to, -1 for none */
+};
+
+/* summary of one quantity over all trials */
+struct libperf_bench_stat
+{
+	double mean;
+	double stddev;              /* sample standard deviation */
+	double ci_low;              /* confidence interval of the mean */
+	double ci_high;
+	double median;
+	double min;
+	double max;
+};
+
+/* per-counter results, indexed like libperf_readall */
+struct libperf_bench_result
+{
+	int trials;
+	int converged;              /* rel_error was reached */
+	struct libperf_bench_stat stats[LIBPERF_NR_COUNTERS];
+};
+
+/* wall time with and without counters, in ns */
+struct libperf_bench_overhead
+{
+	int trials;
+	struct libperf_bench_stat bare;
+	struct libperf_bench_stat instrumented;
+	double difference;          /* instrumented - bare mean */
+	double ci_low;              /* Welch interval of the difference */
+	double ci_high;
+	double relative;            /* difference / bare mean */
+};
+
+/* libperf_bench_defaults
+ *
+ * This function fills in 3 warmup runs, 5 to 100 trials, a 1% target
+ * relative error at 95% confidence, all counters and no pinning.
+ *
+ * struct libperf_bench_opts* opts - options to initialize
+ */
+void
+libperf_bench_defaults(struct libperf_bench_opts *opts);
+
+/* libperf_bench_run
+ *
+ * This function runs fn on the calling thread, optionally pinned to a
+ * cpu, first for the warmup runs and then for trials until the wall time
+ * is known to the target relative error or max_trials is reached.  The
+ * counters are reset before and read after every trial.
+ *
+ * libperf_bench_fn fn - function to measure
+ * void* arg - passed to fn
+ * const struct libperf_bench_opts* opts - options, NULL for the defaults
+ * struct libperf_bench_result* result - filled in with the statistics
+ *
+ * return - 0 on success, -1 with errno set, EINVAL for bad trial counts
+ *          or a confidence other than 0.90, 0.95 or 0.99
+ */
+int
+libperf_bench_run(libperf_bench_fn fn, void *arg,
+                  const struct libperf_bench_opts *opts,
+                  struct libperf_bench_result *result);
+
+/* libperf_bench_overhead
+ *
+ * This function alternates runs of fn without any counters and runs
+ * with the counters of opts enabled, and reports what instrumenting fn
+ * costs in wall time.
+ *
+ * libperf_bench_fn fn - function to measure
+ * void* arg - passed to fn
+ * const struct libperf_bench_opts* opts - options, NULL for the defaults
+ * struct libperf_bench_overhead* result - filled in with both sides
+ *
+ * return - 0 on success, -1 with errno set, EINVAL as for
+ *          libperf_bench_run
+ */
+int
+libperf_bench_overhead(libperf_bench_fn fn, void *arg,
+                       const struct libperf_bench_opts *opts,
+                       struct libperf_bench_overhead *result);
+
+/* binary log
+ *
+ * The log is a stream of records, each starting with a
+ * struct libperf_log_header whose size covers the whole record.  A schema
+ * record names the events of the records following it; values, times
+ * and stats records carry one entry per schema event, in schema order.
+ * Records are in host byte order, and readers skip unknown types.
+ */
+#define LIBPERF_LOG_MAGIC "LPRF"
+#define LIBPERF_LOG_VERSION 1
+#define LIBPERF_LOG_NOREGION UINT32_MAX       /* whole context */
+
+enum libperf_log_type
+{
+	LIBPERF_LOG_SCHEMA = 1,     /* struct libperf_log_schema + names */
+	LIBPERF_LOG_REGION = 2,     /* struct libperf_log_region + name */
+	LIBPERF_LOG_VALUES = 3,     /* record + uint64_t values[nr_events] */
+	LIBPERF_LOG_TIMES = 4,      /* record + uint64_t enabled[nr_events],
+	                               uint64_t running[nr_events] */
+	LIBPERF_LOG_STATS = 5,      /* record + struct libperf_stats[nr_events] */
+	LIBPERF_LOG_METRIC = 6      /* record + double value + NUL terminated
+	                               metric name, padded to 8 bytes */
+};
+
+struct libperf_log_header
+{
+	uint32_t type;              /* enum libperf_log_type */
+	uint32_t size;              /* bytes including this header */
+};
+
+struct libperf_log_schema
+{
+	struct libperf_log_header header;
+	char magic[4];              /* LIBPERF_LOG_MAGIC */
+	uint32_t version;           /* LIBPERF_LOG_VERSION */
+	uint32_t nr_events;
+	uint32_t reserved;
+	/* followed by nr_events NUL terminated names, padded to 8 bytes */
+};
+
+struct libperf_log_region
+{
+	struct libperf_log_header header;
+	uint32_t region;
+	uint32_t reserved;
+	/* followed by the NUL terminated name, padded to 8 bytes */
+};
+
+struct libperf_log_record
+{
+	struct libperf_log_header header;
+	uint64_t timestamp;         /* CLOCK_REALTIME, ns */
+	uint32_t tid;
+	uint32_t region;            /* region id or LIBPERF_LOG_NOREGION */
+	uint64_t id;                /* tag passed to libperf_finalize */
+};
+
+/* libperf_setlogdir
+ *
+ * This function sets the directory log files are created in for the
+ * whole process.  Call it before creating contexts.
+ *
+ * const char* dir - directory, NULL to go back to $LIBPERF_LOGDIR or "."
+ *
+ * return - 0 on success, -1 if out of memory
+ */
+int
+libperf_setlogdir(const char *dir);
+
+/* libperf_logger_start
+ *
+ * This function starts the background logger thread.  Contexts created
+ * with LIBPERF_FLAG_ASYNCLOG start it with the defaults if it is not yet
+ * running.  Each such context gets a ring of fixed size records that only
+ * its own thread writes to; a full ring drops records instead of blocking.
+ * The logger appends everything to <log dir>/<getpid()>.libperf.
+ *
+ * unsigned int queue_records - ring slots per context, a power of two, 0
+ *                              for the default of 1024
+ * unsigned int flush_ms - interval between drains, 0 for the default of 100
+ *
+ * return - 0 on success or if already running, -1 on error
+ */
+int
+libperf_logger_start(unsigned int queue_records, unsigned int flush_ms);
+
+/* libperf_logger_stop
+ *
+ * This function drains all rings, writes out what is left and stops the
+ * background logger thread.
+ */
+void
+libperf_logger_stop(void);
+
+/* libperf_logger_dropped
+ *
+ * return - number of records dropped so far because a ring was full
+ */
+uint64_t
+libperf_logger_dropped(void);
+
+/* libperf_logsnapshot
+ *
+ * This function queues the current values of a LIBPERF_FLAG_ASYNCLOG
+ * context as a values record outside of any region.
+ *
+ * struct libperf_data* pd - library structure obtained from libperf_initialize()
+ * uint64_t id - tag stored in the record
+ *
+ * return - 0 on success, -1 on a failed read or a synchronous context
+ */
+int
+libperf_logsnapshot(struct libperf_data *pd, uint64_t id);
+
+/* streaming binary log reader */
+struct libperf_logreader;
+
+/* one decoded record; pointers stay valid until the next call */
+struct libperf_logentry
+{
+	uint32_t type;              /* enum libperf_log_type */
+	uint64_t timestamp;
+	uint32_t tid;
+	uint32_t region;
+	const char *region_name;    /* NULL for LIBPERF_LOG_NOREGION */
+	uint64_t id;
+	int nr_events;              /* events of the current schema */
+	const char *const *events;
+	const uint64_t *values;                 /* LIBPERF_LOG_VALUES */
+	const uint64_t *time_enabled;           /* LIBPERF_LOG_TIMES */
+	const uint64_t *time_running;           /* LIBPERF_LOG_TIMES */
+	const struct libperf_stats *stats;      /* LIBPERF_LOG_STATS */
+	const char *metric;                     /* LIBPERF_LOG_METRIC */
+	double metric_value;                    /* LIBPERF_LOG_METRIC */
+};
+
+/* libperf_logreader_open
+ *
+ * const char* path - binary log file, "-" for standard input
+ *
+ * return - reader for use with libperf_logreader_next, NULL on error
+ */
+struct libperf_logreader *
+libperf_logreader_open(const char *path);
+
+/* libperf_logreader_next
+ *
+ * This function decodes the next record, holding only that record in
+ * memory.
+ *
+ * struct libperf_logreader* r - reader from libperf_logreader_open()
+ * struct libperf_logentry* entry - filled in with the record
+ *
+ * return - 1 for a record, 0 at the end, -1 for a corrupt or short file
+ */
+int
+libperf_logreader_next(struct libperf_logreader *r,
+                       struct libperf_logentry *entry);
+
+/* libperf_logreader_close
+ *
+ * struct libperf_logreader* r - reader from libperf_logreader_open()
+ */
+void
+libperf_logreader_close(struct libperf_logreader *r);
+
 /* libperf_unit_test
  *
  * This function performs some small unit testing of the library.
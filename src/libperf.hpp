@@ -0,0 +1,298 @@
+/******************************************************************************
+ * libperf.hpp                                                                *
+ *                                                                            *
+ * This file defines the header-only C++17 interface to libperf.  Counter     *
+ * sets are fixed at compile time, so reads become one group read gathered    *
+ * into a std::array, and contexts are owned by move-only RAII objects.       *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#ifndef __LIB_LIBPERF_HPP
+#define __LIB_LIBPERF_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#include "libperf.h"
+
+namespace libperf
+{
+
+/* enum libperf_tracepoint, with the perf tool names */
+enum class event : int
+{
+  cpu_clock = LIBPERF_COUNT_SW_CPU_CLOCK,
+  task_clock = LIBPERF_COUNT_SW_TASK_CLOCK,
+  context_switches = LIBPERF_COUNT_SW_CONTEXT_SWITCHES,
+  cpu_migrations = LIBPERF_COUNT_SW_CPU_MIGRATIONS,
+  page_faults = LIBPERF_COUNT_SW_PAGE_FAULTS,
+  minor_faults = LIBPERF_COUNT_SW_PAGE_FAULTS_MIN,
+  major_faults = LIBPERF_COUNT_SW_PAGE_FAULTS_MAJ,
+
+  cycles = LIBPERF_COUNT_HW_CPU_CYCLES,
+  instructions = LIBPERF_COUNT_HW_INSTRUCTIONS,
+  cache_references = LIBPERF_COUNT_HW_CACHE_REFERENCES,
+  cache_misses = LIBPERF_COUNT_HW_CACHE_MISSES,
+  branches = LIBPERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+  branch_misses = LIBPERF_COUNT_HW_BRANCH_MISSES,
+  bus_cycles = LIBPERF_COUNT_HW_BUS_CYCLES,
+
+  l1d_loads = LIBPERF_COUNT_HW_CACHE_L1D_LOADS,
+  l1d_load_misses = LIBPERF_COUNT_HW_CACHE_L1D_LOADS_MISSES,
+  l1d_stores = LIBPERF_COUNT_HW_CACHE_L1D_STORES,
+  l1d_store_misses = LIBPERF_COUNT_HW_CACHE_L1D_STORES_MISSES,
+  l1d_prefetches = LIBPERF_COUNT_HW_CACHE_L1D_PREFETCHES,
+  l1i_loads = LIBPERF_COUNT_HW_CACHE_L1I_LOADS,
+  l1i_load_misses = LIBPERF_COUNT_HW_CACHE_L1I_LOADS_MISSES,
+  llc_loads = LIBPERF_COUNT_HW_CACHE_LL_LOADS,
+  llc_load_misses = LIBPERF_COUNT_HW_CACHE_LL_LOADS_MISSES,
+  llc_stores = LIBPERF_COUNT_HW_CACHE_LL_STORES,
+  llc_store_misses = LIBPERF_COUNT_HW_CACHE_LL_STORES_MISSES,
+  dtlb_loads = LIBPERF_COUNT_HW_CACHE_DTLB_LOADS,
+  dtlb_load_misses = LIBPERF_COUNT_HW_CACHE_DTLB_LOADS_MISSES,
+  dtlb_stores = LIBPERF_COUNT_HW_CACHE_DTLB_STORES,
+  dtlb_store_misses = LIBPERF_COUNT_HW_CACHE_DTLB_STORES_MISSES,
+  itlb_loads = LIBPERF_COUNT_HW_CACHE_ITLB_LOADS,
+  itlb_load_misses = LIBPERF_COUNT_HW_CACHE_ITLB_LOADS_MISSES,
+  branch_loads = LIBPERF_COUNT_HW_CACHE_BPU_LOADS,
+
+  wall_time = LIBPERF_LIB_SW_WALL_TIME
+};
+
+namespace detail
+{
+
+/* events libperf can open, plus wall time which needs no counter */
+constexpr bool
+valid(event e)
+{
+  int counter = static_cast<int>(e);
+
+  return (counter >= 0 && counter < LIBPERF_COUNT_HW_CACHE_BPU_LOADS_MISSES) ||
+    counter == LIBPERF_LIB_SW_WALL_TIME;
+}
+
+template <event... Es>
+constexpr bool
+distinct()
+{
+  constexpr event list[] = { Es... };
+
+  for (std::size_t i = 0; i < sizeof...(Es); i++)
+    for (std::size_t j = i + 1; j < sizeof...(Es); j++)
+      if (list[i] == list[j])
+        return false;
+
+  return true;
+}
+
+template <event... Es>
+constexpr uint64_t
+mask()
+{
+  uint64_t m = 0;
+
+  for (event e : { Es... })
+    if (e != event::wall_time)
+      m |= LIBPERF_MASK(static_cast<int>(e));
+
+  return m;
+}
+
+struct closer
+{
+  void
+  operator()(libperf_data *pd) const noexcept
+  {
+    libperf_close(pd);
+  }
+};
+
+} /* namespace detail */
+
+/* counter_set
+ *
+ * A group of counters fixed at compile time, for example
+ * counter_set<event::cycles, event::instructions>.  Invalid or repeated
+ * events do not compile.  The set owns its libperf_data and can be moved
+ * but not copied.  Failures throw std::system_error.
+ */
+template <event... Es>
+class counter_set
+{
+  static_assert(sizeof...(Es) > 0, "a counter_set needs an event");
+  static_assert((detail::valid(Es) && ...), "event libperf cannot open");
+  static_assert(detail::distinct<Es...>(), "event listed twice");
+
+public:
+  /* one scaled value per event, in template order */
+  using values = std::array<uint64_t, sizeof...(Es)>;
+
+  static constexpr std::size_t size = sizeof...(Es);
+
+  /* position of E in values, a compile-time constant */
+  template <event E>
+  static constexpr std::size_t
+  index()
+  {
+    constexpr event list[] = { Es... };
+
+    std::size_t i = 0;
+
+    while (i < size && list[i] != E)
+      i++;
+    return i;
+  }
+
+  /* pid and cpu as for libperf_initialize, flags from enum libperf_flags;
+     LIBPERF_FLAG_GROUP is always added */
+  explicit counter_set(int pid = 0, int cpu = -1, int flags = 0)
+    : pd_(libperf_initialize_mask(pid, cpu, detail::mask<Es...>(),
+                                  flags | LIBPERF_FLAG_GROUP))
+  {
+    if (!pd_)
+      throw std::system_error(errno, std::generic_category(),
+                              "libperf_initialize_mask");
+  }
+
+  counter_set(counter_set &&) noexcept = default;
+  counter_set &operator=(counter_set &&) noexcept = default;
+  counter_set(const counter_set &) = delete;
+  counter_set &operator=(const counter_set &) = delete;
+
+  void
+  enable()
+  {
+    check(libperf_enableall(pd_.get()), "libperf_enableall");
+  }
+
+  void
+  disable()
+  {
+    check(libperf_disableall(pd_.get()), "libperf_disableall");
+  }
+
+  void
+  reset()
+  {
+    check(libperf_resetall(pd_.get()), "libperf_resetall");
+  }
+
+  /* one group read; the gather below indexes by constants only */
+  values
+  read() const
+  {
+    uint64_t all[LIBPERF_NR_COUNTERS];
+
+    check(libperf_readall(pd_.get(), all), "libperf_readall");
+    return values{ { all[static_cast<int>(Es)]... } };
+  }
+
+  /* like read, but reports failure instead of throwing */
+  bool
+  try_read(values &out) const noexcept
+  {
+    uint64_t all[LIBPERF_NR_COUNTERS];
+
+    if (libperf_readall(pd_.get(), all) == -1)
+      return false;
+
+    out = values{ { all[static_cast<int>(Es)]... } };
+    return true;
+  }
+
+  template <event E>
+  static constexpr uint64_t
+  get(const values &v)
+  {
+    static_assert(index<E>() < size, "event not in this counter_set");
+    return v[index<E>()];
+  }
+
+  /* logs the final counts and releases the context */
+  void
+  finalize(void *id = nullptr)
+  {
+    libperf_finalize(pd_.release(), id);
+  }
+
+  /* the C context, still owned by the set */
+  libperf_data *
+  native() const noexcept
+  {
+    return pd_.get();
+  }
+
+private:
+  static void
+  check(int result, const char *what)
+  {
+    if (result == -1)
+      throw std::system_error(errno, std::generic_category(), what);
+  }
+
+  std::unique_ptr<libperf_data, detail::closer> pd_;
+};
+
+/* scoped_measure
+ *
+ * Reads the set when constructed and adds the deltas since then into sink
+ * when destroyed, also while an exception unwinds.  A failed read at
+ * either end leaves sink untouched.
+ */
+template <class Set>
+class scoped_measure
+{
+public:
+  scoped_measure(const Set &set, typename Set::values &sink) noexcept
+    : set_(set), sink_(sink), ok_(set.try_read(start_))
+  {
+  }
+
+  scoped_measure(const scoped_measure &) = delete;
+  scoped_measure &operator=(const scoped_measure &) = delete;
+
+  ~scoped_measure()
+  {
+    typename Set::values end;
+
+    if (!ok_ || !set_.try_read(end))
+      return;
+
+    /* scaled estimates can step backwards slightly, clamp those at zero */
+    for (std::size_t i = 0; i < Set::size; i++)
+      sink_[i] += end[i] > start_[i] ? end[i] - start_[i] : 0;
+  }
+
+private:
+  const Set &set_;
+  typename Set::values &sink_;
+  typename Set::values start_;
+  bool ok_;
+};
+
+} /* namespace libperf */
+
+#endif /* __LIB_LIBPERF_HPP */
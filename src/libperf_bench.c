@@ -0,0 +1,433 @@
+/******************************************************************************
+ * libperf_bench.c                                                            *
+ *                                                                            *
+ * This is the libperf benchmark harness.  It repeats a function until the   *
+ * wall time is known to a target relative error and reports mean, standard  *
+ * deviation, confidence interval and median per counter.                     *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_BENCH_WARMUP 3
+#define __LIBPERF_BENCH_MIN_TRIALS 5
+#define __LIBPERF_BENCH_MAX_TRIALS 100
+#define __LIBPERF_BENCH_REL_ERROR 0.01
+#define __LIBPERF_BENCH_CONFIDENCE 0.95
+
+/* two-sided Student t critical values for 1 .. 30 degrees of freedom */
+static const double t90[30] = {
+  6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+  1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725,
+  1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697
+};
+
+static const double t95[30] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static const double t99[30] = {
+  63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+  3.106, 3.055, 3.012, 2.977, 2.947, 2.921, 2.898, 2.878, 2.861, 2.845,
+  2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750
+};
+
+double
+__libperf_tcritical(double df, double confidence)
+{
+  const double *table;
+
+  double z;
+
+  int i;
+
+  if (confidence >= 0.985)
+    {
+      table = t99;
+      z = 2.576;
+    }
+  else if (confidence >= 0.925)
+    {
+      table = t95;
+      z = 1.960;
+    }
+  else
+    {
+      table = t90;
+      z = 1.645;
+    }
+
+  if (df < 1)
+    return INFINITY;
+
+  /* fractional Welch degrees of freedom round down, the safe side */
+  i = (int) df;
+  if (i <= 30)
+    return table[i - 1];
+
+  /* beyond the table the normal quantile with a 1/df correction is
+     within a percent of the exact value */
+  return z + (z * z * z + z) / (4 * df);
+}
+
+int
+__libperf_tsupported(double confidence)
+{
+  return confidence == 0.90 || confidence == 0.95 || confidence == 0.99;
+}
+
+void
+libperf_bench_defaults(struct libperf_bench_opts *opts)
+{
+  memset(opts, 0, sizeof(*opts));
+  opts->warmup = __LIBPERF_BENCH_WARMUP;
+  opts->min_trials = __LIBPERF_BENCH_MIN_TRIALS;
+  opts->max_trials = __LIBPERF_BENCH_MAX_TRIALS;
+  opts->rel_error = __LIBPERF_BENCH_REL_ERROR;
+  opts->confidence = __LIBPERF_BENCH_CONFIDENCE;
+  opts->cpu = -1;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* summarizes n samples of one quantity */
+static void
+summarize(const double *samples, int n, double confidence,
+          struct libperf_bench_stat *stat)
+{
+  double *sorted, mean = 0, M2 = 0, delta, half;
+
+  int i;
+
+  memset(stat, 0, sizeof(*stat));
+  if (n == 0)
+    return;
+
+  for (i = 0; i < n; i++)
+    {
+      delta = samples[i] - mean;
+      mean += delta / (i + 1);
+      M2 += delta * (samples[i] - mean);
+    }
+
+  stat->mean = mean;
+  stat->stddev = n > 1 ? sqrt(M2 / (n - 1)) : 0;
+
+  half = n > 1 ? __libperf_tcritical(n - 1, confidence) * stat->stddev /
+                 sqrt(n) : INFINITY;
+  stat->ci_low = mean - half;
+  stat->ci_high = mean + half;
+
+  sorted = malloc(n * sizeof(*sorted));
+  if (sorted == NULL)
+    {
+      stat->median = mean;
+      return;
+    }
+
+  memcpy(sorted, samples, n * sizeof(*sorted));
+  qsort(sorted, n, sizeof(*sorted), compare_double);
+  stat->min = sorted[0];
+  stat->max = sorted[n - 1];
+  stat->median = n % 2 ? sorted[n / 2] :
+                 (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  free(sorted);
+}
+
+/* has the confidence interval shrunk to the target share of the mean */
+static int
+converged(const double *samples, int n, const struct libperf_bench_opts *opts)
+{
+  struct libperf_bench_stat stat;
+
+  if (n < opts->min_trials || n < 2)
+    return 0;
+
+  summarize(samples, n, opts->confidence, &stat);
+  if (stat.mean == 0)
+    return 1;
+
+  return (stat.ci_high - stat.mean) / fabs(stat.mean) <= opts->rel_error;
+}
+
+/* pins the calling thread to cpu, remembering where it was allowed to run */
+static int
+pin(int cpu, cpu_set_t *saved)
+{
+  cpu_set_t set;
+
+  if (cpu < 0)
+    return 0;
+
+  if (sched_getaffinity(0, sizeof(*saved), saved) == -1)
+    return -1;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void
+unpin(int cpu, const cpu_set_t *saved)
+{
+  if (cpu >= 0)
+    sched_setaffinity(0, sizeof(*saved), saved);
+}
+
+/* one counted run of fn, values as in libperf_readall */
+static int
+counted_trial(struct libperf_data *pd, libperf_bench_fn fn, void *arg,
+              uint64_t *values)
+{
+  uint64_t start[LIBPERF_NR_COUNTERS];
+
+  int i;
+
+  if (libperf_resetall(pd) == -1 || libperf_readall(pd, start) == -1 ||
+      libperf_enableall(pd) == -1)
+    return -1;
+
+  fn(arg);
+
+  if (libperf_disableall(pd) == -1 || libperf_readall(pd, values) == -1)
+    return -1;
+
+  /* wall time keeps running across trials, the counters were reset */
+  values[LIBPERF_LIB_SW_WALL_TIME] -= start[LIBPERF_LIB_SW_WALL_TIME];
+  for (i = 0; i < LIBPERF_LIB_SW_WALL_TIME; i++)
+    values[i] = values[i] > start[i] ? values[i] - start[i] : 0;
+
+  return 0;
+}
+
+/* one uncounted run of fn, wall time in ns */
+static double
+bare_trial(libperf_bench_fn fn, void *arg)
+{
+  unsigned long long start = rdclock();
+
+  fn(arg);
+  return rdclock() - start;
+}
+
+static struct libperf_data *
+open_context(const struct libperf_bench_opts *opts)
+{
+  uint64_t mask = opts->mask ? opts->mask : LIBPERF_MASK_ALL;
+
+  /* the harness reads around fn, lazily opened counters never help */
+  return libperf_initialize_mask(-1, -1, mask,
+                                 opts->flags & ~LIBPERF_FLAG_LAZY);
+}
+
+int
+libperf_bench_run(libperf_bench_fn fn, void *arg,
+                  const struct libperf_bench_opts *opts,
+                  struct libperf_bench_result *result)
+{
+  struct libperf_bench_opts defaults;
+
+  struct libperf_data *pd;
+
+  uint64_t values[LIBPERF_NR_COUNTERS];
+
+  double *samples = NULL, *column = NULL;
+
+  cpu_set_t saved;
+
+  int i, c, n = 0, status = -1, saved_errno;
+
+  if (opts == NULL)
+    {
+      libperf_bench_defaults(&defaults);
+      opts = &defaults;
+    }
+
+  /* other levels would silently get the interval of the nearest table */
+  if (opts->max_trials < 1 || opts->min_trials > opts->max_trials ||
+      !__libperf_tsupported(opts->confidence))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (pin(opts->cpu, &saved) == -1)
+    return -1;
+
+  pd = open_context(opts);
+  samples = malloc(opts->max_trials * LIBPERF_NR_COUNTERS * sizeof(*samples));
+  column = malloc(opts->max_trials * sizeof(*column));
+  if (pd == NULL || samples == NULL || column == NULL)
+    goto out;
+
+  for (i = 0; i < opts->warmup; i++)
+    if (counted_trial(pd, fn, arg, values) == -1)
+      goto out;
+
+  /* trials are stored by counter so each counter is one column */
+  do
+    {
+      if (counted_trial(pd, fn, arg, values) == -1)
+        goto out;
+
+      for (c = 0; c < LIBPERF_NR_COUNTERS; c++)
+        samples[c * opts->max_trials + n] = values[c];
+      n++;
+    }
+  while (n < opts->max_trials &&
+         !converged(samples + LIBPERF_LIB_SW_WALL_TIME * opts->max_trials, n,
+                    opts));
+
+  memset(result, 0, sizeof(*result));
+  result->trials = n;
+  result->converged =
+    converged(samples + LIBPERF_LIB_SW_WALL_TIME * opts->max_trials, n, opts);
+
+  for (c = 0; c < LIBPERF_NR_COUNTERS; c++)
+    {
+      memcpy(column, samples + c * opts->max_trials, n * sizeof(*column));
+      summarize(column, n, opts->confidence, &result->stats[c]);
+    }
+
+  status = 0;
+
+out:
+  saved_errno = errno;
+  if (pd != NULL)
+    libperf_close(pd);
+  free(samples);
+  free(column);
+  unpin(opts->cpu, &saved);
+  errno = saved_errno;
+  return status;
+}
+
+int
+libperf_bench_overhead(libperf_bench_fn fn, void *arg,
+                       const struct libperf_bench_opts *opts,
+                       struct libperf_bench_overhead *result)
+{
+  struct libperf_bench_opts defaults;
+
+  struct libperf_data *pd;
+
+  uint64_t values[LIBPERF_NR_COUNTERS];
+
+  double *bare = NULL, *counted = NULL, vb, vc, df, half;
+
+  cpu_set_t saved;
+
+  int i, n = 0, status = -1, saved_errno;
+
+  if (opts == NULL)
+    {
+      libperf_bench_defaults(&defaults);
+      opts = &defaults;
+    }
+
+  /* other levels would silently get the interval of the nearest table */
+  if (opts->max_trials < 1 || opts->min_trials > opts->max_trials ||
+      !__libperf_tsupported(opts->confidence))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (pin(opts->cpu, &saved) == -1)
+    return -1;
+
+  pd = open_context(opts);
+  bare = malloc(opts->max_trials * sizeof(*bare));
+  counted = malloc(opts->max_trials * sizeof(*counted));
+  if (pd == NULL || bare == NULL || counted == NULL)
+    goto out;
+
+  for (i = 0; i < opts->warmup; i++)
+    {
+      bare_trial(fn, arg);
+      if (counted_trial(pd, fn, arg, values) == -1)
+        goto out;
+    }
+
+  /* alternating the two keeps slow drift out of the difference */
+  do
+    {
+      bare[n] = bare_trial(fn, arg);
+
+      if (counted_trial(pd, fn, arg, values) == -1)
+        goto out;
+      counted[n] = values[LIBPERF_LIB_SW_WALL_TIME];
+      n++;
+    }
+  while (n < opts->max_trials &&
+         !(converged(bare, n, opts) && converged(counted, n, opts)));
+
+  memset(result, 0, sizeof(*result));
+  result->trials = n;
+  summarize(bare, n, opts->confidence, &result->bare);
+  summarize(counted, n, opts->confidence, &result->instrumented);
+
+  result->difference = result->instrumented.mean - result->bare.mean;
+  if (result->bare.mean != 0)
+    result->relative = result->difference / result->bare.mean;
+
+  /* Welch interval of the difference of the means */
+  vb = result->bare.stddev * result->bare.stddev / n;
+  vc = result->instrumented.stddev * result->instrumented.stddev / n;
+  if (n > 1 && vb + vc > 0)
+    {
+      df = (vb + vc) * (vb + vc) / (vb * vb / (n - 1) + vc * vc / (n - 1));
+      half = __libperf_tcritical(df, opts->confidence) * sqrt(vb + vc);
+    }
+  else
+    half = n > 1 ? 0 : INFINITY;
+
+  result->ci_low = result->difference - half;
+  result->ci_high = result->difference + half;
+  status = 0;
+
+out:
+  saved_errno = errno;
+  if (pd != NULL)
+    libperf_close(pd);
+  free(bare);
+  free(counted);
+  unpin(opts->cpu, &saved);
+  errno = saved_errno;
+  return status;
+}
@@ -44,9 +44,12 @@ int
 main(int argc, char *argv[])
 {
   if (argc < 2)
-    fprintf(stderr, "Usage: bench <test #>\n");
+    {
+      fprintf(stderr, "Usage: bench <test #>\n");
+      return EXIT_FAILURE;
+    }
 
-  int test = atoi(argv[1]), status, i = 0;
+  int test = atoi(argv[1]), status, i = 0, pid;
 
   fprintf(stdout, "cmd[");
 
@@ -55,20 +58,17 @@ main(int argc, char *argv[])
 
   fprintf(stdout, " ]\n");
 
+  /* counting starts at the exec, not whenever the parent gets to it */
+  struct libperf_data *pd = libperf_spawn(tests[test], NULL, 0, &pid);
 
-  pid_t pid = fork();
-
-  struct libperf_data *pd = libperf_initialize(pid, -1);
-
-  if (pid == 0)
+  if (pd == NULL)
   {
-      execv(tests[test][0], tests[test]);
-  }
-  else
-  {
-      wait(&status);
-      libperf_finalize(pd, pd);
+      perror(tests[test][0]);
+      return EXIT_FAILURE;
   }
 
+  waitpid(pid, &status, 0);
+  libperf_finalize(pd, pd);
+
   return 0;
 }
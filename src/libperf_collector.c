@@ -0,0 +1,532 @@
+/******************************************************************************
+ * libperf_collector.c                                                        *
+ *                                                                            *
+ * This is the libperf system-wide collector.  It opens one cpu-wide context *
+ * per cpu and reports per-cpu, per-socket and total counter values.          *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_CPU_ONLINE "/sys/devices/system/cpu/online"
+#define __LIBPERF_CPU_PACKAGE \
+  "/sys/devices/system/cpu/cpu%d/topology/physical_package_id"
+#define __LIBPERF_MOUNTS "/proc/self/mounts"
+
+/* one monitored cpu */
+struct collector_cpu
+{
+  int cpu;
+  int socket;
+  int online;
+  struct libperf_data *pd;
+  uint64_t values[LIBPERF_NR_COUNTERS];    /* as of the last read */
+};
+
+/* collector struct */
+struct libperf_collector
+{
+  uint64_t mask;
+  int flags;
+  int enabled;
+  char *cpus;                   /* requested cpu list, NULL for all */
+  int cgroup;                   /* cgroup directory fd, -1 for every task */
+  struct collector_cpu *percpu;
+  int nr_cpus;
+  int nr_sockets;
+};
+
+/* parses a "0-3,8,10-11" style cpu list into a newly allocated array */
+static int
+parse_cpulist(const char *list, int **cpus)
+{
+  const char *p = list;
+
+  char *end;
+
+  long first, last, cpu;
+
+  int n = 0, size = 0, *array = NULL, *grown;
+
+  while (*p != '\0' && *p != '\n')
+    {
+      if (!isdigit((unsigned char) *p))
+        goto invalid;
+
+      first = last = strtol(p, &end, 10);
+      p = end;
+
+      if (*p == '-')
+        {
+          last = strtol(p + 1, &end, 10);
+          if (end == p + 1 || last < first)
+            goto invalid;
+          p = end;
+        }
+
+      for (cpu = first; cpu <= last; cpu++)
+        {
+          if (n == size)
+            {
+              size = size ? 2 * size : 64;
+              grown = realloc(array, size * sizeof(*array));
+              if (grown == NULL)
+                {
+                  free(array);
+                  return -1;
+                }
+              array = grown;
+            }
+          array[n++] = cpu;
+        }
+
+      if (*p == ',')
+        p++;
+    }
+
+  *cpus = array;
+  return n;
+
+invalid:
+  free(array);
+  errno = EINVAL;
+  return -1;
+}
+
+/* reads a small sysfs file into buf */
+static int
+read_sysfs(const char *path, char *buf, size_t size)
+{
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL)
+    return -1;
+
+  if (fgets(buf, size, f) == NULL)
+    {
+      fclose(f);
+      return -1;
+    }
+
+  fclose(f);
+  return 0;
+}
+
+static int
+cpu_socket(int cpu)
+{
+  char path[128], buf[32];
+
+  snprintf(path, sizeof(path), __LIBPERF_CPU_PACKAGE, cpu);
+  if (read_sysfs(path, buf, sizeof(buf)) == -1)
+    return 0;
+
+  return atoi(buf);
+}
+
+static int
+online_cpus(int **cpus)
+{
+  char buf[4096];
+
+  if (read_sysfs(__LIBPERF_CPU_ONLINE, buf, sizeof(buf)) == -1)
+    return -1;
+
+  return parse_cpulist(buf, cpus);
+}
+
+static struct collector_cpu *
+find_cpu(struct libperf_collector *c, int cpu)
+{
+  int i;
+
+  for (i = 0; i < c->nr_cpus; i++)
+    if (c->percpu[i].cpu == cpu)
+      return &c->percpu[i];
+
+  return NULL;
+}
+
+static int
+contains(const int *cpus, int n, int cpu)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (cpus[i] == cpu)
+      return 1;
+
+  return 0;
+}
+
+/* opens a cgroup v2 directory given as in /proc/<pid>/cgroup, relative to
+   the cgroup2 mount, or as a path under that mount */
+static int
+open_cgroup(const char *cgroup)
+{
+  struct mntent *m;
+
+  char path[PATH_MAX];
+
+  size_t length;
+
+  FILE *f;
+
+  int fd = -1, found = 0;
+
+  f = setmntent(__LIBPERF_MOUNTS, "r");
+  if (f == NULL)
+    return -1;
+
+  while (!found && (m = getmntent(f)) != NULL)
+    {
+      if (strcmp(m->mnt_type, "cgroup2") != 0)
+        continue;
+
+      found = 1;
+      length = strlen(m->mnt_dir);
+      if (strncmp(cgroup, m->mnt_dir, length) == 0 &&
+          (cgroup[length] == '/' || cgroup[length] == '\0'))
+        length = snprintf(path, sizeof(path), "%s", cgroup);
+      else
+        length = snprintf(path, sizeof(path), "%s/%s", m->mnt_dir,
+                          cgroup + (cgroup[0] == '/'));
+
+      if (length >= sizeof(path))
+        errno = ENAMETOOLONG;
+      else
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+  endmntent(f);
+
+  if (!found)
+    errno = ENOENT;
+  return fd;
+}
+
+static struct libperf_collector *
+collector_open(const char *events, const char *cpus, int flags,
+               const char *cgroup)
+{
+  struct libperf_collector *c;
+
+  uint64_t mask = LIBPERF_MASK_ALL;
+
+  int saved_errno;
+
+  if (events != NULL && libperf_parseevents(events, &mask) == -1)
+    return NULL;
+
+  c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+
+  c->mask = mask;
+  c->cgroup = -1;
+  c->flags = (flags & ~(LIBPERF_FLAG_MMAP | LIBPERF_FLAG_LAZY)) |
+             __LIBPERF_FLAG_SYSTEMWIDE;
+
+  if (cgroup != NULL)
+    {
+      c->cgroup = open_cgroup(cgroup);
+      if (c->cgroup == -1)
+        goto fail;
+      c->flags |= __LIBPERF_FLAG_CGROUP;
+    }
+
+  if (cpus != NULL && (c->cpus = strdup(cpus)) == NULL)
+    goto fail;
+
+  if (libperf_collector_rescan(c) == -1)
+    goto fail;
+
+  return c;
+
+fail:
+  saved_errno = errno;
+  libperf_collector_close(c);
+  errno = saved_errno;
+  return NULL;
+}
+
+struct libperf_collector *
+libperf_collector_open(const char *events, const char *cpus, int flags)
+{
+  return collector_open(events, cpus, flags, NULL);
+}
+
+struct libperf_collector *
+libperf_collector_open_cgroup(const char *cgroup, const char *events,
+                              const char *cpus, int flags)
+{
+  if (cgroup == NULL)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  return collector_open(events, cpus, flags, cgroup);
+}
+
+int
+libperf_collector_rescan(struct libperf_collector *c)
+{
+  struct collector_cpu *percpu, *pc;
+
+  int *online = NULL, *wanted = NULL, nr_online, nr_wanted = 0, i;
+
+  int max_socket = -1, was_online;
+
+  nr_online = online_cpus(&online);
+  if (nr_online == -1)
+    return -1;
+
+  if (c->cpus != NULL)
+    {
+      nr_wanted = parse_cpulist(c->cpus, &wanted);
+      if (nr_wanted == -1)
+        {
+          free(online);
+          return -1;
+        }
+    }
+
+  /* offline cpus keep their context so their counts stay in the totals */
+  for (i = 0; i < c->nr_cpus; i++)
+    {
+      pc = &c->percpu[i];
+      was_online = pc->online;
+      pc->online = contains(online, nr_online, pc->cpu);
+
+      /* hotplug turned the cpu's events off and nothing turns them back
+         on, so a cpu that returned is enabled again */
+      if (pc->online && !was_online && pc->pd != NULL && c->enabled &&
+          libperf_enableall(pc->pd) == -1)
+        goto fail;
+    }
+
+  for (i = 0; i < nr_online; i++)
+    {
+      if (c->cpus != NULL && !contains(wanted, nr_wanted, online[i]))
+        continue;
+
+      pc = find_cpu(c, online[i]);
+      if (pc != NULL && pc->pd != NULL)
+        continue;
+
+      if (pc == NULL)
+        {
+          percpu = realloc(c->percpu, (c->nr_cpus + 1) * sizeof(*percpu));
+          if (percpu == NULL)
+            goto fail;
+          c->percpu = percpu;
+
+          pc = &c->percpu[c->nr_cpus++];
+          memset(pc, 0, sizeof(*pc));
+          pc->cpu = online[i];
+          pc->socket = cpu_socket(online[i]);
+        }
+
+      pc->online = 1;
+      pc->pd = libperf_initialize_mask(c->cgroup, pc->cpu, c->mask, c->flags);
+      if (pc->pd == NULL)
+        goto fail;
+
+      /* cpus that come up later join in the current state */
+      if (c->enabled && libperf_enableall(pc->pd) == -1)
+        goto fail;
+    }
+
+  for (i = 0; i < c->nr_cpus; i++)
+    if (c->percpu[i].socket > max_socket)
+      max_socket = c->percpu[i].socket;
+  c->nr_sockets = max_socket + 1;
+
+  free(online);
+  free(wanted);
+  return 0;
+
+fail:
+  free(online);
+  free(wanted);
+  return -1;
+}
+
+/* applies fn to every cpu's context */
+static int
+collector_all(struct libperf_collector *c,
+              int (*fn)(struct libperf_data *pd))
+{
+  int i, result = 0;
+
+  for (i = 0; i < c->nr_cpus; i++)
+    if (c->percpu[i].pd != NULL && fn(c->percpu[i].pd) == -1)
+      result = -1;
+
+  return result;
+}
+
+int
+libperf_collector_enable(struct libperf_collector *c)
+{
+  c->enabled = 1;
+  return collector_all(c, libperf_enableall);
+}
+
+int
+libperf_collector_disable(struct libperf_collector *c)
+{
+  c->enabled = 0;
+  return collector_all(c, libperf_disableall);
+}
+
+int
+libperf_collector_reset(struct libperf_collector *c)
+{
+  return collector_all(c, libperf_resetall);
+}
+
+int
+libperf_collector_read(struct libperf_collector *c)
+{
+  int i, result = 0;
+
+  /* with LIBPERF_FLAG_GROUP each cpu costs a single read( ) */
+  for (i = 0; i < c->nr_cpus; i++)
+    if (c->percpu[i].pd != NULL &&
+        libperf_readall(c->percpu[i].pd, c->percpu[i].values) == -1)
+      result = -1;
+
+  return result;
+}
+
+int
+libperf_collector_nrcpus(struct libperf_collector *c)
+{
+  return c->nr_cpus;
+}
+
+int
+libperf_collector_nrsockets(struct libperf_collector *c)
+{
+  return c->nr_sockets;
+}
+
+int
+libperf_collector_cpuinfo(struct libperf_collector *c, int index,
+                          struct libperf_cpuinfo *info)
+{
+  if (index < 0 || index >= c->nr_cpus)
+    return -1;
+
+  info->cpu = c->percpu[index].cpu;
+  info->socket = c->percpu[index].socket;
+  info->online = c->percpu[index].online;
+  return 0;
+}
+
+int
+libperf_collector_percpu(struct libperf_collector *c, int index,
+                         uint64_t *out)
+{
+  if (index < 0 || index >= c->nr_cpus)
+    return -1;
+
+  memcpy(out, c->percpu[index].values, sizeof(c->percpu[index].values));
+  return 0;
+}
+
+/* sums counters over the cpus of one socket, or all cpus for socket -1 */
+static void
+sum_cpus(struct libperf_collector *c, int socket, uint64_t *out)
+{
+  const struct collector_cpu *pc;
+
+  int i, j;
+
+  memset(out, 0, LIBPERF_NR_COUNTERS * sizeof(*out));
+
+  for (i = 0; i < c->nr_cpus; i++)
+    {
+      pc = &c->percpu[i];
+      if (socket != -1 && pc->socket != socket)
+        continue;
+
+      for (j = 0; j < LIBPERF_NR_COUNTERS; j++)
+        {
+          /* wall time is shared, not additive */
+          if (j == LIBPERF_LIB_SW_WALL_TIME)
+            {
+              if (pc->values[j] > out[j])
+                out[j] = pc->values[j];
+            }
+          else
+            out[j] += pc->values[j];
+        }
+    }
+}
+
+int
+libperf_collector_persocket(struct libperf_collector *c, int socket,
+                            uint64_t *out)
+{
+  if (socket < 0 || socket >= c->nr_sockets)
+    return -1;
+
+  sum_cpus(c, socket, out);
+  return 0;
+}
+
+int
+libperf_collector_total(struct libperf_collector *c, uint64_t *out)
+{
+  sum_cpus(c, -1, out);
+  return 0;
+}
+
+void
+libperf_collector_close(struct libperf_collector *c)
+{
+  int i;
+
+  for (i = 0; i < c->nr_cpus; i++)
+    if (c->percpu[i].pd != NULL)
+      libperf_close(c->percpu[i].pd);
+
+  if (c->cgroup != -1)
+    close(c->cgroup);
+
+  free(c->percpu);
+  free(c->cpus);
+  free(c);
+}
@@ -0,0 +1,289 @@
+/******************************************************************************
+ * libperf_decode.c                                                           *
+ *                                                                            *
+ * This is libperf-decode, a tool streaming libperf binary logs out as CSV or *
+ * JSON lines.                                                                *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libperf.h"
+
+enum format
+{
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+static const char *
+type_name(uint32_t type)
+{
+  switch (type)
+    {
+    case LIBPERF_LOG_VALUES:
+      return "values";
+    case LIBPERF_LOG_TIMES:
+      return "times";
+    case LIBPERF_LOG_STATS:
+      return "stats";
+    case LIBPERF_LOG_METRIC:
+      return "metric";
+    default:
+      return NULL;
+    }
+}
+
+static const char *
+region_name(const struct libperf_logentry *e, char *buf, size_t size)
+{
+  if (e->region == LIBPERF_LOG_NOREGION)
+    return "";
+  if (e->region_name != NULL)
+    return e->region_name;
+
+  snprintf(buf, size, "%" PRIu32, e->region);
+  return buf;
+}
+
+static void
+print_json_string(const char *s)
+{
+  fputc('"', stdout);
+  for (; *s != '\0'; s++)
+    {
+      if (*s == '"' || *s == '\\')
+        fprintf(stdout, "\\%c", *s);
+      else if ((unsigned char) *s < 0x20)
+        fprintf(stdout, "\\u%04x", *s);
+      else
+        fputc(*s, stdout);
+    }
+  fputc('"', stdout);
+}
+
+/* RFC 4180 field, since event specs and region names may hold commas */
+static void
+print_csv_string(const char *s)
+{
+  fputc('"', stdout);
+  for (; *s != '\0'; s++)
+    {
+      if (*s == '"')
+        fputc('"', stdout);
+      fputc(*s, stdout);
+    }
+  fputc('"', stdout);
+}
+
+/* the leading columns up to and including the event */
+static void
+print_csv_prefix(const struct libperf_logentry *e, const char *region,
+                 const char *event)
+{
+  fprintf(stdout, "%s,%" PRIu64 ",%" PRIu32 ",", type_name(e->type),
+          e->timestamp, e->tid);
+  /* no region stays an empty field */
+  if (region[0] != '\0')
+    print_csv_string(region);
+  fprintf(stdout, ",%" PRIu64 ",", e->id);
+  print_csv_string(event);
+  fputc(',', stdout);
+}
+
+/* one row per event: kind,timestamp,tid,region,id,event,value,enabled,
+   running,n,mean,stddev,min,max */
+static void
+print_csv(const struct libperf_logentry *e)
+{
+  char buf[16];
+
+  const char *region = region_name(e, buf, sizeof(buf));
+
+  int i;
+
+  /* a metric is one row, its name in the event column */
+  if (e->metric != NULL)
+    {
+      print_csv_prefix(e, region, e->metric);
+      fprintf(stdout, "%.17g,,,,,,,\n", e->metric_value);
+      return;
+    }
+
+  for (i = 0; i < e->nr_events; i++)
+    {
+      print_csv_prefix(e, region, e->events[i]);
+
+      if (e->values != NULL)
+        fprintf(stdout, "%" PRIu64 ",,,,,,,\n", e->values[i]);
+      else if (e->time_enabled != NULL)
+        fprintf(stdout, ",%" PRIu64 ",%" PRIu64 ",,,,,\n",
+                e->time_enabled[i], e->time_running[i]);
+      else
+        fprintf(stdout, ",,,%" PRIu64 ",%.6g,%.6g,%.6g,%.6g\n",
+                e->stats[i].n, e->stats[i].mean, sqrt(e->stats[i].variance),
+                e->stats[i].min, e->stats[i].max);
+    }
+}
+
+/* one object per record */
+static void
+print_json(const struct libperf_logentry *e)
+{
+  char buf[16];
+
+  int i;
+
+  fprintf(stdout, "{\"type\":\"%s\",\"timestamp\":%" PRIu64
+          ",\"tid\":%" PRIu32 ",\"region\":", type_name(e->type),
+          e->timestamp, e->tid);
+
+  if (e->region == LIBPERF_LOG_NOREGION)
+    fprintf(stdout, "null");
+  else
+    print_json_string(region_name(e, buf, sizeof(buf)));
+
+  fprintf(stdout, ",\"id\":%" PRIu64, e->id);
+
+  if (e->metric != NULL)
+    {
+      fprintf(stdout, ",\"metric\":");
+      print_json_string(e->metric);
+      /* JSON has no NaN, an undefined ratio is null */
+      if (isnan(e->metric_value) || isinf(e->metric_value))
+        fprintf(stdout, ",\"value\":null}\n");
+      else
+        fprintf(stdout, ",\"value\":%.17g}\n", e->metric_value);
+      return;
+    }
+
+  fprintf(stdout, ",\"events\":{");
+
+  for (i = 0; i < e->nr_events; i++)
+    {
+      if (i > 0)
+        fputc(',', stdout);
+      print_json_string(e->events[i]);
+      fputc(':', stdout);
+
+      if (e->values != NULL)
+        fprintf(stdout, "%" PRIu64, e->values[i]);
+      else if (e->time_enabled != NULL)
+        fprintf(stdout, "{\"enabled\":%" PRIu64 ",\"running\":%" PRIu64 "}",
+                e->time_enabled[i], e->time_running[i]);
+      else
+        fprintf(stdout, "{\"n\":%" PRIu64 ",\"mean\":%.17g,\"stddev\":%.17g,"
+                "\"min\":%.17g,\"max\":%.17g}", e->stats[i].n,
+                e->stats[i].mean, sqrt(e->stats[i].variance),
+                e->stats[i].min, e->stats[i].max);
+    }
+
+  fprintf(stdout, "}}\n");
+}
+
+static int
+decode(const char *path, enum format format)
+{
+  struct libperf_logreader *r = libperf_logreader_open(path);
+
+  struct libperf_logentry e;
+
+  int result;
+
+  if (r == NULL)
+    {
+      perror(path);
+      return -1;
+    }
+
+  while ((result = libperf_logreader_next(r, &e)) == 1)
+    {
+      if (type_name(e.type) == NULL)
+        continue;
+
+      if (format == FORMAT_CSV)
+        print_csv(&e);
+      else
+        print_json(&e);
+    }
+
+  if (result == -1)
+    fprintf(stderr, "%s: corrupt or truncated log\n", path);
+
+  libperf_logreader_close(r);
+  return result;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-f csv|json] <log file>...\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  enum format format = FORMAT_CSV;
+
+  int opt, status = EXIT_SUCCESS;
+
+  while ((opt = getopt(argc, argv, "f:h")) != -1)
+    {
+      switch (opt)
+        {
+        case 'f':
+          if (strcmp(optarg, "csv") == 0)
+            format = FORMAT_CSV;
+          else if (strcmp(optarg, "json") == 0)
+            format = FORMAT_JSON;
+          else
+            {
+              usage(argv[0]);
+              return EXIT_FAILURE;
+            }
+          break;
+
+        default:
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (optind == argc)
+    {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (format == FORMAT_CSV)
+    fprintf(stdout, "kind,timestamp,tid,region,id,event,value,enabled,"
+            "running,n,mean,stddev,min,max\n");
+
+  for (; optind < argc; optind++)
+    if (decode(argv[optind], format) == -1)
+      status = EXIT_FAILURE;
+
+  return status;
+}
@@ -0,0 +1,577 @@
+/******************************************************************************
+ * libperf_diff.c                                                             *
+ *                                                                            *
+ * This is libperf-diff, a tool comparing two sets of libperf binary logs.    *
+ * It lines runs up by region and event, tests each difference with Welch's   *
+ * t-test and exits non-zero when a counter regressed beyond a threshold.     *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define DIFF_BUCKETS 256
+#define DIFF_THRESHOLD 5.0                     /* percent */
+#define DIFF_CONFIDENCE 0.95
+
+/* exit status when a regression was found, errors exit with 2 */
+#define EXIT_REGRESSION 1
+#define EXIT_ERROR 2
+
+enum format
+{
+  FORMAT_TEXT,
+  FORMAT_JSON
+};
+
+/* running mean and sum of squared deviations of one side */
+struct summary
+{
+  double n, mean, M2;
+};
+
+/* one region and event, with a summary per set of logs; whole-run values
+   are single observations, region stats records are already summaries */
+struct key
+{
+  char *region;                         /* "" outside of regions */
+  char *event;
+  struct summary values[2];
+  struct summary stats[2];
+  struct key *next;
+};
+
+static struct key *buckets[DIFF_BUCKETS];
+
+static int nr_keys;
+
+static const char *only;                /* -e list, NULL for every event */
+
+static const char *higher;              /* -r list, besides the builtins */
+
+/* builtin metrics where a rise is an improvement */
+static const char *const higher_builtins = "ipc,ghz";
+
+static void
+add_value(struct summary *s, double value)
+{
+  double delta;
+
+  s->n++;
+  delta = value - s->mean;
+  s->mean += delta / s->n;
+  s->M2 += delta * (value - s->mean);
+}
+
+/* merges a summary of n samples, Chan et al.'s parallel update */
+static void
+add_summary(struct summary *s, double n, double mean, double variance)
+{
+  double total = s->n + n, delta = mean - s->mean;
+
+  if (n == 0)
+    return;
+
+  s->M2 += (n > 1 ? variance * (n - 1) : 0) + delta * delta * s->n * n / total;
+  s->mean += delta * n / total;
+  s->n = total;
+}
+
+static double
+variance(const struct summary *s)
+{
+  return s->n > 1 ? s->M2 / (s->n - 1) : 0.0;
+}
+
+/* event is an entry of a comma separated list */
+static int
+in_list(const char *list, const char *event)
+{
+  size_t len = strlen(event);
+
+  const char *p = list;
+
+  while ((p = strstr(p, event)) != NULL)
+    {
+      if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+        return 1;
+      p += len;
+    }
+
+  return 0;
+}
+
+/* event is part of the -e list */
+static int
+selected(const char *event)
+{
+  return only == NULL || in_list(only, event);
+}
+
+/* a significant rise of event is an improvement rather than a regression */
+static int
+higher_is_better(const char *event)
+{
+  return in_list(higher_builtins, event) ||
+         (higher != NULL && in_list(higher, event));
+}
+
+static struct key *
+find_key(const char *region, const char *event)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  const char *p;
+
+  struct key *k, **bucket;
+
+  for (p = region; *p != '\0'; p++)
+    hash = (hash ^ (unsigned char) *p) * 0x100000001b3ULL;
+  hash = (hash ^ '/') * 0x100000001b3ULL;
+  for (p = event; *p != '\0'; p++)
+    hash = (hash ^ (unsigned char) *p) * 0x100000001b3ULL;
+
+  bucket = &buckets[hash % DIFF_BUCKETS];
+  for (k = *bucket; k != NULL; k = k->next)
+    if (strcmp(k->region, region) == 0 && strcmp(k->event, event) == 0)
+      return k;
+
+  k = calloc(1, sizeof(*k));
+  if (k == NULL)
+    return NULL;
+
+  k->region = strdup(region);
+  k->event = strdup(event);
+  if (k->region == NULL || k->event == NULL)
+    {
+      free(k->region);
+      free(k->event);
+      free(k);
+      return NULL;
+    }
+
+  k->next = *bucket;
+  *bucket = k;
+  nr_keys++;
+  return k;
+}
+
+/* folds one record into the summaries of a side */
+static int
+add_entry(const struct libperf_logentry *e, int side)
+{
+  char buf[16];
+
+  const char *region = "";
+
+  struct key *k;
+
+  int i;
+
+  if (e->region != LIBPERF_LOG_NOREGION)
+    {
+      region = e->region_name;
+      if (region == NULL)
+        {
+          snprintf(buf, sizeof(buf), "%" PRIu32, e->region);
+          region = buf;
+        }
+    }
+
+  if (e->type == LIBPERF_LOG_METRIC)
+    {
+      if (!selected(e->metric) || isnan(e->metric_value))
+        return 0;
+      if ((k = find_key(region, e->metric)) == NULL)
+        return -1;
+      add_value(&k->values[side], e->metric_value);
+      return 0;
+    }
+
+  if (e->type != LIBPERF_LOG_VALUES && e->type != LIBPERF_LOG_STATS)
+    return 0;
+
+  for (i = 0; i < e->nr_events; i++)
+    {
+      if (!selected(e->events[i]))
+        continue;
+      if ((k = find_key(region, e->events[i])) == NULL)
+        return -1;
+
+      if (e->type == LIBPERF_LOG_VALUES)
+        add_value(&k->values[side], e->values[i]);
+      else
+        add_summary(&k->stats[side], e->stats[i].n, e->stats[i].mean,
+                    e->stats[i].variance);
+    }
+
+  return 0;
+}
+
+/* streams one log, holding a single record at a time */
+static int
+read_log(const char *path, int side)
+{
+  struct libperf_logreader *r = libperf_logreader_open(path);
+
+  struct libperf_logentry e;
+
+  int result;
+
+  if (r == NULL)
+    {
+      perror(path);
+      return -1;
+    }
+
+  while ((result = libperf_logreader_next(r, &e)) == 1)
+    if (add_entry(&e, side) == -1)
+      {
+        perror("libperf-diff");
+        result = -1;
+        break;
+      }
+
+  if (result == -1)
+    fprintf(stderr, "%s: corrupt or truncated log\n", path);
+
+  libperf_logreader_close(r);
+  return result;
+}
+
+/* region end values and finalize stats describe the same samples, the
+   stats win when a side has both */
+static const struct summary *
+side(const struct key *k, int i)
+{
+  return k->stats[i].n > 0 ? &k->stats[i] : &k->values[i];
+}
+
+static int
+compare_keys(const void *a, const void *b)
+{
+  const struct key *x = *(const struct key *const *) a;
+
+  const struct key *y = *(const struct key *const *) b;
+
+  int result = strcmp(x->region, y->region);
+
+  return result != 0 ? result : strcmp(x->event, y->event);
+}
+
+enum verdict
+{
+  VERDICT_UNTESTED,                     /* under two runs on a side */
+  VERDICT_SAME,
+  VERDICT_IMPROVED,
+  VERDICT_REGRESSED
+};
+
+static const char *const verdict_names[] = {
+  "n/a", "same", "improved", "REGRESSED"
+};
+
+struct result
+{
+  double change;                        /* percent of the base mean */
+  double ci;                            /* half width, percent */
+  double t;
+  double df;
+  enum verdict verdict;
+};
+
+/* Welch's t-test of the difference of the means; counts are costs, so
+   a significant increase beyond the threshold is a regression unless the
+   event is one where higher is better */
+static void
+test(const struct summary *a, const struct summary *b, double confidence,
+     double threshold, int higher_better, struct result *r)
+{
+  double va = variance(a) / a->n, vb = variance(b) / b->n;
+
+  double diff = b->mean - a->mean, half = 0;
+
+  memset(r, 0, sizeof(*r));
+  r->change = a->mean != 0 ? 100.0 * diff / fabs(a->mean) :
+              (diff != 0 ? INFINITY : 0);
+  r->verdict = VERDICT_UNTESTED;
+
+  if (a->n < 2 || b->n < 2)
+    return;
+
+  if (va + vb > 0)
+    {
+      r->df = (va + vb) * (va + vb) /
+              (va * va / (a->n - 1) + vb * vb / (b->n - 1));
+      r->t = diff / sqrt(va + vb);
+      half = __libperf_tcritical(r->df, confidence) * sqrt(va + vb);
+    }
+  else
+    {
+      /* constant on both sides: any difference is real */
+      r->df = a->n + b->n - 2;
+      r->t = diff != 0 ? copysign(INFINITY, diff) : 0;
+    }
+
+  r->ci = a->mean != 0 ? 100.0 * half / fabs(a->mean) : 0;
+  r->verdict = VERDICT_SAME;
+
+  if (fabs(diff) > half && fabs(r->change) > threshold)
+    r->verdict = (diff > 0) != higher_better ? VERDICT_REGRESSED :
+                 VERDICT_IMPROVED;
+}
+
+static void
+print_json_string(const char *s)
+{
+  fputc('"', stdout);
+  for (; *s != '\0'; s++)
+    {
+      if (*s == '"' || *s == '\\')
+        fprintf(stdout, "\\%c", *s);
+      else if ((unsigned char) *s < 0x20)
+        fprintf(stdout, "\\u%04x", *s);
+      else
+        fputc(*s, stdout);
+    }
+  fputc('"', stdout);
+}
+
+/* JSON has no NaN or infinity, an undefined value is null */
+static void
+print_json_double(const char *name, double value)
+{
+  fprintf(stdout, ",\"%s\":", name);
+  if (isnan(value) || isinf(value))
+    fprintf(stdout, "null");
+  else
+    fprintf(stdout, "%.17g", value);
+}
+
+static void
+print_result(const struct key *k, const struct result *r, enum format format)
+{
+  const struct summary *a = side(k, 0), *b = side(k, 1);
+
+  if (format == FORMAT_JSON)
+    {
+      fprintf(stdout, "{\"region\":");
+      if (k->region[0] == '\0')
+        fprintf(stdout, "null");
+      else
+        print_json_string(k->region);
+      fprintf(stdout, ",\"event\":");
+      print_json_string(k->event);
+      fprintf(stdout, ",\"base_n\":%.0f,\"new_n\":%.0f", a->n, b->n);
+      print_json_double("base_mean", a->mean);
+      print_json_double("new_mean", b->mean);
+      print_json_double("change", r->change);
+      print_json_double("ci", r->ci);
+      print_json_double("t", r->t);
+      print_json_double("df", r->df);
+      fprintf(stdout, ",\"verdict\":\"%s\"}\n", verdict_names[r->verdict]);
+      return;
+    }
+
+  fprintf(stdout, "%-16s %-24s %5.0f %18.6g %5.0f %18.6g %+9.2f%% +- %6.2f%%"
+          "  %s\n", k->region[0] != '\0' ? k->region : "-", k->event, a->n,
+          a->mean, b->n, b->mean, r->change, r->ci,
+          verdict_names[r->verdict]);
+}
+
+/* prints every key seen on both sides, returns the number of regressions
+   and sets tested to the number of keys with two runs on each side */
+static int
+report(double confidence, double threshold, enum format format, int *tested)
+{
+  struct key **keys = malloc((nr_keys + 1) * sizeof(*keys)), *k;
+
+  struct result r;
+
+  int i, n = 0, regressions = 0;
+
+  *tested = 0;
+
+  if (keys == NULL)
+    {
+      perror("libperf-diff");
+      return -1;
+    }
+
+  for (i = 0; i < DIFF_BUCKETS; i++)
+    for (k = buckets[i]; k != NULL; k = k->next)
+      if (side(k, 0)->n > 0 && side(k, 1)->n > 0)
+        keys[n++] = k;
+
+  qsort(keys, n, sizeof(*keys), compare_keys);
+
+  if (format == FORMAT_TEXT)
+    fprintf(stdout, "%-16s %-24s %5s %18s %5s %18s %10s %10s  %s\n", "region",
+            "event", "n", "base", "n", "new", "change", "ci", "verdict");
+
+  for (i = 0; i < n; i++)
+    {
+      test(side(keys[i], 0), side(keys[i], 1), confidence, threshold,
+           higher_is_better(keys[i]->event), &r);
+      print_result(keys[i], &r, format);
+      if (r.verdict == VERDICT_REGRESSED)
+        regressions++;
+      if (r.verdict != VERDICT_UNTESTED)
+        (*tested)++;
+    }
+
+  /* a single run per side cannot regress, which must not pass silently */
+  if (*tested < n)
+    {
+      fflush(stdout);
+      fprintf(stderr, "libperf-diff: %d of %d counters have fewer than 2 runs "
+              "on a side and were not tested\n", n - *tested, n);
+    }
+
+  if (format == FORMAT_TEXT)
+    fprintf(stdout, "%d of %d compared counters regressed by more than "
+            "%.4g%% at %.0f%% confidence\n", regressions, n, threshold,
+            100 * confidence);
+
+  free(keys);
+  return regressions;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-c 0.90|0.95|0.99] [-t percent] [-e events] "
+          "[-r events] [-f text|json] [-s]\n"
+          "       %*s base.libperf new.libperf\n"
+          "       %*s base.libperf... : new.libperf...\n"
+          "  -c  confidence of the Welch t-test, default %.2f\n"
+          "  -t  smallest change reported as a regression, default %.4g%%\n"
+          "  -e  comma separated events and metrics to compare\n"
+          "  -r  comma separated events and metrics where higher is better,\n"
+          "      besides %s\n"
+          "  -f  output format\n"
+          "  -s  treat logs where no counter could be tested as an error\n"
+          "exits with %d if a counter regressed, %d on errors\n",
+          name, (int) strlen(name), "", (int) strlen(name), "",
+          DIFF_CONFIDENCE, DIFF_THRESHOLD, higher_builtins, EXIT_REGRESSION,
+          EXIT_ERROR);
+}
+
+int
+main(int argc, char *argv[])
+{
+  enum format format = FORMAT_TEXT;
+
+  double confidence = DIFF_CONFIDENCE, threshold = DIFF_THRESHOLD;
+
+  int opt, i, split = -1, current = 0, regressions, tested, strict = 0;
+
+  char *end;
+
+  while ((opt = getopt(argc, argv, "c:t:e:r:f:sh")) != -1)
+    {
+      switch (opt)
+        {
+        case 'c':
+          /* the t tables only cover 0.90, 0.95 and 0.99 */
+          confidence = strtod(optarg, &end);
+          if (*end != '\0' || !__libperf_tsupported(confidence))
+            {
+              usage(argv[0]);
+              return EXIT_ERROR;
+            }
+          break;
+        case 't':
+          threshold = strtod(optarg, &end);
+          if (*end != '\0' || threshold < 0)
+            {
+              usage(argv[0]);
+              return EXIT_ERROR;
+            }
+          break;
+        case 'e':
+          only = optarg;
+          break;
+        case 'r':
+          higher = optarg;
+          break;
+        case 's':
+          strict = 1;
+          break;
+        case 'f':
+          if (strcmp(optarg, "text") == 0)
+            format = FORMAT_TEXT;
+          else if (strcmp(optarg, "json") == 0)
+            format = FORMAT_JSON;
+          else
+            {
+              usage(argv[0]);
+              return EXIT_ERROR;
+            }
+          break;
+        default:
+          usage(argv[0]);
+          return EXIT_ERROR;
+        }
+    }
+
+  /* two sets split by ":", or one log each */
+  for (i = optind; i < argc; i++)
+    if (strcmp(argv[i], ":") == 0)
+      {
+        split = i;
+        break;
+      }
+
+  if (split == -1 && argc - optind == 2)
+    split = optind + 1;
+  else if (split == -1 || split == optind || split == argc - 1)
+    {
+      usage(argv[0]);
+      return EXIT_ERROR;
+    }
+
+  for (i = optind; i < argc; i++)
+    {
+      if (i == split && strcmp(argv[i], ":") == 0)
+        {
+          current = 1;
+          continue;
+        }
+      if (i == split)
+        current = 1;
+      if (read_log(argv[i], current) == -1)
+        return EXIT_ERROR;
+    }
+
+  regressions = report(confidence, threshold, format, &tested);
+  if (regressions < 0 || (strict && tested == 0))
+    return EXIT_ERROR;
+
+  return regressions > 0 ? EXIT_REGRESSION : EXIT_SUCCESS;
+}
@@ -0,0 +1,519 @@
+/******************************************************************************
+ * libperf_events.c                                                           *
+ *                                                                            *
+ * This is the libperf event spec parser.  It turns perf tool style event     *
+ * specs, such as "cpu/event=0x3c,umask=0x1/u", "r01c2:k", "4:0x3c" or a      *
+ * sysfs event alias, into a struct perf_event_attr.                          *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/perf_event.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_PMU_DIR "/sys/bus/event_source/devices"
+#define __LIBPERF_TRACEFS "/sys/kernel/tracing"
+#define __LIBPERF_TRACEFS_DEBUGFS "/sys/kernel/debug/tracing"
+#define __LIBPERF_SPEC_MAX 256
+#define __LIBPERF_MODIFIERS "ukhGHIp"
+
+int
+__libperf_nextevent(const char **list, char *buf, size_t size)
+{
+  const char *p = *list, *start;
+
+  int depth = 0;
+
+  size_t len;
+
+  /* skip separators and blanks */
+  while (*p == ',' || isspace((unsigned char) *p))
+    p++;
+
+  if (*p == '\0')
+    {
+      *list = p;
+      return 0;
+    }
+
+  /* commas between a pmu's slashes belong to its terms */
+  for (start = p; *p != '\0' && (*p != ',' || depth); p++)
+    if (*p == '/')
+      depth = !depth;
+
+  len = p - start;
+  while (len > 0 && isspace((unsigned char) start[len - 1]))
+    len--;
+
+  *list = p;
+
+  if (len >= size)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  memcpy(buf, start, len);
+  buf[len] = '\0';
+  return 1;
+}
+
+/* reads a small sysfs file of a pmu */
+static int
+read_pmu_file(const char *pmu, const char *dir, const char *name, char *buf,
+              size_t size)
+{
+  char path[512];
+
+  FILE *f;
+
+  if (strchr(pmu, '/') != NULL || strchr(name, '/') != NULL ||
+      strcmp(name, "..") == 0 || strcmp(name, ".") == 0)
+    return -1;
+
+  if (dir != NULL)
+    snprintf(path, sizeof(path), __LIBPERF_PMU_DIR "/%s/%s/%s", pmu, dir,
+             name);
+  else
+    snprintf(path, sizeof(path), __LIBPERF_PMU_DIR "/%s/%s", pmu, name);
+
+  f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+
+  if (fgets(buf, size, f) == NULL)
+    {
+      fclose(f);
+      return -1;
+    }
+
+  fclose(f);
+  buf[strcspn(buf, "\n")] = '\0';
+  return 0;
+}
+
+/* parses 0x.., 0.. or decimal values in full 64 bit range */
+static int
+parse_number(const char *s, uint64_t *value)
+{
+  char *end;
+
+  if (*s == '\0' || *s == '-')
+    return -1;
+
+  errno = 0;
+  *value = strtoull(s, &end, 0);
+  return (*end != '\0' || errno != 0) ? -1 : 0;
+}
+
+static __u64 *
+config_field(struct perf_event_attr *attr, const char *name)
+{
+  if (strcmp(name, "config") == 0)
+    return &attr->config;
+  if (strcmp(name, "config1") == 0)
+    return &attr->config1;
+  if (strcmp(name, "config2") == 0)
+    return &attr->config2;
+
+  return NULL;
+}
+
+/* resolves subsys:name to its tracepoint id through tracefs, mounted on
+   its own or below debugfs on older systems */
+static int
+parse_tracepoint(const char *subsys, const char *name,
+                 struct perf_event_attr *attr)
+{
+  static const char *const roots[] = {
+    __LIBPERF_TRACEFS, __LIBPERF_TRACEFS_DEBUGFS
+  };
+
+  char path[512], buf[32];
+
+  uint64_t id;
+
+  unsigned int i;
+
+  FILE *f = NULL;
+
+  if (*subsys == '\0' || *name == '\0' || strchr(name, '/') != NULL ||
+      strchr(subsys, '/') != NULL || subsys[0] == '.' || name[0] == '.')
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  for (i = 0; f == NULL && i < sizeof(roots) / sizeof(roots[0]); i++)
+    {
+      snprintf(path, sizeof(path), "%s/events/%s/%s/id", roots[i], subsys,
+               name);
+      f = fopen(path, "r");
+    }
+
+  if (f == NULL)
+    {
+      errno = ENOENT;
+      return -1;
+    }
+
+  if (fgets(buf, sizeof(buf), f) == NULL)
+    {
+      fclose(f);
+      errno = ENOENT;
+      return -1;
+    }
+  fclose(f);
+
+  buf[strcspn(buf, "\n")] = '\0';
+  if (parse_number(buf, &id) == -1)
+    return -1;
+
+  attr->type = PERF_TYPE_TRACEPOINT;
+  attr->config = id;
+  return 0;
+}
+
+/* spreads value over the bits a format file such as "config:0-7,21"
+   names, lowest range first */
+static int
+apply_format(struct perf_event_attr *attr, const char *format, uint64_t value)
+{
+  char field[16], *p;
+
+  const char *colon = strchr(format, ':');
+
+  __u64 *target;
+
+  long lo, hi, bit;
+
+  int used = 0;
+
+  if (colon == NULL || (size_t) (colon - format) >= sizeof(field))
+    return -1;
+
+  memcpy(field, format, colon - format);
+  field[colon - format] = '\0';
+
+  target = config_field(attr, field);
+  if (target == NULL)
+    return -1;
+
+  p = (char *) colon + 1;
+  while (*p != '\0')
+    {
+      lo = hi = strtol(p, &p, 10);
+      if (*p == '-')
+        hi = strtol(p + 1, &p, 10);
+      if (lo < 0 || hi > 63 || lo > hi)
+        return -1;
+
+      for (bit = lo; bit <= hi; bit++, used++)
+        {
+          if (used < 64 && (value >> used) & 1)
+            *target |= 1ULL << bit;
+          else
+            *target &= ~(1ULL << bit);
+        }
+
+      if (*p == ',')
+        p++;
+      else if (*p != '\0')
+        return -1;
+    }
+
+  /* bits that did not fit mean the value is too wide for the field */
+  if (used < 64 && (value >> used) != 0)
+    return -1;
+
+  return 0;
+}
+
+static int parse_terms(const char *pmu, char *terms,
+                       struct perf_event_attr *attr, int depth);
+
+/* applies one name[=value] term of a pmu spec */
+static int
+apply_term(const char *pmu, const char *name, const char *value_str,
+           struct perf_event_attr *attr, int depth)
+{
+  char buf[__LIBPERF_SPEC_MAX];
+
+  uint64_t value = 1;
+
+  __u64 *field;
+
+  if (value_str != NULL && parse_number(value_str, &value) == -1)
+    return -1;
+
+  if ((field = config_field(attr, name)) != NULL)
+    {
+      *field = value;
+      return 0;
+    }
+
+  if (strcmp(name, "period") == 0)
+    attr->sample_period = value;
+  else if (strcmp(name, "exclude_user") == 0)
+    attr->exclude_user = !!value;
+  else if (strcmp(name, "exclude_kernel") == 0)
+    attr->exclude_kernel = !!value;
+  else if (strcmp(name, "exclude_hv") == 0)
+    attr->exclude_hv = !!value;
+  else if (strcmp(name, "exclude_idle") == 0)
+    attr->exclude_idle = !!value;
+  else if (read_pmu_file(pmu, "format", name, buf, sizeof(buf)) == 0)
+    return apply_format(attr, buf, value);
+  else if (value_str == NULL && depth == 0 &&
+           read_pmu_file(pmu, "events", name, buf, sizeof(buf)) == 0)
+    return parse_terms(pmu, buf, attr, depth + 1);   /* event alias */
+  else
+    return -1;
+
+  return 0;
+}
+
+/* parses the comma separated terms between a pmu's slashes */
+static int
+parse_terms(const char *pmu, char *terms, struct perf_event_attr *attr,
+            int depth)
+{
+  char *term, *save = NULL, *eq;
+
+  for (term = strtok_r(terms, ",", &save); term != NULL;
+       term = strtok_r(NULL, ",", &save))
+    {
+      while (isspace((unsigned char) *term))
+        term++;
+      if (*term == '\0')
+        continue;
+
+      eq = strchr(term, '=');
+      if (eq != NULL)
+        *eq++ = '\0';
+
+      if (apply_term(pmu, term, eq, attr, depth) == -1)
+        return -1;
+    }
+
+  return 0;
+}
+
+/* pmu/terms/ */
+static int
+parse_pmu(char *spec, struct perf_event_attr *attr)
+{
+  char *slash = strchr(spec, '/'), *terms, *end, buf[32];
+
+  uint64_t type;
+
+  if (slash == NULL)
+    return -1;
+
+  *slash = '\0';
+  terms = slash + 1;
+  end = strrchr(terms, '/');
+  if (end == NULL || end[1] != '\0')
+    return -1;
+  *end = '\0';
+
+  if (read_pmu_file(spec, NULL, "type", buf, sizeof(buf)) == -1 ||
+      parse_number(buf, &type) == -1)
+    return -1;
+
+  attr->type = type;
+  return parse_terms(spec, terms, attr, 0);
+}
+
+/* finds a pmu that exports name under events/ */
+static int
+parse_alias(const char *name, struct perf_event_attr *attr)
+{
+  char spec[__LIBPERF_SPEC_MAX];
+
+  struct dirent *entry;
+
+  DIR *dir = opendir(__LIBPERF_PMU_DIR);
+
+  char buf[__LIBPERF_SPEC_MAX];
+
+  int result = -1;
+
+  if (dir == NULL)
+    return -1;
+
+  while (result == -1 && (entry = readdir(dir)) != NULL)
+    {
+      if (entry->d_name[0] == '.' ||
+          read_pmu_file(entry->d_name, "events", name, buf, sizeof(buf)) == -1)
+        continue;
+
+      if ((size_t) snprintf(spec, sizeof(spec), "%s/%s/", entry->d_name,
+                            name) >= sizeof(spec))
+        continue;
+
+      memset(attr, 0, sizeof(*attr));
+      result = parse_pmu(spec, attr);
+    }
+
+  closedir(dir);
+  return result;
+}
+
+/* perf tool modifiers: u, k and h pick the privilege levels counted */
+static int
+apply_modifiers(const char *mods, struct perf_event_attr *attr)
+{
+  int user = 0, kernel = 0, hv = 0;
+
+  for (; *mods != '\0'; mods++)
+    switch (*mods)
+      {
+      case 'u':
+        user = 1;
+        break;
+      case 'k':
+        kernel = 1;
+        break;
+      case 'h':
+        hv = 1;
+        break;
+      case 'G':
+        attr->exclude_host = 1;
+        break;
+      case 'H':
+        attr->exclude_guest = 1;
+        break;
+      case 'I':
+        attr->exclude_idle = 1;
+        break;
+      case 'p':
+        if (attr->precise_ip < 3)
+          attr->precise_ip++;
+        break;
+      default:
+        return -1;
+      }
+
+  if (user || kernel || hv)
+    {
+      attr->exclude_user = !user;
+      attr->exclude_kernel = !kernel;
+      attr->exclude_hv = !hv;
+    }
+
+  return 0;
+}
+
+/* splits trailing modifiers off spec, returns them or NULL */
+static char *
+split_modifiers(char *spec)
+{
+  char *colon = strrchr(spec, ':'), *slash = strrchr(spec, '/'), *mods;
+
+  /* pmu/terms/ukh without a colon, as perf accepts */
+  if (slash != NULL && slash[1] != '\0' && slash[1] != ':' &&
+      strspn(slash + 1, __LIBPERF_MODIFIERS) == strlen(slash + 1))
+    {
+      mods = strdup(slash + 1);
+      slash[1] = '\0';
+      return mods;
+    }
+
+  if (colon == NULL || (slash != NULL && colon < slash) || colon[1] == '\0' ||
+      strspn(colon + 1, __LIBPERF_MODIFIERS) != strlen(colon + 1))
+    return NULL;
+
+  mods = strdup(colon + 1);
+  *colon = '\0';
+  return mods;
+}
+
+int
+libperf_parseattr(const char *spec, struct perf_event_attr *attr)
+{
+  char copy[__LIBPERF_SPEC_MAX], *mods, *colon, *end;
+
+  uint64_t type, config;
+
+  int counter, result = -1, missing = 0;
+
+  if (strlen(spec) >= sizeof(copy))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  strcpy(copy, spec);
+  mods = split_modifiers(copy);
+  memset(attr, 0, sizeof(*attr));
+
+  colon = strchr(copy, ':');
+
+  if (strchr(copy, '/') != NULL)
+    result = parse_pmu(copy, attr);
+  else if ((counter = libperf_eventbyname(copy)) >= 0)
+    result = __libperf_defaultattr(counter, attr);
+  else if (copy[0] == 'r' && copy[1] != '\0' &&
+           strspn(copy + 1, "0123456789abcdefABCDEF") == strlen(copy + 1))
+    {
+      attr->type = PERF_TYPE_RAW;
+      attr->config = strtoull(copy + 1, &end, 16);
+      result = 0;
+    }
+  else if (colon != NULL && !isdigit((unsigned char) copy[0]))
+    {
+      *colon = '\0';
+      result = parse_tracepoint(copy, colon + 1, attr);
+      missing = result == -1 && errno == ENOENT;
+    }
+  else if (colon != NULL)
+    {
+      /* type:config */
+      *colon = '\0';
+      if (parse_number(copy, &type) == 0 && type <= UINT32_MAX &&
+          parse_number(colon + 1, &config) == 0)
+        {
+          attr->type = type;
+          attr->config = config;
+          result = 0;
+        }
+    }
+  else
+    result = parse_alias(copy, attr);
+
+  if (result == 0 && mods != NULL)
+    result = apply_modifiers(mods, attr);
+
+  free(mods);
+
+  attr->size = sizeof(*attr);
+  if (result == -1)
+    errno = missing ? ENOENT : EINVAL;
+  return result;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+ * libperf_example.cpp                                                        *
+ *                                                                            *
+ * This is an example program showing how to use libperf within C++ code.     *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <cstdio>               /* for printf family */
+#include <cstdlib>              /* for EXIT_SUCCESS definition */
+#include <system_error>         /* for std::system_error */
+#include <vector>               /* for std::vector */
+#include "libperf.hpp"          /* header-only C++ libperf include */
+
+using namespace libperf;
+
+/* the events are part of the type, a typo does not compile */
+using set = counter_set<event::task_clock, event::page_faults,
+                        event::wall_time>;
+
+int
+main()
+{
+  try
+    {
+      set counters;                                                          /* init lib, one group */
+
+      set::values total{};                                                   /* deltas add up here */
+
+      counters.enable();                                                     /* enable the group */
+
+      for (int i = 0; i < 4; i++)
+        {
+          scoped_measure<set> measure(counters, total);                      /* read now and at scope exit */
+
+          std::vector<char> buffer(1 << 20, static_cast<char>(i));           /* some work to count */
+        }
+
+      counters.disable();                                                    /* disable the group */
+
+      std::printf("task-clock: %llu ns\n",                                   /* printout by event */
+                  (unsigned long long) set::get<event::task_clock>(total));
+      std::printf("page-faults: %llu\n",
+                  (unsigned long long) set::get<event::page_faults>(total));
+      std::printf("wall-time: %llu ns\n",
+                  (unsigned long long) set::get<event::wall_time>(total));
+
+      counters.finalize();                                                   /* log all counter values */
+    }
+  catch (const std::system_error &e)
+    {
+      std::fprintf(stderr, "%s\n", e.what());                                /* failed to open or read */
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;                                                       /* success exit value */
+}
@@ -0,0 +1,542 @@
+/******************************************************************************
+ * libperf_export.c                                                           *
+ *                                                                            *
+ * This is the libperf shared memory export.  A context publishes its counts  *
+ * into a seqlock protected POSIX shared memory segment that any process can  *
+ * map and copy consistent snapshots out of.                                  *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+/* snapshot attempts before a reader gives up on a busy writer */
+#define __LIBPERF_EXPORT_RETRIES 1000
+
+/* writer struct */
+struct libperf_export
+{
+  struct libperf_data *pd;
+  char name[NAME_MAX + 1];              /* with the leading '/' */
+  int fd;
+  struct libperf_export_header *header;
+  size_t size;                          /* mapped bytes */
+  int *events;                          /* counter ids in segment order */
+  struct libperf_count *counts;         /* nr_events, read before publish */
+  int nr_events;
+};
+
+/* reader struct */
+struct libperf_export_reader
+{
+  int fd;
+  const struct libperf_export_header *header;
+  size_t size;                          /* mapped bytes */
+  struct libperf_export_header *copy;
+  size_t copy_size;
+};
+
+static int nr_exports;
+
+static void
+copy_name(char *dest, const char *name)
+{
+  strncpy(dest, name != NULL ? name : "", LIBPERF_EXPORT_NAME_MAX - 1);
+  dest[LIBPERF_EXPORT_NAME_MAX - 1] = '\0';
+}
+
+static size_t
+layout_size(int nr_events, int nr_regions, int nr_metrics)
+{
+  return sizeof(struct libperf_export_header) +
+         nr_events * sizeof(struct libperf_export_event) +
+         nr_regions * (sizeof(struct libperf_export_region) +
+                       nr_events * sizeof(struct libperf_stats)) +
+         nr_metrics * sizeof(struct libperf_export_metric);
+}
+
+static int
+count_regions(struct libperf_data *pd)
+{
+  int nr = 0;
+
+  while (libperf_region_name(pd, nr) != NULL)
+    nr++;
+
+  return nr;
+}
+
+/* lays the segment out for the context's current regions and metrics and
+   names them, called between seq bumps; the segment only ever grows */
+static int
+relayout(struct libperf_export *e, int nr_regions, int nr_metrics)
+{
+  struct libperf_export_header *h = e->header;
+
+  struct libperf_export_region *regions;
+
+  struct libperf_export_metric *metrics;
+
+  size_t size = layout_size(e->nr_events, nr_regions, nr_metrics);
+
+  uint64_t stats;
+
+  void *map;
+
+  int i;
+
+  if (size > e->size)
+    {
+      if (ftruncate(e->fd, size) == -1)
+        return -1;
+
+      map = mremap(h, e->size, size, MREMAP_MAYMOVE);
+      if (map == MAP_FAILED)
+        return -1;
+
+      e->header = h = map;
+      e->size = size;
+    }
+
+  h->size = size;
+  h->nr_regions = nr_regions;
+  h->nr_metrics = nr_metrics;
+  h->regions_offset = h->events_offset +
+                      e->nr_events * sizeof(struct libperf_export_event);
+  h->metrics_offset = h->regions_offset +
+                      nr_regions * sizeof(struct libperf_export_region);
+  stats = h->metrics_offset + nr_metrics * sizeof(struct libperf_export_metric);
+
+  regions = (void *) ((char *) h + h->regions_offset);
+  for (i = 0; i < nr_regions; i++)
+    {
+      copy_name(regions[i].name, libperf_region_name(e->pd, i));
+      regions[i].stats_offset = stats +
+                                i * e->nr_events * sizeof(struct libperf_stats);
+    }
+
+  metrics = (void *) ((char *) h + h->metrics_offset);
+  for (i = 0; i < nr_metrics; i++)
+    copy_name(metrics[i].name, libperf_metricname(e->pd, i));
+
+  return 0;
+}
+
+/* fills in the values, called between seq bumps */
+static void
+fill(struct libperf_export *e)
+{
+  struct libperf_export_header *h = e->header;
+
+  struct libperf_export_event *events;
+
+  struct libperf_export_region *regions;
+
+  struct libperf_export_metric *metrics;
+
+  struct libperf_stats *stats;
+
+  uint64_t values[LIBPERF_NR_COUNTERS];
+
+  uint32_t i;
+
+  int j;
+
+  memset(values, 0, sizeof(values));
+
+  events = (void *) ((char *) h + h->events_offset);
+  for (j = 0; j < e->nr_events; j++)
+    {
+      events[j].count = e->counts[j];
+      if (e->events[j] < LIBPERF_NR_COUNTERS)
+        values[e->events[j]] = e->counts[j].value;
+    }
+
+  regions = (void *) ((char *) h + h->regions_offset);
+  for (i = 0; i < h->nr_regions; i++)
+    {
+      stats = (void *) ((char *) h + regions[i].stats_offset);
+      for (j = 0; j < e->nr_events; j++)
+        if (libperf_region_stats(e->pd, i, e->events[j], &stats[j]) == -1)
+          memset(&stats[j], 0, sizeof(stats[j]));
+    }
+
+  metrics = (void *) ((char *) h + h->metrics_offset);
+  for (i = 0; i < h->nr_metrics; i++)
+    metrics[i].value = libperf_evalmetric(e->pd, i, NULL, values);
+}
+
+struct libperf_export *
+libperf_export_open(struct libperf_data *pd, const char *name)
+{
+  struct libperf_export *e;
+
+  struct libperf_export_header *h;
+
+  struct libperf_export_event *events;
+
+  uint64_t mask = __libperf_openmask(pd);
+
+  int nr_counters = libperf_nrcounters(pd), i, length, saved_errno;
+
+  e = calloc(1, sizeof(*e));
+  if (e == NULL)
+    return NULL;
+
+  e->pd = pd;
+  e->fd = -1;
+
+  if (name != NULL)
+    length = snprintf(e->name, sizeof(e->name), "/%s", name);
+  else
+    length = snprintf(e->name, sizeof(e->name), "/" LIBPERF_EXPORT_PREFIX
+                      "%d.%d", (int) getpid(),
+                      __atomic_fetch_add(&nr_exports, 1, __ATOMIC_RELAXED));
+
+  if (length >= (int) sizeof(e->name) || strchr(e->name + 1, '/') != NULL)
+    {
+      free(e);
+      errno = EINVAL;
+      return NULL;
+    }
+
+  /* the open counters, wall time, then the added events */
+  e->events = malloc((nr_counters + 1) * sizeof(*e->events));
+  e->counts = malloc((nr_counters + 1) * sizeof(*e->counts));
+  if (e->events == NULL || e->counts == NULL)
+    goto fail;
+
+  for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+    if ((mask & LIBPERF_MASK(i)) || i == LIBPERF_LIB_SW_WALL_TIME)
+      e->events[e->nr_events++] = i;
+  for (; i < nr_counters; i++)
+    e->events[e->nr_events++] = i;
+
+  /* a stale default segment of an earlier process with our pid may still
+     be mapped by a reader, unlinking leaves it intact for them; a name
+     the caller chose may belong to a live exporter, so that is EEXIST */
+  if (name == NULL)
+    shm_unlink(e->name);
+  e->fd = shm_open(e->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (e->fd == -1)
+    goto fail;
+
+  e->size = layout_size(e->nr_events, 0, 0);
+  if (ftruncate(e->fd, e->size) == -1)
+    goto fail;
+
+  h = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_SHARED, e->fd, 0);
+  if (h == MAP_FAILED)
+    goto fail;
+  e->header = h;
+
+  /* readers see an odd seq and no magic until the first publish */
+  h->seq = 1;
+  h->version = LIBPERF_EXPORT_VERSION;
+  h->header_size = sizeof(*h);
+  h->pid = getpid();
+  h->tid = __libperf_pid(pd);
+  h->cpu = __libperf_cpu(pd);
+  h->nr_events = e->nr_events;
+  h->start_time = __libperf_realtime();
+  h->events_offset = sizeof(*h);
+
+  events = (void *) ((char *) h + h->events_offset);
+  for (i = 0; i < e->nr_events; i++)
+    copy_name(events[i].name, libperf_countername(pd, e->events[i]));
+
+  if (relayout(e, 0, 0) == -1)
+    goto fail;
+
+  memcpy(e->header->magic, LIBPERF_EXPORT_MAGIC, sizeof(h->magic));
+
+  if (libperf_export_publish(e) == -1)
+    goto fail;
+
+  return e;
+
+fail:
+  saved_errno = errno;
+  libperf_export_close(e);
+  errno = saved_errno;
+  return NULL;
+}
+
+const char *
+libperf_export_name(struct libperf_export *e)
+{
+  return e->name + 1;
+}
+
+int
+libperf_export_publish(struct libperf_export *e)
+{
+  struct libperf_count counts[LIBPERF_NR_COUNTERS];
+
+  struct libperf_export_header *h;
+
+  int nr_regions = count_regions(e->pd), nr_metrics = libperf_nrmetrics(e->pd);
+
+  int i, result = 0;
+
+  uint64_t seq;
+
+  /* read everything first so the odd seq window stays short */
+  if (libperf_readcounts(e->pd, counts) == -1)
+    return -1;
+
+  for (i = 0; i < e->nr_events; i++)
+    if (e->events[i] < LIBPERF_NR_COUNTERS)
+      e->counts[i] = counts[e->events[i]];
+    else if (libperf_readcount(e->pd, e->events[i], &e->counts[i]) == -1)
+      return -1;
+
+  h = e->header;
+  seq = h->seq | 1;
+  __atomic_store_n(&h->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if ((nr_regions != (int) h->nr_regions ||
+       nr_metrics != (int) h->nr_metrics) &&
+      relayout(e, nr_regions, nr_metrics) == -1)
+    result = -1;
+  else
+    {
+      h = e->header;
+      fill(e);
+      h->update_time = __libperf_realtime();
+      h->nr_updates++;
+    }
+
+  __atomic_store_n(&e->header->seq, seq + 1, __ATOMIC_RELEASE);
+  return result;
+}
+
+void
+libperf_export_close(struct libperf_export *e)
+{
+  if (e == NULL)
+    return;
+
+  if (e->header != NULL)
+    munmap(e->header, e->size);
+
+  if (e->fd != -1)
+    {
+      close(e->fd);
+      shm_unlink(e->name);
+    }
+
+  free(e->events);
+  free(e->counts);
+  free(e);
+}
+
+/* maps the whole segment as it is now */
+static int
+remap(struct libperf_export_reader *r)
+{
+  struct stat st;
+
+  void *map;
+
+  if (fstat(r->fd, &st) == -1)
+    return -1;
+
+  if ((size_t) st.st_size < sizeof(struct libperf_export_header))
+    {
+      errno = EPROTO;
+      return -1;
+    }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+
+  if (r->header != NULL)
+    munmap((void *) r->header, r->size);
+
+  r->header = map;
+  r->size = st.st_size;
+  return 0;
+}
+
+struct libperf_export_reader *
+libperf_export_attach(const char *name)
+{
+  struct libperf_export_reader *r;
+
+  char path[NAME_MAX + 1];
+
+  int saved_errno;
+
+  if (snprintf(path, sizeof(path), "/%s", name + (name[0] == '/')) >=
+      (int) sizeof(path))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  r = calloc(1, sizeof(*r));
+  if (r == NULL)
+    return NULL;
+
+  r->fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+  if (r->fd == -1 || remap(r) == -1)
+    goto fail;
+
+  if (memcmp(r->header->magic, LIBPERF_EXPORT_MAGIC,
+             sizeof(r->header->magic)) != 0 ||
+      r->header->version != LIBPERF_EXPORT_VERSION ||
+      r->header->header_size != sizeof(struct libperf_export_header))
+    {
+      errno = EPROTO;
+      goto fail;
+    }
+
+  return r;
+
+fail:
+  saved_errno = errno;
+  libperf_export_detach(r);
+  errno = saved_errno;
+  return NULL;
+}
+
+/* checks that every array of a copied segment lies within it */
+static int
+valid_copy(const struct libperf_export_header *h, size_t size)
+{
+  const struct libperf_export_region *regions;
+
+  uint64_t stats = (uint64_t) h->nr_events * sizeof(struct libperf_stats);
+
+  uint32_t i;
+
+  if (h->events_offset > size || h->regions_offset > size ||
+      h->metrics_offset > size ||
+      h->nr_events > (size - h->events_offset) /
+                     sizeof(struct libperf_export_event) ||
+      h->nr_regions > (size - h->regions_offset) /
+                      sizeof(struct libperf_export_region) ||
+      h->nr_metrics > (size - h->metrics_offset) /
+                      sizeof(struct libperf_export_metric))
+    return 0;
+
+  regions = (const void *) ((const char *) h + h->regions_offset);
+  for (i = 0; i < h->nr_regions; i++)
+    if (regions[i].stats_offset > size ||
+        stats > size - regions[i].stats_offset)
+      return 0;
+
+  return 1;
+}
+
+const struct libperf_export_header *
+libperf_export_snapshot(struct libperf_export_reader *r)
+{
+  struct libperf_export_header *copy;
+
+  uint64_t seq, size;
+
+  int i;
+
+  for (i = 0; i < __LIBPERF_EXPORT_RETRIES; i++)
+    {
+      seq = __atomic_load_n(&r->header->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+        {
+          sched_yield();
+          continue;
+        }
+
+      size = __atomic_load_n(&r->header->size, __ATOMIC_RELAXED);
+      if (size < sizeof(struct libperf_export_header))
+        {
+          errno = EPROTO;
+          return NULL;
+        }
+
+      /* the writer grew the segment */
+      if (size > r->size)
+        {
+          if (remap(r) == -1)
+            return NULL;
+          continue;
+        }
+
+      if (size > r->copy_size)
+        {
+          copy = realloc(r->copy, size);
+          if (copy == NULL)
+            return NULL;
+          r->copy = copy;
+          r->copy_size = size;
+        }
+
+      memcpy(r->copy, r->header, size);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if (__atomic_load_n(&r->header->seq, __ATOMIC_RELAXED) != seq)
+        continue;
+
+      if (r->copy->size != size || !valid_copy(r->copy, size))
+        {
+          errno = EPROTO;
+          return NULL;
+        }
+
+      return r->copy;
+    }
+
+  errno = EAGAIN;
+  return NULL;
+}
+
+void
+libperf_export_detach(struct libperf_export_reader *r)
+{
+  if (r == NULL)
+    return;
+
+  if (r->header != NULL)
+    munmap((void *) r->header, r->size);
+
+  if (r->fd != -1)
+    close(r->fd);
+
+  free(r->copy);
+  free(r);
+}
@@ -0,0 +1,536 @@
+/******************************************************************************
+ * libperf_log.c                                                              *
+ *                                                                            *
+ * This is the libperf binary log implementation: the record encoder used by *
+ * libperf_finalize and a streaming reader used by the decoding tools.        *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_ALIGN8(x) (((x) + 7) & ~(size_t) 7)
+
+/* largest record the reader accepts, guards against corrupt sizes */
+#define __LIBPERF_LOG_MAX_RECORD (1 << 24)
+#define __LIBPERF_LOG_MAX_REGIONS (1 << 20)     /* region ids a reader takes */
+
+/* process-wide log directory, NULL means $LIBPERF_LOGDIR or "." */
+static char *logdir;
+
+int
+libperf_setlogdir(const char *dir)
+{
+  char *copy = NULL;
+
+  if (dir != NULL && (copy = strdup(dir)) == NULL)
+    return -1;
+
+  free(logdir);
+  logdir = copy;
+  return 0;
+}
+
+int
+__libperf_logpath(char *path, size_t size, pid_t pid, const char *suffix)
+{
+  const char *dir = logdir;
+
+  int n;
+
+  if (dir == NULL)
+    dir = getenv("LIBPERF_LOGDIR");
+  if (dir == NULL || *dir == '\0')
+    dir = ".";
+
+  n = snprintf(path, size, "%s/%d%s", dir, (int) pid, suffix);
+  if (n < 0 || (size_t) n >= size)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  return 0;
+}
+
+/* reserves len zeroed bytes at the end of the buffer */
+static void *
+logbuf_reserve(struct __libperf_logbuf *b, size_t len)
+{
+  size_t size;
+
+  char *data;
+
+  if (b->error)
+    return NULL;
+
+  if (b->len + len > b->size)
+    {
+      size = b->size ? b->size : 4096;
+      while (size < b->len + len)
+        size *= 2;
+
+      data = realloc(b->data, size);
+      if (data == NULL)
+        {
+          b->error = 1;
+          return NULL;
+        }
+      b->data = data;
+      b->size = size;
+    }
+
+  data = b->data + b->len;
+  memset(data, 0, len);
+  b->len += len;
+  return data;
+}
+
+void
+__libperf_logbuf_schema(struct __libperf_logbuf *b, int nr_events,
+                        const char *const *names)
+{
+  struct libperf_log_schema *schema;
+
+  size_t names_len = 0, size;
+
+  char *p;
+
+  int i;
+
+  for (i = 0; i < nr_events; i++)
+    names_len += strlen(names[i]) + 1;
+
+  size = __LIBPERF_ALIGN8(sizeof(*schema) + names_len);
+  schema = logbuf_reserve(b, size);
+  if (schema == NULL)
+    return;
+
+  schema->header.type = LIBPERF_LOG_SCHEMA;
+  schema->header.size = size;
+  memcpy(schema->magic, LIBPERF_LOG_MAGIC, sizeof(schema->magic));
+  schema->version = LIBPERF_LOG_VERSION;
+  schema->nr_events = nr_events;
+
+  p = (char *) (schema + 1);
+  for (i = 0; i < nr_events; i++)
+    {
+      strcpy(p, names[i]);
+      p += strlen(names[i]) + 1;
+    }
+}
+
+void
+__libperf_logbuf_region(struct __libperf_logbuf *b, uint32_t region,
+                        const char *name)
+{
+  struct libperf_log_region *r;
+
+  size_t size = __LIBPERF_ALIGN8(sizeof(*r) + strlen(name) + 1);
+
+  r = logbuf_reserve(b, size);
+  if (r == NULL)
+    return;
+
+  r->header.type = LIBPERF_LOG_REGION;
+  r->header.size = size;
+  r->region = region;
+  strcpy((char *) (r + 1), name);
+}
+
+void *
+__libperf_logbuf_record(struct __libperf_logbuf *b, uint32_t type,
+                        uint64_t timestamp, uint32_t tid, uint32_t region,
+                        uint64_t id, size_t payload)
+{
+  struct libperf_log_record *r;
+
+  size_t size = sizeof(*r) + payload;
+
+  r = logbuf_reserve(b, size);
+  if (r == NULL)
+    return NULL;
+
+  r->header.type = type;
+  r->header.size = size;
+  r->timestamp = timestamp;
+  r->tid = tid;
+  r->region = region;
+  r->id = id;
+  return r + 1;
+}
+
+void
+__libperf_logbuf_metric(struct __libperf_logbuf *b, uint64_t timestamp,
+                        uint32_t tid, uint32_t region, uint64_t id,
+                        const char *name, double value)
+{
+  size_t payload = __LIBPERF_ALIGN8(sizeof(value) + strlen(name) + 1);
+
+  double *p = __libperf_logbuf_record(b, LIBPERF_LOG_METRIC, timestamp, tid,
+                                      region, id, payload);
+
+  if (p == NULL)
+    return;
+
+  *p = value;
+  strcpy((char *) (p + 1), name);
+}
+
+void
+__libperf_logbuf_raw(struct __libperf_logbuf *b, const void *data, size_t len)
+{
+  void *p = logbuf_reserve(b, len);
+
+  if (p != NULL)
+    memcpy(p, data, len);
+}
+
+int
+__libperf_logbuf_append(struct __libperf_logbuf *b, const char *path)
+{
+  const char *p = b->data;
+
+  size_t left = b->len;
+
+  ssize_t result;
+
+  int fd;
+
+  if (b->error)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  fd = open(path, O_WRONLY | O_APPEND | O_CREAT,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1)
+    return -1;
+
+  /* one write( ) keeps the batch contiguous next to other writers */
+  while (left > 0)
+    {
+      result = write(fd, p, left);
+      if (result < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          close(fd);
+          return -1;
+        }
+      p += result;
+      left -= result;
+    }
+
+  return close(fd);
+}
+
+void
+__libperf_logbuf_free(struct __libperf_logbuf *b)
+{
+  free(b->data);
+  b->data = NULL;
+  b->len = b->size = 0;
+  b->error = 0;
+}
+
+uint64_t
+__libperf_realtime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* reader struct */
+struct libperf_logreader
+{
+  FILE *file;
+  char *record;                 /* current record */
+  size_t record_size;
+  char *names;                  /* names of the current schema */
+  const char **events;
+  int nr_events;
+  char **regions;               /* region names by id for this schema */
+  uint32_t nr_regions;
+};
+
+struct libperf_logreader *
+libperf_logreader_open(const char *path)
+{
+  struct libperf_logreader *r = calloc(1, sizeof(*r));
+
+  if (r == NULL)
+    return NULL;
+
+  r->file = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+  if (r->file == NULL)
+    {
+      free(r);
+      return NULL;
+    }
+
+  return r;
+}
+
+static void
+reset_schema(struct libperf_logreader *r)
+{
+  uint32_t i;
+
+  for (i = 0; i < r->nr_regions; i++)
+    free(r->regions[i]);
+  free(r->regions);
+  free(r->names);
+  free(r->events);
+
+  r->regions = NULL;
+  r->nr_regions = 0;
+  r->names = NULL;
+  r->events = NULL;
+  r->nr_events = 0;
+}
+
+static int
+read_schema(struct libperf_logreader *r)
+{
+  const struct libperf_log_schema *schema = (void *) r->record;
+
+  size_t len = schema->header.size - sizeof(*schema);
+
+  char *p, *end;
+
+  uint32_t i;
+
+  if (memcmp(schema->magic, LIBPERF_LOG_MAGIC, sizeof(schema->magic)) != 0 ||
+      schema->version != LIBPERF_LOG_VERSION ||
+      schema->nr_events > len)
+    return -1;
+
+  reset_schema(r);
+
+  r->names = malloc(len + 1);
+  r->events = malloc((schema->nr_events + 1) * sizeof(*r->events));
+  if (r->names == NULL || r->events == NULL)
+    return -1;
+
+  memcpy(r->names, schema + 1, len);
+  r->names[len] = '\0';
+
+  p = r->names;
+  end = r->names + len;
+  for (i = 0; i < schema->nr_events; i++)
+    {
+      if (p >= end)
+        return -1;
+      r->events[i] = p;
+      p += strlen(p) + 1;
+    }
+
+  r->nr_events = schema->nr_events;
+  return 0;
+}
+
+static int
+read_region(struct libperf_logreader *r)
+{
+  const struct libperf_log_region *region = (void *) r->record;
+
+  size_t len = region->header.size - sizeof(*region);
+
+  char **regions;
+
+  uint32_t i;
+
+  /* a corrupt id must not wrap around or allocate gigabytes */
+  if (region->region >= __LIBPERF_LOG_MAX_REGIONS)
+    return -1;
+
+  if (region->region >= r->nr_regions)
+    {
+      regions = realloc(r->regions, (region->region + 1) * sizeof(*regions));
+      if (regions == NULL)
+        return -1;
+      for (i = r->nr_regions; i <= region->region; i++)
+        regions[i] = NULL;
+      r->regions = regions;
+      r->nr_regions = region->region + 1;
+    }
+
+  free(r->regions[region->region]);
+  r->regions[region->region] = strndup((const char *) (region + 1), len);
+  return r->regions[region->region] == NULL ? -1 : 0;
+}
+
+int
+libperf_logreader_next(struct libperf_logreader *r,
+                       struct libperf_logentry *entry)
+{
+  struct libperf_log_header header;
+
+  const struct libperf_log_record *record;
+
+  size_t payload, expected;
+
+  char *grown;
+
+  if (fread(&header, sizeof(header), 1, r->file) != 1)
+    return feof(r->file) ? 0 : -1;
+
+  if (header.size < sizeof(header) || header.size > __LIBPERF_LOG_MAX_RECORD)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (header.size > r->record_size)
+    {
+      grown = realloc(r->record, header.size);
+      if (grown == NULL)
+        return -1;
+      r->record = grown;
+      r->record_size = header.size;
+    }
+
+  memcpy(r->record, &header, sizeof(header));
+  if (fread(r->record + sizeof(header), header.size - sizeof(header), 1,
+            r->file) != 1 && header.size > sizeof(header))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  memset(entry, 0, sizeof(*entry));
+  entry->type = header.type;
+
+  switch (header.type)
+    {
+    case LIBPERF_LOG_SCHEMA:
+      if (header.size < sizeof(struct libperf_log_schema) ||
+          read_schema(r) == -1)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      break;
+
+    case LIBPERF_LOG_REGION:
+      if (header.size < sizeof(struct libperf_log_region) ||
+          read_region(r) == -1)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      entry->region = ((struct libperf_log_region *) r->record)->region;
+      break;
+
+    case LIBPERF_LOG_VALUES:
+    case LIBPERF_LOG_TIMES:
+    case LIBPERF_LOG_STATS:
+      if (header.size < sizeof(*record))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      record = (const struct libperf_log_record *) r->record;
+      payload = header.size - sizeof(*record);
+
+      if (header.type == LIBPERF_LOG_VALUES)
+        expected = r->nr_events * sizeof(uint64_t);
+      else if (header.type == LIBPERF_LOG_TIMES)
+        expected = 2 * r->nr_events * sizeof(uint64_t);
+      else
+        expected = r->nr_events * sizeof(struct libperf_stats);
+
+      /* data before any schema, or not matching it, is corrupt */
+      if (payload != expected)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      entry->timestamp = record->timestamp;
+      entry->tid = record->tid;
+      entry->region = record->region;
+      entry->id = record->id;
+
+      if (header.type == LIBPERF_LOG_VALUES)
+        entry->values = (const uint64_t *) (record + 1);
+      else if (header.type == LIBPERF_LOG_TIMES)
+        {
+          entry->time_enabled = (const uint64_t *) (record + 1);
+          entry->time_running = entry->time_enabled + r->nr_events;
+        }
+      else
+        entry->stats = (const struct libperf_stats *) (record + 1);
+      break;
+
+    case LIBPERF_LOG_METRIC:
+      record = (const struct libperf_log_record *) r->record;
+      if (header.size <= sizeof(*record) + sizeof(double) ||
+          r->record[header.size - 1] != '\0')
+        {
+          errno = EINVAL;
+          return -1;
+        }
+
+      entry->timestamp = record->timestamp;
+      entry->tid = record->tid;
+      entry->region = record->region;
+      entry->id = record->id;
+      memcpy(&entry->metric_value, record + 1, sizeof(double));
+      entry->metric = (const char *) (record + 1) + sizeof(double);
+      break;
+
+    default:
+      /* unknown records are skipped by newer readers */
+      break;
+    }
+
+  entry->nr_events = r->nr_events;
+  entry->events = r->events;
+  if (entry->region < r->nr_regions)
+    entry->region_name = r->regions[entry->region];
+
+  return 1;
+}
+
+void
+libperf_logreader_close(struct libperf_logreader *r)
+{
+  reset_schema(r);
+  if (r->file != stdin)
+    fclose(r->file);
+  free(r->record);
+  free(r);
+}
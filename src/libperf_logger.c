@@ -0,0 +1,444 @@
+/******************************************************************************
+ * libperf_logger.c                                                           *
+ *                                                                            *
+ * This is the libperf asynchronous logger.  Instrumented threads push        *
+ * encoded binary log records into their own lock-free single-producer,       *
+ * single-consumer ring, and one background thread drains every ring and      *
+ * batches the records into the process log file.                             *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_LOGGER_RECORDS 1024           /* default ring slots */
+#define __LIBPERF_LOGGER_FLUSH_MS 100           /* default drain interval */
+#define __LIBPERF_CACHELINE 64
+
+/* a per-thread ring of fixed size encoded records */
+struct __libperf_logqueue
+{
+  /* producer side */
+  uint64_t head __attribute__ ((aligned(__LIBPERF_CACHELINE)));
+  uint64_t dropped;
+
+  /* consumer side */
+  uint64_t tail __attribute__ ((aligned(__LIBPERF_CACHELINE)));
+
+  /* fixed at creation */
+  char *slots __attribute__ ((aligned(__LIBPERF_CACHELINE)));
+  uint64_t nr_slots;                    /* power of two */
+  size_t slot_size;
+  pid_t tid;
+  int nr_events;
+  char **events;
+
+  /* protected by logger.lock */
+  char **regions;
+  uint32_t nr_regions;
+  uint32_t emitted_regions;             /* names written since the schema */
+  int closed;
+  struct __libperf_logbuf final;        /* written once the ring is empty */
+  struct __libperf_logqueue *next;
+};
+
+/* the one background logger of the process */
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  pthread_t thread;
+  int running;
+  int stopping;
+  unsigned int nr_slots;
+  unsigned int flush_ms;
+  struct __libperf_logqueue *queues;
+  struct __libperf_logqueue *current;   /* queue whose schema is in effect */
+  uint64_t retired_dropped;             /* drops of queues already freed */
+  struct __libperf_logbuf batch;
+} logger = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+static void
+free_queue(struct __libperf_logqueue *q)
+{
+  int i;
+
+  uint32_t j;
+
+  for (i = 0; i < q->nr_events; i++)
+    free(q->events[i]);
+  for (j = 0; j < q->nr_regions; j++)
+    free(q->regions[j]);
+
+  free(q->events);
+  free(q->regions);
+  free(q->slots);
+  __libperf_logbuf_free(&q->final);
+  free(q);
+}
+
+/* moves whatever q holds into the batch, called with logger.lock held */
+static void
+drain_queue(struct __libperf_logqueue *q)
+{
+  uint64_t head, tail;
+
+  uint32_t i;
+
+  char *record;
+
+  head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+  tail = q->tail;
+
+  if (head == tail && q->emitted_regions == q->nr_regions &&
+      q->final.len == 0)
+    return;
+
+  /* switching rings means switching schemas in the output */
+  if (logger.current != q)
+    {
+      __libperf_logbuf_schema(&logger.batch, q->nr_events,
+                              (const char *const *) q->events);
+      q->emitted_regions = 0;
+      logger.current = q;
+    }
+
+  for (i = q->emitted_regions; i < q->nr_regions; i++)
+    if (q->regions[i] != NULL)
+      __libperf_logbuf_region(&logger.batch, i, q->regions[i]);
+  q->emitted_regions = q->nr_regions;
+
+  for (; tail != head; tail++)
+    {
+      /* slots already hold encoded records */
+      record = q->slots + (tail & (q->nr_slots - 1)) * q->slot_size;
+      __libperf_logbuf_raw(&logger.batch, record, q->slot_size);
+    }
+
+  /* let the producer reuse the slots only after they were copied */
+  __atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+
+  if (q->final.len > 0)
+    {
+      __libperf_logbuf_raw(&logger.batch, q->final.data, q->final.len);
+      __libperf_logbuf_free(&q->final);
+
+      /* the final buffer carries its own schema */
+      logger.current = NULL;
+    }
+}
+
+/* drains every ring and writes the batch, called with logger.lock held */
+static void
+flush_all(void)
+{
+  struct __libperf_logqueue **link = &logger.queues, *q;
+
+  char path[PATH_MAX];
+
+  while ((q = *link) != NULL)
+    {
+      drain_queue(q);
+
+      if (q->closed)
+        {
+          *link = q->next;
+          if (logger.current == q)
+            logger.current = NULL;
+          logger.retired_dropped +=
+            __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+          free_queue(q);
+        }
+      else
+        link = &q->next;
+    }
+
+  if (logger.batch.len == 0)
+    return;
+
+  if (__libperf_logpath(path, sizeof(path), getpid(), ".libperf") == -1 ||
+      __libperf_logbuf_append(&logger.batch, path) == -1)
+    perror("libperf logger");
+
+  /* the next batch may land after other writers, so restate the schema */
+  logger.current = NULL;
+  logger.batch.len = 0;
+  logger.batch.error = 0;
+}
+
+static void *
+logger_main(void *arg)
+{
+  struct timespec deadline;
+
+  (void) arg;
+
+  pthread_mutex_lock(&logger.lock);
+
+  while (!logger.stopping)
+    {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += logger.flush_ms / 1000;
+      deadline.tv_nsec += (logger.flush_ms % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000L;
+        }
+
+      pthread_cond_timedwait(&logger.wakeup, &logger.lock, &deadline);
+      flush_all();
+    }
+
+  flush_all();
+  pthread_mutex_unlock(&logger.lock);
+  return NULL;
+}
+
+int
+libperf_logger_start(unsigned int queue_records, unsigned int flush_ms)
+{
+  int result = 0;
+
+  if (queue_records == 0)
+    queue_records = __LIBPERF_LOGGER_RECORDS;
+  if (flush_ms == 0)
+    flush_ms = __LIBPERF_LOGGER_FLUSH_MS;
+
+  if ((queue_records & (queue_records - 1)) != 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  pthread_mutex_lock(&logger.lock);
+
+  if (!logger.running)
+    {
+      logger.nr_slots = queue_records;
+      logger.flush_ms = flush_ms;
+      logger.stopping = 0;
+
+      result = pthread_create(&logger.thread, NULL, logger_main, NULL);
+      if (result == 0)
+        logger.running = 1;
+      else
+        {
+          errno = result;
+          result = -1;
+        }
+    }
+
+  pthread_mutex_unlock(&logger.lock);
+  return result;
+}
+
+void
+libperf_logger_stop(void)
+{
+  pthread_mutex_lock(&logger.lock);
+
+  if (!logger.running)
+    {
+      pthread_mutex_unlock(&logger.lock);
+      return;
+    }
+
+  logger.stopping = 1;
+  pthread_cond_signal(&logger.wakeup);
+  pthread_mutex_unlock(&logger.lock);
+
+  pthread_join(logger.thread, NULL);
+
+  pthread_mutex_lock(&logger.lock);
+  logger.running = 0;
+  __libperf_logbuf_free(&logger.batch);
+  pthread_mutex_unlock(&logger.lock);
+}
+
+uint64_t
+libperf_logger_dropped(void)
+{
+  struct __libperf_logqueue *q;
+
+  uint64_t dropped;
+
+  pthread_mutex_lock(&logger.lock);
+
+  dropped = logger.retired_dropped;
+  for (q = logger.queues; q != NULL; q = q->next)
+    dropped += __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&logger.lock);
+  return dropped;
+}
+
+struct __libperf_logqueue *
+__libperf_logqueue_create(pid_t tid, int nr_events, const char *const *names)
+{
+  struct __libperf_logqueue *q;
+
+  int i;
+
+  if (libperf_logger_start(0, 0) == -1)
+    return NULL;
+
+  q = aligned_alloc(__LIBPERF_CACHELINE,
+                    (sizeof(*q) + __LIBPERF_CACHELINE - 1) &
+                    ~(size_t) (__LIBPERF_CACHELINE - 1));
+  if (q == NULL)
+    return NULL;
+
+  memset(q, 0, sizeof(*q));
+  q->tid = tid;
+  q->slot_size = sizeof(struct libperf_log_record) +
+                 nr_events * sizeof(uint64_t);
+  q->events = calloc(nr_events, sizeof(*q->events));
+
+  pthread_mutex_lock(&logger.lock);
+  q->nr_slots = logger.nr_slots;
+  pthread_mutex_unlock(&logger.lock);
+
+  q->slots = malloc(q->nr_slots * q->slot_size);
+  if (q->events == NULL || q->slots == NULL)
+    goto fail;
+
+  /* only now, free_queue walks the names up to nr_events */
+  q->nr_events = nr_events;
+  for (i = 0; i < nr_events; i++)
+    if ((q->events[i] = strdup(names[i])) == NULL)
+      goto fail;
+
+  pthread_mutex_lock(&logger.lock);
+  q->next = logger.queues;
+  logger.queues = q;
+  pthread_mutex_unlock(&logger.lock);
+
+  return q;
+
+fail:
+  free_queue(q);
+  errno = ENOMEM;
+  return NULL;
+}
+
+uint64_t *
+__libperf_logqueue_push(struct __libperf_logqueue *q, uint32_t region,
+                        uint64_t id)
+{
+  struct libperf_log_record *r;
+
+  uint64_t head = q->head;
+
+  /* full: drop rather than block the measured thread */
+  if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->nr_slots)
+    {
+      __atomic_store_n(&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+
+  r = (struct libperf_log_record *)
+      (q->slots + (head & (q->nr_slots - 1)) * q->slot_size);
+  r->header.type = LIBPERF_LOG_VALUES;
+  r->header.size = q->slot_size;
+  r->timestamp = __libperf_realtime();
+  r->tid = q->tid;
+  r->region = region;
+  r->id = id;
+  return (uint64_t *) (r + 1);
+}
+
+void
+__libperf_logqueue_commit(struct __libperf_logqueue *q)
+{
+  /* publish the slot only after its contents are written */
+  __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+int
+__libperf_logqueue_region(struct __libperf_logqueue *q, uint32_t region,
+                          const char *name)
+{
+  char **regions;
+
+  uint32_t i;
+
+  int result = 0;
+
+  pthread_mutex_lock(&logger.lock);
+
+  if (region >= q->nr_regions)
+    {
+      regions = realloc(q->regions, (region + 1) * sizeof(*regions));
+      if (regions == NULL)
+        {
+          result = -1;
+          goto out;
+        }
+      for (i = q->nr_regions; i <= region; i++)
+        regions[i] = NULL;
+      q->regions = regions;
+      q->nr_regions = region + 1;
+    }
+
+  free(q->regions[region]);
+  q->regions[region] = strdup(name);
+  if (q->regions[region] == NULL)
+    result = -1;
+
+  /* names already written would otherwise be missed by this one */
+  if (region < q->emitted_regions)
+    q->emitted_regions = region;
+
+out:
+  pthread_mutex_unlock(&logger.lock);
+  return result;
+}
+
+void
+__libperf_logqueue_close(struct __libperf_logqueue *q,
+                         struct __libperf_logbuf *final)
+{
+  pthread_mutex_lock(&logger.lock);
+
+  /* the logger thread frees the ring once it wrote what is left */
+  q->final = *final;
+  memset(final, 0, sizeof(*final));
+  q->closed = 1;
+
+  if (logger.running)
+    pthread_cond_signal(&logger.wakeup);
+  else
+    flush_all();
+
+  pthread_mutex_unlock(&logger.lock);
+}
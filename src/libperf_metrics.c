@@ -0,0 +1,413 @@
+/******************************************************************************
+ * libperf_metrics.c                                                          *
+ *                                                                            *
+ * This is the libperf derived metrics compiler.  It turns a builtin metric   *
+ * such as "ipc" or a user expression such as "bmr=branch-misses/branches"    *
+ * small stack program evaluated over counter deltas.                         *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+#define __LIBPERF_METRIC_STACK 32
+#define __LIBPERF_METRIC_NAME 64
+
+/* builtin metrics, in terms of the perf tool event names */
+static const struct
+{
+  const char *name;
+  const char *expr;
+} builtin_metrics[] = {
+
+  { "ipc",               "instructions / cycles"                         },
+  { "cpi",               "cycles / instructions"                         },
+  { "branch-miss-rate",  "branch-misses / branches"                      },
+  { "cache-miss-ratio",  "cache-misses / cache-references"               },
+  { "l1d-miss-ratio",    "L1-dcache-load-misses / L1-dcache-loads"       },
+  { "llc-miss-ratio",    "LLC-load-misses / LLC-loads"                   },
+  { "dtlb-miss-ratio",   "dTLB-load-misses / dTLB-loads"                 },
+  { "itlb-miss-ratio",   "iTLB-load-misses / iTLB-loads"                 },
+  { "branch-mpki",       "branch-misses * 1000 / instructions"           },
+  { "l1d-mpki",          "L1-dcache-load-misses * 1000 / instructions"   },
+  { "llc-mpki",          "LLC-load-misses * 1000 / instructions"         },
+  { "dtlb-mpki",         "dTLB-load-misses * 1000 / instructions"        },
+  { "ghz",               "cycles / wall-time"                            },
+
+};
+
+enum op
+{
+  OP_CONST,
+  OP_COUNTER,
+  OP_NEG,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV
+};
+
+struct insn
+{
+  enum op op;
+  int counter;
+  double value;
+};
+
+/* compiled metric, a postfix program */
+struct __libperf_metric
+{
+  char *name;
+  uint64_t mask;                /* counters the program reads */
+  struct insn *prog;
+  int len;
+};
+
+/* recursive descent parser state */
+struct parser
+{
+  const char *p;
+  struct __libperf_metric *m;
+  int depth, max_depth;
+  int nesting;                          /* of parse_factor calls */
+  int error;
+};
+
+static void
+emit(struct parser *ps, enum op op, int counter, double value)
+{
+  struct insn *prog;
+
+  if (ps->error)
+    return;
+
+  prog = realloc(ps->m->prog, (ps->m->len + 1) * sizeof(*prog));
+  if (prog == NULL)
+    {
+      ps->error = 1;
+      return;
+    }
+
+  ps->m->prog = prog;
+  prog[ps->m->len].op = op;
+  prog[ps->m->len].counter = counter;
+  prog[ps->m->len].value = value;
+  ps->m->len++;
+
+  /* track how deep evaluation goes so it can use a fixed stack */
+  if (op == OP_CONST || op == OP_COUNTER)
+    ps->depth++;
+  else if (op != OP_NEG)
+    ps->depth--;
+  if (ps->depth > ps->max_depth)
+    ps->max_depth = ps->depth;
+}
+
+static void
+skip_blanks(struct parser *ps)
+{
+  while (isspace((unsigned char) *ps->p))
+    ps->p++;
+}
+
+static int
+name_char(char c)
+{
+  return isalnum((unsigned char) c) || c == '_' || c == '-' || c == '.';
+}
+
+static int
+counter_by_name(const char *name)
+{
+  struct perf_event_attr attr;
+
+  int counter;
+
+  if (strcasecmp(name, "wall-time") == 0)
+    return LIBPERF_LIB_SW_WALL_TIME;
+
+  counter = libperf_eventbyname(name);
+  return __libperf_defaultattr(counter, &attr) == 0 ? counter : -1;
+}
+
+/* event names contain '-', so the longest known name up to a '-' wins and
+   the rest is left for a subtraction: "cycles-bus-cycles" */
+static int
+parse_name(struct parser *ps)
+{
+  char name[__LIBPERF_METRIC_NAME];
+
+  size_t run = 0, len;
+
+  int counter;
+
+  while (name_char(ps->p[run]))
+    run++;
+
+  for (len = run; len > 0; len--)
+    {
+      if (len != run && ps->p[len] != '-')
+        continue;
+      if (len >= sizeof(name))
+        continue;
+
+      memcpy(name, ps->p, len);
+      name[len] = '\0';
+
+      counter = counter_by_name(name);
+      if (counter >= 0)
+        {
+          ps->p += len;
+          ps->m->mask |= LIBPERF_MASK(counter);
+          emit(ps, OP_COUNTER, counter, 0.0);
+          return 0;
+        }
+    }
+
+  return -1;
+}
+
+static void parse_expr(struct parser *ps);
+
+static void
+parse_factor(struct parser *ps)
+{
+  char *end;
+
+  double value;
+
+  /* deeper nesting could never be evaluated, stop before the C stack
+     runs out on a hostile "((((..." or "----..." */
+  if (ps->error || ++ps->nesting > __LIBPERF_METRIC_STACK)
+    {
+      ps->error = 1;
+      return;
+    }
+
+  skip_blanks(ps);
+
+  if (*ps->p == '(')
+    {
+      ps->p++;
+      parse_expr(ps);
+      skip_blanks(ps);
+      if (*ps->p != ')')
+        ps->error = 1;
+      else
+        ps->p++;
+    }
+  else if (*ps->p == '-')
+    {
+      ps->p++;
+      parse_factor(ps);
+      emit(ps, OP_NEG, 0, 0.0);
+    }
+  else if (isdigit((unsigned char) *ps->p) || *ps->p == '.')
+    {
+      value = strtod(ps->p, &end);
+      if (end == ps->p)
+        ps->error = 1;
+      ps->p = end;
+      emit(ps, OP_CONST, 0, value);
+    }
+  else if (parse_name(ps) == -1)
+    ps->error = 1;
+
+  ps->nesting--;
+}
+
+static void
+parse_term(struct parser *ps)
+{
+  char op;
+
+  parse_factor(ps);
+  for (;;)
+    {
+      skip_blanks(ps);
+      op = *ps->p;
+      if (ps->error || (op != '*' && op != '/'))
+        return;
+
+      ps->p++;
+      parse_factor(ps);
+      emit(ps, op == '*' ? OP_MUL : OP_DIV, 0, 0.0);
+    }
+}
+
+static void
+parse_expr(struct parser *ps)
+{
+  char op;
+
+  parse_term(ps);
+  for (;;)
+    {
+      skip_blanks(ps);
+      op = *ps->p;
+      if (ps->error || (op != '+' && op != '-'))
+        return;
+
+      ps->p++;
+      parse_term(ps);
+      emit(ps, op == '+' ? OP_ADD : OP_SUB, 0, 0.0);
+    }
+}
+
+void
+__libperf_metric_free(struct __libperf_metric *m)
+{
+  if (m == NULL)
+    return;
+
+  free(m->name);
+  free(m->prog);
+  free(m);
+}
+
+struct __libperf_metric *
+__libperf_metric_compile(const char *metric)
+{
+  struct __libperf_metric *m = calloc(1, sizeof(*m));
+
+  struct parser ps = { NULL, m, 0, 0, 0, 0 };
+
+  const char *expr = NULL, *eq;
+
+  int i;
+
+  if (m == NULL)
+    return NULL;
+
+  for (i = 0; i < __LIBPERF_ARRAY_SIZE(builtin_metrics); i++)
+    if (strcasecmp(metric, builtin_metrics[i].name) == 0)
+      {
+        m->name = strdup(builtin_metrics[i].name);
+        expr = builtin_metrics[i].expr;
+      }
+
+  /* name=expression */
+  eq = strchr(metric, '=');
+  if (expr == NULL && eq != NULL && eq != metric)
+    {
+      m->name = strndup(metric, eq - metric);
+      expr = eq + 1;
+    }
+
+  if (expr == NULL || m->name == NULL)
+    goto fail;
+
+  ps.p = expr;
+  parse_expr(&ps);
+  skip_blanks(&ps);
+
+  if (ps.error || *ps.p != '\0' || ps.max_depth > __LIBPERF_METRIC_STACK)
+    goto fail;
+
+  return m;
+
+fail:
+  __libperf_metric_free(m);
+  errno = EINVAL;
+  return NULL;
+}
+
+const char *
+__libperf_metric_name(const struct __libperf_metric *m)
+{
+  return m->name;
+}
+
+uint64_t
+__libperf_metric_mask(const struct __libperf_metric *m)
+{
+  return m->mask;
+}
+
+double
+__libperf_metric_eval(const struct __libperf_metric *m, const double *deltas)
+{
+  double stack[__LIBPERF_METRIC_STACK];
+
+  int i, sp = 0;
+
+  for (i = 0; i < m->len; i++)
+    switch (m->prog[i].op)
+      {
+      case OP_CONST:
+        stack[sp++] = m->prog[i].value;
+        break;
+      case OP_COUNTER:
+        stack[sp++] = deltas[m->prog[i].counter];
+        break;
+      case OP_NEG:
+        stack[sp - 1] = -stack[sp - 1];
+        break;
+      case OP_ADD:
+        sp--;
+        stack[sp - 1] += stack[sp];
+        break;
+      case OP_SUB:
+        sp--;
+        stack[sp - 1] -= stack[sp];
+        break;
+      case OP_MUL:
+        sp--;
+        stack[sp - 1] *= stack[sp];
+        break;
+      case OP_DIV:
+        /* a ratio over nothing is undefined, not infinite */
+        sp--;
+        stack[sp - 1] = stack[sp] == 0.0 ? NAN : stack[sp - 1] / stack[sp];
+        break;
+      }
+
+  return stack[0];
+}
+
+int
+libperf_metricmask(const char *metric, uint64_t *mask)
+{
+  struct __libperf_metric *m = __libperf_metric_compile(metric);
+
+  if (m == NULL)
+    return -1;
+
+  *mask = m->mask;
+  __libperf_metric_free(m);
+  return 0;
+}
+
+const char *
+libperf_builtinmetric(int index)
+{
+  if (index < 0 || index >= __LIBPERF_ARRAY_SIZE(builtin_metrics))
+    return NULL;
+
+  return builtin_metrics[index].name;
+}
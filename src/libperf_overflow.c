@@ -0,0 +1,324 @@
+/******************************************************************************
+ * libperf_overflow.c                                                         *
+ *                                                                            *
+ * This is the libperf overflow notification.  A sampling copy of a counter   *
+ * raises a realtime signal every period events and the signal handler runs   *
+ * the callback registered for the counter's fd.                              *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_MAX_OVERFLOWS 256            /* armed at once */
+#define __LIBPERF_OVERFLOW_SIGNAL (SIGRTMIN + 3)
+#define __LIBPERF_FENCE_WAIT_MS 1000           /* before giving up on one */
+
+/* overflow struct */
+struct libperf_overflow
+{
+  int fd;
+  int slot;
+  struct libperf_data *pd;
+  int counter;
+  libperf_overflow_fn fn;
+  void *arg;
+  uint64_t count;
+  struct f_owner_ex owner;              /* where its signals are queued */
+  int cancelled;                        /* signals still queued are dropped */
+  int fenced;                           /* all of them were delivered */
+};
+
+/* the handler finds a notification by the si_fd of its signal; slots are
+   published and cleared atomically so it never takes a lock */
+static struct libperf_overflow *overflows[__LIBPERF_MAX_OVERFLOWS];
+
+/* handlers that may still be looking at each slot */
+static int inflight[__LIBPERF_MAX_OVERFLOWS];
+
+static pthread_mutex_t overflows_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+static int handler_error;
+
+static void
+overflow_handler(int sig, siginfo_t *info, void *context)
+{
+  struct libperf_overflow *o;
+
+  int saved_errno = errno, fence, found = 0, i;
+
+  (void) sig;
+  (void) context;
+
+  /* libperf_overflow_cancel queues a fence behind the fd's signals */
+  fence = info->si_code == SI_QUEUE && info->si_pid == getpid();
+
+  for (i = 0; i < __LIBPERF_MAX_OVERFLOWS && !found; i++)
+    {
+      /* counted before the slot is looked at, so a cancel that cleared
+         the slot and then sees no handler here cannot free o under us */
+      __atomic_add_fetch(&inflight[i], 1, __ATOMIC_SEQ_CST);
+
+      o = __atomic_load_n(&overflows[i], __ATOMIC_SEQ_CST);
+      if (o == NULL)
+        ;
+      else if (fence)
+        {
+          if (o == info->si_value.sival_ptr)
+            {
+              __atomic_store_n(&o->fenced, 1, __ATOMIC_SEQ_CST);
+              found = 1;
+            }
+        }
+      else if (info->si_code > 0 && o->fd == info->si_fd)
+        {
+          if (!__atomic_load_n(&o->cancelled, __ATOMIC_SEQ_CST))
+            {
+              __atomic_add_fetch(&o->count, 1, __ATOMIC_RELAXED);
+              if (o->fn(o->pd, o->counter, o->arg) != 0)
+                ioctl(o->fd, PERF_EVENT_IOC_DISABLE);
+            }
+          found = 1;
+        }
+
+      __atomic_sub_fetch(&inflight[i], 1, __ATOMIC_SEQ_CST);
+    }
+
+  errno = saved_errno;
+}
+
+static void
+install_handler(void)
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = overflow_handler;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  if (sigaction(__LIBPERF_OVERFLOW_SIGNAL, &sa, NULL) == -1)
+    handler_error = errno;
+}
+
+/* routes the fd's signals to the counted thread if it is one of ours */
+static int
+set_owner(struct libperf_overflow *o, pid_t pid)
+{
+  if (pid == 0)
+    pid = sys_gettid();
+
+  if (pid > 0 && syscall(SYS_tgkill, getpid(), pid, 0) == 0)
+    {
+      o->owner.type = F_OWNER_TID;
+      o->owner.pid = pid;
+    }
+  else
+    {
+      o->owner.type = F_OWNER_PID;
+      o->owner.pid = getpid();
+    }
+
+  if (fcntl(o->fd, F_SETOWN_EX, &o->owner) == -1 ||
+      fcntl(o->fd, F_SETSIG, __LIBPERF_OVERFLOW_SIGNAL) == -1 ||
+      fcntl(o->fd, F_SETFL, fcntl(o->fd, F_GETFL) | O_ASYNC) == -1)
+    return -1;
+
+  return 0;
+}
+
+/* queues a signal for o behind every signal its fd queued so far;
+   realtime signals of one number are delivered in order */
+static int
+send_fence(struct libperf_overflow *o)
+{
+  siginfo_t info;
+
+  memset(&info, 0, sizeof(info));
+  info.si_signo = __LIBPERF_OVERFLOW_SIGNAL;
+  info.si_code = SI_QUEUE;
+  info.si_pid = getpid();
+  info.si_uid = getuid();
+  info.si_value.sival_ptr = o;
+
+  if (o->owner.type == F_OWNER_TID)
+    return syscall(SYS_rt_tgsigqueueinfo, getpid(), o->owner.pid,
+                   __LIBPERF_OVERFLOW_SIGNAL, &info);
+
+  return syscall(SYS_rt_sigqueueinfo, getpid(), __LIBPERF_OVERFLOW_SIGNAL,
+                 &info);
+}
+
+/* waits until the fence was handled, or the owning thread and with it its
+   pending signals are gone */
+static int
+wait_fence(struct libperf_overflow *o)
+{
+  int ms;
+
+  for (ms = 0; ms < __LIBPERF_FENCE_WAIT_MS; ms++)
+    {
+      if (__atomic_load_n(&o->fenced, __ATOMIC_SEQ_CST))
+        return 0;
+
+      if (o->owner.type == F_OWNER_TID &&
+          syscall(SYS_tgkill, getpid(), o->owner.pid, 0) == -1 &&
+          errno == ESRCH)
+        return 0;
+
+      usleep(1000);
+    }
+
+  return -1;
+}
+
+struct libperf_overflow *
+libperf_on_overflow(struct libperf_data *pd, int counter, uint64_t period,
+                    libperf_overflow_fn fn, void *arg)
+{
+  struct libperf_overflow *o;
+
+  int i, saved_errno;
+
+  if (fn == NULL)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  pthread_once(&handler_once, install_handler);
+  if (handler_error != 0)
+    {
+      errno = handler_error;
+      return NULL;
+    }
+
+  o = calloc(1, sizeof(*o));
+  if (o == NULL)
+    return NULL;
+
+  o->pd = pd;
+  o->counter = counter;
+  o->fn = fn;
+  o->arg = arg;
+  o->slot = -1;
+
+  /* the copy starts counting at once, but nothing is delivered before the
+     slot is published below */
+  o->fd = __libperf_openoverflow(pd, counter, period);
+  if (o->fd == -1)
+    {
+      saved_errno = errno;
+      free(o);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  pthread_mutex_lock(&overflows_lock);
+  for (i = 0; i < __LIBPERF_MAX_OVERFLOWS; i++)
+    if (overflows[i] == NULL)
+      {
+        o->slot = i;
+        __atomic_store_n(&overflows[i], o, __ATOMIC_SEQ_CST);
+        break;
+      }
+  pthread_mutex_unlock(&overflows_lock);
+
+  if (o->slot == -1)
+    {
+      close(o->fd);
+      free(o);
+      errno = ENOSPC;
+      return NULL;
+    }
+
+  if (set_owner(o, __libperf_pid(pd)) == -1)
+    {
+      saved_errno = errno;
+      libperf_overflow_cancel(o);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  return o;
+}
+
+uint64_t
+libperf_overflow_count(struct libperf_overflow *o)
+{
+  return __atomic_load_n(&o->count, __ATOMIC_RELAXED);
+}
+
+void
+libperf_overflow_cancel(struct libperf_overflow *o)
+{
+  int saved_errno, slot;
+
+  if (o == NULL)
+    return;
+
+  saved_errno = errno;
+  slot = o->slot;
+
+  ioctl(o->fd, PERF_EVENT_IOC_DISABLE);
+
+  /* no new signals once O_ASYNC is off; the ones already queued still
+     carry the fd number, which must not be reused before they are all
+     handled, or a later notification on the same fd would get them */
+  __atomic_store_n(&o->cancelled, 1, __ATOMIC_SEQ_CST);
+  fcntl(o->fd, F_SETFL, fcntl(o->fd, F_GETFL) & ~O_ASYNC);
+
+  /* a fence that cannot be sent or never arrives, say because fn called
+     us, leaves the slot and the fd behind rather than hang */
+  if (send_fence(o) == -1 || wait_fence(o) == -1)
+    {
+      errno = saved_errno;
+      return;
+    }
+
+  /* a handler that found o before the slot was cleared may still use it,
+     one that starts afterwards cannot find it; the lock keeps the slot
+     from being reused meanwhile */
+  pthread_mutex_lock(&overflows_lock);
+  __atomic_store_n(&overflows[slot], NULL, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&inflight[slot], __ATOMIC_SEQ_CST) != 0)
+    sched_yield();
+  pthread_mutex_unlock(&overflows_lock);
+
+  close(o->fd);
+  free(o);
+  errno = saved_errno;
+}
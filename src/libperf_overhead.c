@@ -0,0 +1,674 @@
+/******************************************************************************
+ * libperf_overhead.c                                                         *
+ *                                                                            *
+ * This is a benchmark suite measuring what libperf itself costs: ns and TSC  *
+ * ticks per call of its hot paths, over counter set sizes and thread         *
+ * counts, with tail percentiles and optional CSV or JSON output.             *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libperf.h"
+
+#define ITERATIONS 100000
+#define SLOW_DIVISOR 100        /* init and finalize run this many times less */
+#define MIN_SLOW_ITERATIONS 100
+
+/* TSC ticks run at a fixed reference rate, not the core clock, and are
+   only reported where there is a TSC */
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+enum op
+{
+  OP_INIT,
+  OP_READ,
+  OP_READ_MMAP,
+  OP_READALL,
+  OP_ENABLE,
+  OP_DISABLE,
+  OP_FINALIZE,
+  NR_OPS
+};
+
+static const char *op_names[NR_OPS] = {
+  "init", "read", "read-mmap", "readall", "enable", "disable", "finalize"
+};
+
+enum format
+{
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+/* one timed call */
+struct sample
+{
+  uint64_t ns;
+  uint64_t ticks;               /* TSC */
+};
+
+/* one thread's share of a run */
+struct job
+{
+  enum op op;
+  uint64_t mask;
+  int counter;                  /* first counter of mask */
+  long iterations;
+  struct sample *samples;
+  pthread_barrier_t *barrier;
+  int error;
+};
+
+/* summary of one run */
+struct result
+{
+  double ns_mean, ticks_mean;
+  uint64_t ns_p50, ns_p90, ns_p99, ns_p999, ns_max;
+  uint64_t ticks_p50, ticks_p99;
+};
+
+static uint64_t overhead_ns, overhead_ticks;
+
+static inline unsigned long long
+rdclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* time stamp counter, 0 where there is none */
+static inline uint64_t
+rdtsc(void)
+{
+#if HAVE_TSC
+  uint32_t low, high;
+
+  __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+  return low | ((uint64_t) high << 32);
+#else
+  return 0;
+#endif
+}
+
+static inline void
+stamp(struct sample *s)
+{
+  s->ns = rdclock();
+  s->ticks = rdtsc();
+}
+
+/* stores end - start minus the cost of taking the stamps themselves */
+static inline void
+record(struct sample *out, const struct sample *start,
+       const struct sample *end)
+{
+  uint64_t ns = end->ns - start->ns, ticks = end->ticks - start->ticks;
+
+  out->ns = ns > overhead_ns ? ns - overhead_ns : 0;
+  out->ticks = ticks > overhead_ticks ? ticks - overhead_ticks : 0;
+}
+
+/* the cheapest back to back stamps are the timing floor */
+static void
+calibrate(void)
+{
+  struct sample start, end;
+
+  int i;
+
+  overhead_ns = overhead_ticks = UINT64_MAX;
+
+  for (i = 0; i < 10000; i++)
+    {
+      stamp(&start);
+      stamp(&end);
+      if (end.ns - start.ns < overhead_ns)
+        overhead_ns = end.ns - start.ns;
+      if (end.ticks - start.ticks < overhead_ticks)
+        overhead_ticks = end.ticks - start.ticks;
+    }
+}
+
+static void *
+run_job(void *arg)
+{
+  struct job *job = arg;
+
+  struct libperf_data *pd = NULL;
+
+  struct sample start = { 0, 0 }, end = { 0, 0 };
+
+  uint64_t values[LIBPERF_NR_COUNTERS];
+
+  volatile uint64_t sink = 0;
+
+  int flags = job->op == OP_READ_MMAP ? LIBPERF_FLAG_MMAP : 0;
+
+  long i;
+
+  if (job->op != OP_INIT && job->op != OP_FINALIZE)
+    {
+      pd = libperf_initialize_mask(-1, -1, job->mask, flags);
+      if (pd == NULL)
+        job->error = 1;
+      else
+        libperf_enableall(pd);
+    }
+
+  pthread_barrier_wait(job->barrier);
+  if (job->error)
+    return NULL;
+
+  for (i = 0; i < job->iterations; i++)
+    {
+      switch (job->op)
+        {
+        case OP_INIT:
+          stamp(&start);
+          pd = libperf_initialize_mask(-1, -1, job->mask, 0);
+          stamp(&end);
+          if (pd == NULL)
+            {
+              job->error = 1;
+              return NULL;
+            }
+          libperf_close(pd);
+          break;
+
+        case OP_FINALIZE:
+          pd = libperf_initialize_mask(-1, -1, job->mask, 0);
+          if (pd == NULL)
+            {
+              job->error = 1;
+              return NULL;
+            }
+          stamp(&start);
+          libperf_finalize(pd, NULL);
+          stamp(&end);
+          break;
+
+        case OP_READ:
+        case OP_READ_MMAP:
+          stamp(&start);
+          sink += libperf_readcounter(pd, job->counter);
+          stamp(&end);
+          break;
+
+        case OP_READALL:
+          stamp(&start);
+          libperf_readall(pd, values);
+          stamp(&end);
+          sink += values[job->counter];
+          break;
+
+        case OP_ENABLE:
+          libperf_disablecounter(pd, job->counter);
+          stamp(&start);
+          libperf_enablecounter(pd, job->counter);
+          stamp(&end);
+          break;
+
+        case OP_DISABLE:
+          libperf_enablecounter(pd, job->counter);
+          stamp(&start);
+          libperf_disablecounter(pd, job->counter);
+          stamp(&end);
+          break;
+
+        default:
+          break;
+        }
+
+      record(&job->samples[i], &start, &end);
+    }
+
+  if (job->op != OP_INIT && job->op != OP_FINALIZE)
+    libperf_close(pd);
+
+  (void) sink;
+  return NULL;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* nearest rank percentile of sorted values */
+static uint64_t
+percentile(const uint64_t *sorted, long n, double p)
+{
+  long rank = (long) (p / 100.0 * n + 0.5);
+
+  if (rank < 1)
+    rank = 1;
+  if (rank > n)
+    rank = n;
+
+  return sorted[rank - 1];
+}
+
+static void
+summarize(const struct sample *samples, long n, struct result *result)
+{
+  uint64_t *ns = malloc(n * sizeof(*ns)), *ticks = malloc(n * sizeof(*ticks));
+
+  double ns_sum = 0, ticks_sum = 0;
+
+  long i;
+
+  memset(result, 0, sizeof(*result));
+  if (ns == NULL || ticks == NULL)
+    goto out;
+
+  for (i = 0; i < n; i++)
+    {
+      ns[i] = samples[i].ns;
+      ticks[i] = samples[i].ticks;
+      ns_sum += ns[i];
+      ticks_sum += ticks[i];
+    }
+
+  qsort(ns, n, sizeof(*ns), compare_u64);
+  qsort(ticks, n, sizeof(*ticks), compare_u64);
+
+  result->ns_mean = ns_sum / n;
+  result->ticks_mean = ticks_sum / n;
+  result->ns_p50 = percentile(ns, n, 50);
+  result->ns_p90 = percentile(ns, n, 90);
+  result->ns_p99 = percentile(ns, n, 99);
+  result->ns_p999 = percentile(ns, n, 99.9);
+  result->ns_max = ns[n - 1];
+  result->ticks_p50 = percentile(ticks, n, 50);
+  result->ticks_p99 = percentile(ticks, n, 99);
+
+out:
+  free(ns);
+  free(ticks);
+}
+
+/* runs op on nr_threads threads at once and pools their samples */
+static int
+run(enum op op, uint64_t mask, int nr_threads, long iterations,
+    struct result *result)
+{
+  struct job *jobs = calloc(nr_threads, sizeof(*jobs));
+
+  pthread_t *threads = calloc(nr_threads, sizeof(*threads));
+
+  struct sample *samples = calloc(nr_threads * iterations, sizeof(*samples));
+
+  pthread_barrier_t barrier;
+
+  int i, status = -1;
+
+  if (jobs == NULL || threads == NULL || samples == NULL)
+    goto out;
+
+  pthread_barrier_init(&barrier, NULL, nr_threads);
+
+  for (i = 0; i < nr_threads; i++)
+    {
+      jobs[i].op = op;
+      jobs[i].mask = mask;
+      jobs[i].counter = __builtin_ctzll(mask);
+      jobs[i].iterations = iterations;
+      jobs[i].samples = samples + i * iterations;
+      jobs[i].barrier = &barrier;
+      pthread_create(&threads[i], NULL, run_job, &jobs[i]);
+    }
+
+  status = 0;
+  for (i = 0; i < nr_threads; i++)
+    {
+      pthread_join(threads[i], NULL);
+      if (jobs[i].error)
+        status = -1;
+    }
+
+  pthread_barrier_destroy(&barrier);
+
+  if (status == 0)
+    summarize(samples, nr_threads * iterations, result);
+
+out:
+  free(jobs);
+  free(threads);
+  free(samples);
+  return status;
+}
+
+/* the first n supported counters, 0 if there are fewer */
+static uint64_t
+first_counters(uint64_t supported, int n)
+{
+  uint64_t mask = 0;
+
+  int i;
+
+  for (i = 0; i < 64 && n > 0; i++)
+    if (supported & (1ULL << i))
+      {
+        mask |= 1ULL << i;
+        n--;
+      }
+
+  return n > 0 ? 0 : mask;
+}
+
+/* parses "1,2,4" into values, "all" becomes all_value */
+static int
+parse_list(const char *list, int *values, int max, int all_value)
+{
+  char *copy = strdup(list), *token, *save = NULL;
+
+  int n = 0;
+
+  if (copy == NULL)
+    return -1;
+
+  for (token = strtok_r(copy, ",", &save); token != NULL && n < max;
+       token = strtok_r(NULL, ",", &save))
+    {
+      values[n] = strcmp(token, "all") == 0 ? all_value : atoi(token);
+      if (values[n] > 0)
+        n++;
+    }
+
+  free(copy);
+  return n;
+}
+
+static int
+parse_ops(const char *list, int *ops)
+{
+  char *copy = strdup(list), *token, *save = NULL;
+
+  int i;
+
+  if (copy == NULL)
+    return -1;
+
+  memset(ops, 0, NR_OPS * sizeof(*ops));
+
+  for (token = strtok_r(copy, ",", &save); token != NULL;
+       token = strtok_r(NULL, ",", &save))
+    {
+      for (i = 0; i < NR_OPS; i++)
+        if (strcmp(token, op_names[i]) == 0)
+          break;
+
+      if (i == NR_OPS)
+        {
+          free(copy);
+          return -1;
+        }
+      ops[i] = 1;
+    }
+
+  free(copy);
+  return 0;
+}
+
+static void
+print_result(enum format format, enum op op, int counters, int threads,
+             long iterations, const struct result *r, int *first)
+{
+  switch (format)
+    {
+    case FORMAT_TEXT:
+      fprintf(stdout, "%-10s %4d %4d %9.1f %8" PRIu64 " %8" PRIu64 " %8"
+              PRIu64 " %8" PRIu64 " %9" PRIu64, op_names[op], counters,
+              threads, r->ns_mean, r->ns_p50, r->ns_p90, r->ns_p99,
+              r->ns_p999, r->ns_max);
+      if (HAVE_TSC)
+        fprintf(stdout, " %10.1f", r->ticks_mean);
+      fputc('\n', stdout);
+      break;
+
+    case FORMAT_CSV:
+      fprintf(stdout, "%s,%d,%d,%ld,%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+              ",%" PRIu64 ",%" PRIu64, op_names[op], counters, threads,
+              iterations, r->ns_mean, r->ns_p50, r->ns_p90, r->ns_p99,
+              r->ns_p999, r->ns_max);
+      if (HAVE_TSC)
+        fprintf(stdout, ",%.1f,%" PRIu64 ",%" PRIu64, r->ticks_mean,
+                r->ticks_p50, r->ticks_p99);
+      fputc('\n', stdout);
+      break;
+
+    case FORMAT_JSON:
+      fprintf(stdout, "%s\n  {\"op\":\"%s\",\"counters\":%d,\"threads\":%d,"
+              "\"iterations\":%ld,\"ns\":{\"mean\":%.1f,\"p50\":%" PRIu64
+              ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64
+              ",\"max\":%" PRIu64 "}", *first ? "[" : ",", op_names[op],
+              counters, threads, iterations, r->ns_mean, r->ns_p50, r->ns_p90,
+              r->ns_p99, r->ns_p999, r->ns_max);
+      if (HAVE_TSC)
+        fprintf(stdout, ",\"tsc_ticks\":{\"mean\":%.1f,\"p50\":%" PRIu64
+                ",\"p99\":%" PRIu64 "}", r->ticks_mean, r->ticks_p50,
+                r->ticks_p99);
+      fputc('}', stdout);
+      break;
+    }
+
+  *first = 0;
+}
+
+/* finalize writes a log per call, keep them out of the working directory */
+static char *
+make_logdir(void)
+{
+  static char dir[] = "/tmp/libperf-overhead.XXXXXX";
+
+  if (mkdtemp(dir) == NULL || libperf_setlogdir(dir) == -1)
+    return NULL;
+
+  return dir;
+}
+
+static void
+remove_logdir(const char *dir)
+{
+  char path[512];
+
+  struct dirent *entry;
+
+  DIR *d = opendir(dir);
+
+  if (d != NULL)
+    {
+      while ((entry = readdir(d)) != NULL)
+        if (entry->d_name[0] != '.')
+          {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+          }
+      closedir(d);
+    }
+
+  rmdir(dir);
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-n iterations] [-o op,...] [-s size,...|all] "
+          "[-t threads,...] [-f text|csv|json]\n"
+          "ops: init read read-mmap readall enable disable finalize\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const struct libperf_capabilities *caps = libperf_capabilities();
+
+  int ops[NR_OPS], sizes[16], threads[16], nr_sizes, nr_threads;
+
+  int opt, op, s, t, first = 1, status = EXIT_SUCCESS;
+
+  int nr_supported = __builtin_popcountll(caps->supported);
+
+  long iterations = ITERATIONS, n;
+
+  enum format format = FORMAT_TEXT;
+
+  const char *size_list = "1,4,all", *thread_list = "1,2,4";
+
+  struct result result;
+
+  uint64_t mask;
+
+  char *logdir;
+
+  for (op = 0; op < NR_OPS; op++)
+    ops[op] = 1;
+
+  while ((opt = getopt(argc, argv, "n:o:s:t:f:h")) != -1)
+    {
+      switch (opt)
+        {
+        case 'n':
+          iterations = atol(optarg);
+          break;
+        case 'o':
+          if (parse_ops(optarg, ops) == -1)
+            {
+              usage(argv[0]);
+              return EXIT_FAILURE;
+            }
+          break;
+        case 's':
+          size_list = optarg;
+          break;
+        case 't':
+          thread_list = optarg;
+          break;
+        case 'f':
+          if (strcmp(optarg, "text") == 0)
+            format = FORMAT_TEXT;
+          else if (strcmp(optarg, "csv") == 0)
+            format = FORMAT_CSV;
+          else if (strcmp(optarg, "json") == 0)
+            format = FORMAT_JSON;
+          else
+            {
+              usage(argv[0]);
+              return EXIT_FAILURE;
+            }
+          break;
+        default:
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  nr_sizes = parse_list(size_list, sizes, 16, nr_supported);
+  nr_threads = parse_list(thread_list, threads, 16, 1);
+  if (iterations <= 0 || nr_sizes <= 0 || nr_threads <= 0 ||
+      nr_supported == 0)
+    {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  logdir = make_logdir();
+  if (logdir == NULL)
+    {
+      perror("libperf-overhead");
+      return EXIT_FAILURE;
+    }
+
+  calibrate();
+
+  if (format == FORMAT_TEXT)
+    {
+      fprintf(stdout, "%d counters supported, timer overhead %" PRIu64
+              " ns subtracted\n%-10s %4s %4s %9s %8s %8s %8s %8s %9s",
+              nr_supported, overhead_ns, "op", "ctrs", "thrd", "ns/op", "p50",
+              "p90", "p99", "p99.9", "max");
+      if (HAVE_TSC)
+        fprintf(stdout, " %10s", "tsc/op");
+      fputc('\n', stdout);
+    }
+  else if (format == FORMAT_CSV)
+    fprintf(stdout, "op,counters,threads,iterations,ns_mean,ns_p50,ns_p90,"
+            "ns_p99,ns_p999,ns_max%s\n",
+            HAVE_TSC ? ",tsc_mean,tsc_p50,tsc_p99" : "");
+
+  for (op = 0; op < NR_OPS; op++)
+    {
+      if (!ops[op])
+        continue;
+
+      n = iterations;
+      if (op == OP_INIT || op == OP_FINALIZE)
+        {
+          n /= SLOW_DIVISOR;
+          if (n < MIN_SLOW_ITERATIONS)
+            n = MIN_SLOW_ITERATIONS;
+        }
+
+      for (s = 0; s < nr_sizes; s++)
+        {
+          mask = first_counters(caps->supported, sizes[s]);
+          if (mask == 0)
+            continue;
+
+          for (t = 0; t < nr_threads; t++)
+            {
+              if (run(op, mask, threads[t], n, &result) == -1)
+                {
+                  fprintf(stderr, "%s: %d counters, %d threads failed\n",
+                          op_names[op], sizes[s], threads[t]);
+                  status = EXIT_FAILURE;
+                  continue;
+                }
+
+              print_result(format, op, sizes[s], threads[t], n, &result,
+                           &first);
+            }
+        }
+    }
+
+  if (format == FORMAT_JSON)
+    fprintf(stdout, "%s\n", first ? "[]" : "\n]");
+
+  remove_logdir(logdir);
+  return status;
+}
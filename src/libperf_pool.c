@@ -0,0 +1,269 @@
+/******************************************************************************
+ * libperf_pool.c                                                             *
+ *                                                                            *
+ * This is the libperf context pool.  Contexts for many threads are carved    *
+ * out of cache line aligned arena chunks and recycled through a free list    *
+ * when they are closed, including when their thread exits.                   *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_CACHELINE 64
+#define __LIBPERF_POOL_CHUNK 64                /* blocks per grown chunk */
+
+/* precedes every block, one cache line so the context stays aligned */
+struct block
+{
+  struct block *next;                   /* free list */
+  struct libperf_pool *pool;
+  pid_t owner;                          /* thread of libperf_pool_thread */
+} __attribute__ ((aligned(__LIBPERF_CACHELINE)));
+
+/* one arena allocation, its blocks follow the header */
+struct chunk
+{
+  struct chunk *next;
+} __attribute__ ((aligned(__LIBPERF_CACHELINE)));
+
+/* pool struct */
+struct libperf_pool
+{
+  uint64_t mask;
+  int flags;
+  size_t stride;                        /* struct block and context */
+  pthread_key_t key;                    /* libperf_pool_thread block */
+
+  /* guarded by lock */
+  pthread_mutex_t lock;
+  struct block *free;
+  struct chunk *chunks;
+  FILE *log;
+};
+
+#define BLOCK_DATA(b) ((struct libperf_data *) ((struct block *) (b) + 1))
+#define DATA_BLOCK(pd) ((struct block *) (pd) - 1)
+
+/* adds a chunk of nr blocks to the free list, with pool->lock held */
+static int
+add_chunk(struct libperf_pool *pool, size_t nr)
+{
+  struct chunk *c;
+
+  struct block *b;
+
+  void *memory;
+
+  size_t i;
+
+  if (nr > (SIZE_MAX - sizeof(*c)) / pool->stride)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  errno = posix_memalign(&memory, __LIBPERF_CACHELINE,
+                         sizeof(*c) + nr * pool->stride);
+  if (errno != 0)
+    return -1;
+
+  c = memory;
+  c->next = pool->chunks;
+  pool->chunks = c;
+
+  for (i = nr; i-- > 0;)
+    {
+      b = (struct block *) ((char *) (c + 1) + i * pool->stride);
+      b->pool = pool;
+      b->owner = 0;
+      b->next = pool->free;
+      pool->free = b;
+    }
+
+  return 0;
+}
+
+static struct block *
+get_block(struct libperf_pool *pool)
+{
+  struct block *b = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->free != NULL || add_chunk(pool, __LIBPERF_POOL_CHUNK) == 0)
+    {
+      b = pool->free;
+      pool->free = b->next;
+    }
+  pthread_mutex_unlock(&pool->lock);
+
+  return b;
+}
+
+/* finalizes the context of an exiting thread unless it was already
+   closed, in which case its block may even serve another thread now */
+static void
+thread_exit(void *arg)
+{
+  struct block *b = arg;
+
+  if (b->owner == sys_gettid())
+    libperf_finalize(BLOCK_DATA(b), NULL);
+}
+
+struct libperf_pool *
+libperf_pool_create(uint64_t mask, int flags, size_t reserve)
+{
+  struct libperf_pool *pool = calloc(1, sizeof(*pool));
+
+  if (pool == NULL)
+    return NULL;
+
+  pool->mask = mask;
+  pool->flags = flags;
+  pool->stride = sizeof(struct block) + __libperf_blocksize();
+  pthread_mutex_init(&pool->lock, NULL);
+
+  errno = pthread_key_create(&pool->key, thread_exit);
+  if (errno != 0)
+    goto fail;
+
+  if (reserve > 0 && add_chunk(pool, reserve) == -1)
+    {
+      pthread_key_delete(pool->key);
+      goto fail;
+    }
+
+  return pool;
+
+fail:
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+  return NULL;
+}
+
+struct libperf_data *
+libperf_pool_initialize(struct libperf_pool *pool, int pid, int cpu)
+{
+  struct block *b = get_block(pool);
+
+  if (b == NULL)
+    return NULL;
+
+  /* on failure the context is closed, which already returned b */
+  return __libperf_initialize_block(BLOCK_DATA(b), pool, pid, cpu,
+                                    pool->mask, pool->flags);
+}
+
+struct libperf_data *
+libperf_pool_thread(struct libperf_pool *pool)
+{
+  struct block *b = pthread_getspecific(pool->key);
+
+  struct libperf_data *pd;
+
+  int saved_errno;
+
+  if (b != NULL)
+    return BLOCK_DATA(b);
+
+  pd = libperf_pool_initialize(pool, -1, -1);
+  if (pd == NULL)
+    return NULL;
+
+  b = DATA_BLOCK(pd);
+  b->owner = sys_gettid();
+
+  errno = pthread_setspecific(pool->key, b);
+  if (errno != 0 || libperf_enableall(pd) == -1)
+    {
+      saved_errno = errno;
+      libperf_close(pd);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  return pd;
+}
+
+void
+__libperf_pool_release(struct libperf_pool *pool, struct libperf_data *pd)
+{
+  struct block *b = DATA_BLOCK(pd);
+
+  /* closed by its own thread before exiting */
+  if (b->owner != 0 && pthread_getspecific(pool->key) == b)
+    pthread_setspecific(pool->key, NULL);
+  b->owner = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  b->next = pool->free;
+  pool->free = b;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+FILE *
+__libperf_pool_logger(struct libperf_pool *pool)
+{
+  char path[PATH_MAX];
+
+  FILE *log;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->log == NULL &&
+      __libperf_logpath(path, sizeof(path), getpid(), "") == 0)
+    pool->log = fopen(path, "a");
+  log = pool->log;
+  pthread_mutex_unlock(&pool->lock);
+
+  return log;
+}
+
+void
+libperf_pool_destroy(struct libperf_pool *pool)
+{
+  struct chunk *c, *next;
+
+  if (pool == NULL)
+    return;
+
+  pthread_key_delete(pool->key);
+
+  if (pool->log != NULL)
+    fclose(pool->log);
+
+  for (c = pool->chunks; c != NULL; c = next)
+    {
+      next = c->next;
+      free(c);
+    }
+
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
@@ -0,0 +1,262 @@
+/******************************************************************************
+ * libperf_private.h                                                          *
+ *                                                                            *
+ * This file holds the helpers shared by the libperf translation units.  It  *
+ * is not installed and is not part of the libperf interface.                 *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#ifndef __LIB_LIBPERF_PRIVATE_H
+#define __LIB_LIBPERF_PRIVATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+/* internal initialization flags, above those of enum libperf_flags */
+
+/* pid -1 means every task on cpu, and no per-context log file is opened */
+#define __LIBPERF_FLAG_SYSTEMWIDE (1 << 16)
+
+/* counts stay with the monitored thread instead of folding in children */
+#define __LIBPERF_FLAG_NOINHERIT (1 << 17)
+
+/* counters start with the next exec of the monitored task */
+#define __LIBPERF_FLAG_ENABLE_ON_EXEC (1 << 18)
+
+/* pid is a cgroup directory fd, counting every task of the cgroup on cpu */
+#define __LIBPERF_FLAG_CGROUP (1 << 19)
+
+/* the context lives in a block of a struct libperf_pool */
+#define __LIBPERF_FLAG_POOLED (1 << 20)
+
+/* compiler barrier, enough for the single-writer mmap page seqlock */
+#define barrier() __asm__ volatile ("" ::: "memory")
+
+/* rdclock() function */
+static inline unsigned long long rdclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* perf_event_open syscall wrapper */
+static inline long
+sys_perf_event_open(struct perf_event_attr *hw_event,
+                    pid_t pid, int cpu, int group_fd,
+                    unsigned long flags)
+{
+  return syscall(__NR_perf_event_open, hw_event, pid, cpu,
+                 group_fd, flags);
+}
+
+/* gettid syscall wrapper */
+static inline pid_t
+sys_gettid(void)
+{
+  return syscall(SYS_gettid);
+}
+
+/* copies the default perf_event_attr of a counter from enum
+   libperf_tracepoint, returns -1 for an invalid counter */
+int
+__libperf_defaultattr(int counter, struct perf_event_attr *attr);
+
+/* reads the builtin counters and wall time of a context like
+   libperf_readall, but only through read( ) and without touching the
+   context's scratch state, so a thread other than the owner may call it */
+int
+__libperf_readsyscall(struct libperf_data *pd, uint64_t *out);
+
+/* LIBPERF_MASK bits of the builtin counters a context has open */
+uint64_t
+__libperf_openmask(struct libperf_data *pd);
+
+/* task a context counts, -1 for every task on its cpu */
+pid_t
+__libperf_pid(struct libperf_data *pd);
+
+/* cpu a context counts on, -1 for any */
+int
+__libperf_cpu(struct libperf_data *pd);
+
+/* opens a standalone, enabled, non-inherited copy of a counter that
+   overflows every period events, returning its fd or -1 */
+int
+__libperf_openoverflow(struct libperf_data *pd, int counter, uint64_t period);
+
+/* bytes of a pool block: a context with its builtin counter slots and
+   group read buffer, a multiple of the cache line size */
+size_t
+__libperf_blocksize(void);
+
+/* builds a context like libperf_initialize_mask inside a zeroed or
+   recycled pool block, which libperf_close hands back to the pool */
+struct libperf_data *
+__libperf_initialize_block(void *block, struct libperf_pool *pool, pid_t pid,
+                           int cpu, uint64_t mask, int flags);
+
+/* puts a closed context's block back on its pool's free list */
+void
+__libperf_pool_release(struct libperf_pool *pool, struct libperf_data *pd);
+
+/* text log shared by the contexts of a pool, opened on first use */
+FILE *
+__libperf_pool_logger(struct libperf_pool *pool);
+
+/* copies the next event spec of a comma separated list into buf, commas
+   between a pmu's slashes stay part of the spec; returns 1, 0 at the end
+   of the list or -1 if the spec does not fit */
+int
+__libperf_nextevent(const char **list, char *buf, size_t size);
+
+/* derived metric compiled from a builtin name or "name=expression" */
+struct __libperf_metric;
+
+/* returns NULL with errno set to EINVAL if the metric does not parse */
+struct __libperf_metric *
+__libperf_metric_compile(const char *metric);
+
+const char *
+__libperf_metric_name(const struct __libperf_metric *m);
+
+/* counters the metric reads, as LIBPERF_MASK bits */
+uint64_t
+__libperf_metric_mask(const struct __libperf_metric *m);
+
+/* evaluates over LIBPERF_NR_COUNTERS deltas, NAN for a division by zero */
+double
+__libperf_metric_eval(const struct __libperf_metric *m, const double *deltas);
+
+void
+__libperf_metric_free(struct __libperf_metric *m);
+
+/* growable buffer binary log records are encoded into */
+struct __libperf_logbuf
+{
+  char *data;
+  size_t len;
+  size_t size;
+  int error;                    /* set once an allocation failed */
+};
+
+/* builds <log dir>/<pid><suffix>, returns -1 if it does not fit */
+int
+__libperf_logpath(char *path, size_t size, pid_t pid, const char *suffix);
+
+/* appends a schema record naming nr_events events */
+void
+__libperf_logbuf_schema(struct __libperf_logbuf *b, int nr_events,
+                        const char *const *names);
+
+/* appends a record naming a region id */
+void
+__libperf_logbuf_region(struct __libperf_logbuf *b, uint32_t region,
+                        const char *name);
+
+/* appends a values, times or stats record and returns its zeroed payload
+   of the given size, or NULL if out of memory */
+void *
+__libperf_logbuf_record(struct __libperf_logbuf *b, uint32_t type,
+                        uint64_t timestamp, uint32_t tid, uint32_t region,
+                        uint64_t id, size_t payload);
+
+/* appends a metric record carrying one value and the metric's name */
+void
+__libperf_logbuf_metric(struct __libperf_logbuf *b, uint64_t timestamp,
+                        uint32_t tid, uint32_t region, uint64_t id,
+                        const char *name, double value);
+
+/* appends already encoded records */
+void
+__libperf_logbuf_raw(struct __libperf_logbuf *b, const void *data, size_t len);
+
+/* appends the whole buffer to a file with O_APPEND */
+int
+__libperf_logbuf_append(struct __libperf_logbuf *b, const char *path);
+
+void
+__libperf_logbuf_free(struct __libperf_logbuf *b);
+
+/* CLOCK_REALTIME in ns, the timestamp of log records */
+uint64_t
+__libperf_realtime(void);
+
+/* two-sided Student t critical value for df degrees of freedom at a
+   confidence of 0.90, 0.95 or 0.99 */
+double
+__libperf_tcritical(double df, double confidence);
+
+/* whether __libperf_tcritical has a table for confidence */
+int
+__libperf_tsupported(double confidence);
+
+/* address to symbol resolution for one process, loaded from its maps */
+struct __libperf_symbols;
+
+struct __libperf_symbols *
+__libperf_symbols_open(pid_t pid);
+
+/* rereads /proc/<pid>/maps, keeping the symbol tables already loaded */
+int
+__libperf_symbols_reload(struct __libperf_symbols *s);
+
+/* names the function containing ip, returning a string owned by s or buf */
+const char *
+__libperf_symbols_name(struct __libperf_symbols *s, uint64_t ip, char *buf,
+                       size_t size);
+
+void
+__libperf_symbols_close(struct __libperf_symbols *s);
+
+/* single-producer, single-consumer ring drained by the background logger */
+struct __libperf_logqueue;
+
+/* registers a ring for one thread, starting the logger if needed */
+struct __libperf_logqueue *
+__libperf_logqueue_create(pid_t tid, int nr_events, const char *const *names);
+
+/* reserves the next slot as a values record and returns its nr_events
+   values to fill in, or NULL if the ring is full and the record dropped */
+uint64_t *
+__libperf_logqueue_push(struct __libperf_logqueue *q, uint32_t region,
+                        uint64_t id);
+
+/* publishes the slot returned by __libperf_logqueue_push */
+void
+__libperf_logqueue_commit(struct __libperf_logqueue *q);
+
+/* names a region in the records of this ring */
+int
+__libperf_logqueue_region(struct __libperf_logqueue *q, uint32_t region,
+                          const char *name);
+
+/* retires the ring, final is written after its last record and taken over */
+void
+__libperf_logqueue_close(struct __libperf_logqueue *q,
+                         struct __libperf_logbuf *final);
+
+#endif /* __LIB_LIBPERF_PRIVATE_H */
@@ -0,0 +1,135 @@
+/******************************************************************************
+ * libperf_probe.c                                                            *
+ *                                                                            *
+ * This is the libperf capability probe.  It finds out once per process      *
+ * which counters this kernel and PMU support, so that contexts created       *
+ * later skip the unsupported ones without a system call.                     *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_PARANOID "/proc/sys/kernel/perf_event_paranoid"
+
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+static struct libperf_capabilities capabilities;
+
+static int
+read_paranoid(void)
+{
+  FILE *f = fopen(__LIBPERF_PARANOID, "r");
+
+  int level;
+
+  if (f == NULL)
+    return INT_MAX;
+
+  if (fscanf(f, "%d", &level) != 1)
+    level = INT_MAX;
+
+  fclose(f);
+  return level;
+}
+
+/* asks the kernel whether user space may rdpmc this open event */
+static int
+probe_rdpmc(int fd)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  struct perf_event_mmap_page *pc;
+
+  long page_size = sysconf(_SC_PAGESIZE);
+
+  int result;
+
+  pc = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (pc == MAP_FAILED)
+    return 0;
+
+  result = pc->cap_user_rdpmc;
+  munmap(pc, page_size);
+  return result;
+#else
+  (void) fd;
+  return 0;
+#endif
+}
+
+static void
+probe(void)
+{
+  struct perf_event_attr attr;
+
+  int counter, fd, saved_errno = errno;
+
+  capabilities.paranoid = read_paranoid();
+
+  /* the same attributes a context opens, on the calling thread */
+  for (counter = 0; __libperf_defaultattr(counter, &attr) == 0; counter++)
+    {
+      attr.disabled = 1;
+      attr.inherit = 0;
+
+      fd = sys_perf_event_open(&attr, 0, -1, -1, 0);
+
+      /* under perf_event_paranoid 2 and up contexts count user space only,
+         see open_counter */
+      if (fd < 0 && (errno == EACCES || errno == EPERM))
+        {
+          attr.exclude_kernel = attr.exclude_hv = 1;
+          fd = sys_perf_event_open(&attr, 0, -1, -1, 0);
+        }
+
+      if (fd < 0)
+        {
+          capabilities.error = errno;
+          continue;
+        }
+
+      capabilities.supported |= LIBPERF_MASK(counter);
+
+      /* only hardware events ever get a user space counter index */
+      if (attr.type == PERF_TYPE_HARDWARE && !capabilities.rdpmc)
+        capabilities.rdpmc = probe_rdpmc(fd);
+
+      close(fd);
+    }
+
+  errno = saved_errno;
+}
+
+const struct libperf_capabilities *
+libperf_capabilities(void)
+{
+  pthread_once(&probe_once, probe);
+  return &capabilities;
+}
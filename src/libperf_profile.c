@@ -0,0 +1,911 @@
+/******************************************************************************
+ * libperf_profile.c                                                          *
+ *                                                                            *
+ * This is the libperf call-graph profiler.  It samples call stacks with      *
+ * PERF_SAMPLE_CALLCHAIN on every cpu, folds them into a bounded table keyed  *
+ * by stack and writes the table as folded-stack text for flame graphs.       *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_PROFILE_PAGES 16             /* data pages per cpu */
+#define __LIBPERF_PROFILE_STACKS 4096          /* default table size */
+#define __LIBPERF_PROFILE_SCAN 8               /* eviction candidates */
+#define __LIBPERF_PROFILE_RECORD 8192          /* largest record kept */
+#define __LIBPERF_PROFILE_EVENT "cpu-clock"
+
+/* callchain entries at or above this are PERF_CONTEXT_* markers */
+#define __LIBPERF_CONTEXT_MAX ((uint64_t) -4095)
+
+/* one sampling event and its ring buffer */
+struct ring
+{
+  int fd;
+  struct perf_event_mmap_page *page;    /* control page */
+  char *data;                           /* ring buffer after the page */
+  uint64_t size;                        /* ring buffer bytes, power of two */
+  size_t map_size;
+};
+
+/* a distinct stack, frames leaf first */
+struct stack
+{
+  uint64_t hash;
+  uint64_t count;
+  uint64_t *ips;
+  uint32_t nr;
+  uint32_t capacity;
+  struct stack *next;                   /* hash chain */
+};
+
+/* profiler struct */
+struct libperf_profiler
+{
+  pid_t pid;
+  struct ring *rings;
+  int nr_rings;
+
+  /* the table and the rings' tails, guarded by lock */
+  pthread_mutex_t lock;
+  struct stack *stacks;
+  size_t max_stacks;
+  size_t nr_stacks;
+  struct stack **buckets;
+  size_t nr_buckets;                    /* power of two */
+  size_t hand;                          /* next eviction candidate */
+  uint64_t evicted;
+  uint64_t lost;
+  struct __libperf_symbols *symbols;    /* loaded by the first dump */
+  char record[__LIBPERF_PROFILE_RECORD];
+
+  /* autodump thread */
+  int running;
+  pthread_t thread;
+  int stop[2];                          /* pipe that wakes the thread */
+  char *path;
+  unsigned int interval_ms;
+};
+
+/* a symbolized stack at dump time, stacks of several addresses in the
+   same functions share one */
+struct folded
+{
+  char *line;
+  size_t length;
+  uint64_t hash;
+  uint64_t count;
+  struct folded *next;                  /* hash chain */
+};
+
+/* PERF_RECORD_SAMPLE layout for PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN */
+struct callchain_record
+{
+  struct perf_event_header header;
+  uint32_t pid, tid;
+  uint64_t nr;
+  uint64_t ips[];
+};
+
+/* PERF_RECORD_LOST layout */
+struct lost_record
+{
+  struct perf_event_header header;
+  uint64_t id;
+  uint64_t lost;
+};
+
+/* FNV-1a over the frames */
+static uint64_t
+hash_stack(const uint64_t *ips, uint32_t nr)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  uint32_t i;
+
+  int j;
+
+  for (i = 0; i < nr; i++)
+    for (j = 0; j < 64; j += 8)
+      {
+        hash ^= (ips[i] >> j) & 0xff;
+        hash *= 0x100000001b3ULL;
+      }
+
+  return hash;
+}
+
+static void
+unlink_stack(struct libperf_profiler *p, struct stack *s)
+{
+  struct stack **link = &p->buckets[s->hash & (p->nr_buckets - 1)];
+
+  while (*link != s)
+    link = &(*link)->next;
+
+  *link = s->next;
+}
+
+/* frees a slot by folding the least sampled of a few candidates into the
+   evicted count, a clock sweep that keeps hot stacks without a full scan */
+static struct stack *
+evict(struct libperf_profiler *p)
+{
+  struct stack *victim = NULL, *s;
+
+  int i;
+
+  for (i = 0; i < __LIBPERF_PROFILE_SCAN; i++)
+    {
+      s = &p->stacks[p->hand];
+      p->hand = (p->hand + 1) % p->max_stacks;
+      if (victim == NULL || s->count < victim->count)
+        victim = s;
+    }
+
+  unlink_stack(p, victim);
+  p->evicted += victim->count;
+  return victim;
+}
+
+static void
+add_stack(struct libperf_profiler *p, const uint64_t *ips, uint32_t nr)
+{
+  uint64_t hash = hash_stack(ips, nr), *grown;
+
+  struct stack *s, **bucket = &p->buckets[hash & (p->nr_buckets - 1)];
+
+  for (s = *bucket; s != NULL; s = s->next)
+    if (s->hash == hash && s->nr == nr &&
+        memcmp(s->ips, ips, nr * sizeof(*ips)) == 0)
+      {
+        s->count++;
+        return;
+      }
+
+  if (p->nr_stacks < p->max_stacks)
+    s = &p->stacks[p->nr_stacks++];
+  else
+    s = evict(p);
+
+  if (nr > s->capacity)
+    {
+      grown = realloc(s->ips, nr * sizeof(*ips));
+      if (grown == NULL)
+        {
+          /* the slot is free again but the sample has nowhere to go */
+          s->nr = 0;
+          s->count = 0;
+          s->hash = hash_stack(NULL, 0);
+          s->next = p->buckets[s->hash & (p->nr_buckets - 1)];
+          p->buckets[s->hash & (p->nr_buckets - 1)] = s;
+          p->evicted++;
+          return;
+        }
+      s->ips = grown;
+      s->capacity = nr;
+    }
+
+  memcpy(s->ips, ips, nr * sizeof(*ips));
+  s->nr = nr;
+  s->hash = hash;
+  s->count = 1;
+  s->next = *bucket;
+  *bucket = s;
+}
+
+/* drops the PERF_CONTEXT_* markers from a callchain in place */
+static uint32_t
+strip_markers(uint64_t *ips, uint64_t nr)
+{
+  uint32_t n = 0;
+
+  uint64_t i;
+
+  for (i = 0; i < nr; i++)
+    if (ips[i] < __LIBPERF_CONTEXT_MAX)
+      ips[n++] = ips[i];
+
+  return n;
+}
+
+/* folds the records of one ring, with p->lock held */
+static int
+drain_ring(struct libperf_profiler *p, struct ring *r)
+{
+  struct perf_event_header *header;
+
+  uint64_t head, tail, offset, mask = r->size - 1;
+
+  int n = 0;
+
+  /* the kernel publishes data_head after writing the records it covers */
+  head = __atomic_load_n(&r->page->data_head, __ATOMIC_ACQUIRE);
+  tail = r->page->data_tail;
+
+  while (tail < head)
+    {
+      offset = tail & mask;
+      header = (struct perf_event_header *) (r->data + offset);
+
+      if (header->size == 0)
+        break;
+
+      /* records are folded from a copy since markers are stripped in
+         place, which also stitches together those that wrap around */
+      if (header->size > sizeof(p->record))
+        {
+          tail += header->size;
+          continue;
+        }
+
+      if (offset + header->size > r->size)
+        {
+          uint64_t first = r->size - offset;
+
+          memcpy(p->record, r->data + offset, first);
+          memcpy(p->record + first, r->data, header->size - first);
+        }
+      else
+        memcpy(p->record, header, header->size);
+
+      header = (struct perf_event_header *) p->record;
+
+      switch (header->type)
+        {
+        case PERF_RECORD_SAMPLE:
+          {
+            struct callchain_record *c = (struct callchain_record *) header;
+
+            uint64_t nr = c->nr;
+
+            if (nr > (header->size - sizeof(*c)) / sizeof(uint64_t))
+              nr = (header->size - sizeof(*c)) / sizeof(uint64_t);
+
+            add_stack(p, c->ips, strip_markers(c->ips, nr));
+            n++;
+            break;
+          }
+
+        case PERF_RECORD_LOST:
+          p->lost += ((const struct lost_record *) header)->lost;
+          break;
+
+        default:
+          break;
+        }
+
+      tail += header->size;
+    }
+
+  /* hand the consumed space back only after we are done reading it */
+  __atomic_store_n(&r->page->data_tail, tail, __ATOMIC_RELEASE);
+  return n;
+}
+
+static int
+drain_locked(struct libperf_profiler *p)
+{
+  int i, n = 0;
+
+  for (i = 0; i < p->nr_rings; i++)
+    n += drain_ring(p, &p->rings[i]);
+
+  return n;
+}
+
+static int
+open_ring(struct ring *r, struct perf_event_attr *attr, pid_t pid, int cpu)
+{
+  long page_size = sysconf(_SC_PAGESIZE);
+
+  int saved_errno;
+
+  void *map;
+
+  r->fd = sys_perf_event_open(attr, pid, cpu, -1, 0);
+
+  /* unprivileged users may only sample user space */
+  if (r->fd < 0 && (errno == EACCES || errno == EPERM) &&
+      !attr->exclude_kernel)
+    {
+      attr->exclude_kernel = attr->exclude_hv = 1;
+      attr->exclude_callchain_kernel = 1;
+      r->fd = sys_perf_event_open(attr, pid, cpu, -1, 0);
+    }
+
+  if (r->fd < 0)
+    return -1;
+
+  r->map_size = (__LIBPERF_PROFILE_PAGES + 1) * page_size;
+  map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+  if (map == MAP_FAILED)
+    {
+      saved_errno = errno;
+      close(r->fd);
+      errno = saved_errno;
+      return -1;
+    }
+
+  r->page = map;
+  r->data = (char *) map + page_size;
+  r->size = (uint64_t) __LIBPERF_PROFILE_PAGES * page_size;
+  return 0;
+}
+
+static void
+close_rings(struct libperf_profiler *p)
+{
+  int i;
+
+  for (i = 0; i < p->nr_rings; i++)
+    {
+      munmap(p->rings[i].page, p->rings[i].map_size);
+      close(p->rings[i].fd);
+    }
+
+  free(p->rings);
+}
+
+static void
+free_stacks(struct libperf_profiler *p)
+{
+  size_t i;
+
+  for (i = 0; i < p->max_stacks; i++)
+    free(p->stacks[i].ips);
+
+  free(p->stacks);
+  free(p->buckets);
+}
+
+struct libperf_profiler *
+libperf_profiler_open(int pid, const char *event, uint64_t period,
+                      size_t max_stacks, int flags)
+{
+  struct libperf_profiler *p;
+
+  struct perf_event_attr attr;
+
+  long nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+  int cpu, saved_errno = ENODEV;
+
+  if (event == NULL)
+    event = __LIBPERF_PROFILE_EVENT;
+
+  if (max_stacks == 0)
+    max_stacks = __LIBPERF_PROFILE_STACKS;
+
+  if (period == 0 || max_stacks > SIZE_MAX / 2 / sizeof(struct stack) ||
+      nr_cpus < 1)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (libperf_parseattr(event, &attr) == -1)
+    return NULL;
+
+  if (pid == 0)
+    pid = getpid();
+
+  attr.size = sizeof(attr);
+  attr.disabled = 1;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+  attr.watermark = 1;
+  attr.wakeup_watermark =
+    __LIBPERF_PROFILE_PAGES * sysconf(_SC_PAGESIZE) / 2;
+
+  /* per cpu events may be inherited and still mmapped */
+  attr.inherit = 1;
+
+  if (flags & LIBPERF_SAMPLER_FREQ)
+    {
+      attr.freq = 1;
+      attr.sample_freq = period;
+    }
+  else
+    attr.sample_period = period;
+
+  if (flags & LIBPERF_SAMPLER_USER)
+    attr.exclude_kernel = attr.exclude_hv = attr.exclude_callchain_kernel = 1;
+
+  p = calloc(1, sizeof(*p));
+  if (p == NULL)
+    return NULL;
+
+  p->pid = pid;
+  p->max_stacks = max_stacks;
+  for (p->nr_buckets = 1; p->nr_buckets < max_stacks; p->nr_buckets *= 2)
+    ;
+
+  p->stacks = calloc(max_stacks, sizeof(*p->stacks));
+  p->buckets = calloc(p->nr_buckets, sizeof(*p->buckets));
+  p->rings = calloc(nr_cpus, sizeof(*p->rings));
+  if (p->stacks == NULL || p->buckets == NULL || p->rings == NULL)
+    {
+      saved_errno = ENOMEM;
+      goto fail;
+    }
+
+  /* offline or missing cpus are skipped, any other error is fatal */
+  for (cpu = 0; cpu < nr_cpus; cpu++)
+    {
+      if (open_ring(&p->rings[p->nr_rings], &attr, pid, cpu) == 0)
+        p->nr_rings++;
+      else if (errno != ENODEV && errno != EINVAL)
+        {
+          saved_errno = errno;
+          goto fail;
+        }
+      else
+        saved_errno = errno;
+    }
+
+  if (p->nr_rings == 0)
+    goto fail;
+
+  pthread_mutex_init(&p->lock, NULL);
+  p->stop[0] = p->stop[1] = -1;
+  return p;
+
+fail:
+  if (p->rings != NULL)
+    close_rings(p);
+  if (p->stacks != NULL)
+    free_stacks(p);
+  else
+    free(p->buckets);
+  free(p);
+  errno = saved_errno;
+  return NULL;
+}
+
+static int
+ioctl_all(struct libperf_profiler *p, unsigned long request)
+{
+  int i, result = 0;
+
+  for (i = 0; i < p->nr_rings; i++)
+    if (ioctl(p->rings[i].fd, request) == -1)
+      result = -1;
+
+  return result;
+}
+
+int
+libperf_profiler_enable(struct libperf_profiler *p)
+{
+  return ioctl_all(p, PERF_EVENT_IOC_ENABLE);
+}
+
+int
+libperf_profiler_disable(struct libperf_profiler *p)
+{
+  return ioctl_all(p, PERF_EVENT_IOC_DISABLE);
+}
+
+int
+libperf_profiler_drain(struct libperf_profiler *p)
+{
+  int n;
+
+  pthread_mutex_lock(&p->lock);
+  n = drain_locked(p);
+  pthread_mutex_unlock(&p->lock);
+  return n;
+}
+
+/* writes the frames of one folded line, root first; runs of kernel frames
+   become one */
+static void
+write_frames(struct libperf_profiler *p, const struct stack *s, FILE *out)
+{
+  char buf[PATH_MAX + 32];
+
+  const char *name, *previous = NULL;
+
+  uint32_t i;
+
+  if (s->nr == 0)
+    fputs("[unknown]", out);
+
+  for (i = s->nr; i-- > 0;)
+    {
+      /* return addresses point after the call, which may be the start of
+         the next function */
+      name = __libperf_symbols_name(p->symbols, i > 0 ? s->ips[i] - 1 :
+                                    s->ips[i], buf, sizeof(buf));
+
+      if (previous != NULL && strcmp(name, "[kernel]") == 0 &&
+          strcmp(previous, "[kernel]") == 0)
+        continue;
+
+      if (i != s->nr - 1)
+        fputc(';', out);
+      fputs(name, out);
+      previous = name[0] == '[' ? name : NULL;
+    }
+}
+
+/* FNV-1a over a folded line */
+static uint64_t
+hash_line(const char *line, size_t length)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  size_t i;
+
+  for (i = 0; i < length; i++)
+    {
+      hash ^= (unsigned char) line[i];
+      hash *= 0x100000001b3ULL;
+    }
+
+  return hash;
+}
+
+/* symbolizes every stack and adds up the ones that fold to the same line,
+   filling lines in table order; returns their number or -1 */
+static ssize_t
+fold_stacks(struct libperf_profiler *p, struct folded *lines)
+{
+  struct folded **buckets, *f;
+
+  size_t i, nr_buckets = 1, n = 0;
+
+  uint64_t hash;
+
+  char *line;
+
+  size_t length;
+
+  FILE *out;
+
+  while (nr_buckets < p->nr_stacks)
+    nr_buckets <<= 1;
+
+  buckets = calloc(nr_buckets, sizeof(*buckets));
+  if (buckets == NULL)
+    return -1;
+
+  for (i = 0; i < p->nr_stacks; i++)
+    {
+      if (p->stacks[i].count == 0)
+        continue;
+
+      out = open_memstream(&line, &length);
+      if (out == NULL)
+        goto fail;
+      write_frames(p, &p->stacks[i], out);
+      if (fclose(out) == EOF)
+        goto fail;
+
+      hash = hash_line(line, length);
+      for (f = buckets[hash & (nr_buckets - 1)]; f != NULL; f = f->next)
+        if (f->hash == hash && f->length == length &&
+            memcmp(f->line, line, length) == 0)
+          break;
+
+      if (f != NULL)
+        {
+          f->count += p->stacks[i].count;
+          free(line);
+          continue;
+        }
+
+      f = &lines[n++];
+      f->line = line;
+      f->length = length;
+      f->hash = hash;
+      f->count = p->stacks[i].count;
+      f->next = buckets[hash & (nr_buckets - 1)];
+      buckets[hash & (nr_buckets - 1)] = f;
+    }
+
+  free(buckets);
+  return n;
+
+fail:
+  while (n > 0)
+    free(lines[--n].line);
+  free(buckets);
+  return -1;
+}
+
+static int
+dump_locked(struct libperf_profiler *p, FILE *out)
+{
+  struct folded *lines;
+
+  ssize_t nr_lines, i;
+
+  int n = 0;
+
+  drain_locked(p);
+
+  /* pick up libraries mapped since the last dump */
+  if (p->symbols == NULL)
+    p->symbols = __libperf_symbols_open(p->pid);
+  else if (__libperf_symbols_reload(p->symbols) == -1)
+    {
+      __libperf_symbols_close(p->symbols);
+      p->symbols = NULL;
+    }
+
+  if (p->symbols == NULL)
+    return -1;
+
+  lines = malloc((p->nr_stacks + 1) * sizeof(*lines));
+  if (lines == NULL)
+    return -1;
+
+  nr_lines = fold_stacks(p, lines);
+  if (nr_lines == -1)
+    {
+      free(lines);
+      return -1;
+    }
+
+  for (i = 0; i < nr_lines; i++)
+    {
+      /* keep going after an error so every line is freed */
+      if (n != -1)
+        n = fprintf(out, "%s %" PRIu64 "\n", lines[i].line,
+                    lines[i].count) < 0 ? -1 : n + 1;
+      free(lines[i].line);
+    }
+  free(lines);
+
+  if (n == -1)
+    return -1;
+
+  if (p->evicted > 0)
+    {
+      if (fprintf(out, "[evicted] %" PRIu64 "\n", p->evicted) < 0)
+        return -1;
+      n++;
+    }
+
+  return n;
+}
+
+int
+libperf_profiler_dump(struct libperf_profiler *p, FILE *out)
+{
+  int n;
+
+  pthread_mutex_lock(&p->lock);
+  n = dump_locked(p, out);
+  pthread_mutex_unlock(&p->lock);
+
+  if (n >= 0 && fflush(out) == EOF)
+    return -1;
+
+  return n;
+}
+
+/* writes path.tmp and renames it over path, so readers never see a
+   partial profile */
+static void
+dump_file(struct libperf_profiler *p)
+{
+  char tmp[PATH_MAX];
+
+  FILE *f;
+
+  int n;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", p->path) >= (int) sizeof(tmp))
+    return;
+
+  f = fopen(tmp, "we");
+  if (f == NULL)
+    return;
+
+  pthread_mutex_lock(&p->lock);
+  n = dump_locked(p, f);
+  pthread_mutex_unlock(&p->lock);
+
+  if (fclose(f) == EOF || n < 0 || rename(tmp, p->path) == -1)
+    unlink(tmp);
+}
+
+static void *
+autodump_main(void *arg)
+{
+  struct libperf_profiler *p = arg;
+
+  struct pollfd *fds;
+
+  unsigned long long deadline, now;
+
+  int i, timeout;
+
+  fds = calloc(p->nr_rings + 1, sizeof(*fds));
+  if (fds == NULL)
+    return NULL;
+
+  for (i = 0; i < p->nr_rings; i++)
+    {
+      fds[i].fd = p->rings[i].fd;
+      fds[i].events = POLLIN;
+    }
+  fds[p->nr_rings].fd = p->stop[0];
+  fds[p->nr_rings].events = POLLIN;
+
+  /* deadlines advance by whole intervals so dumps do not drift */
+  deadline = rdclock() + p->interval_ms * 1000000ULL;
+
+  for (;;)
+    {
+      now = rdclock();
+      if (now >= deadline)
+        {
+          dump_file(p);
+          deadline += p->interval_ms * 1000000ULL;
+          if (deadline <= now)
+            deadline = now + p->interval_ms * 1000000ULL;
+          continue;
+        }
+
+      timeout = (deadline - now + 999999) / 1000000;
+      if (poll(fds, p->nr_rings + 1, timeout) == -1 && errno != EINTR)
+        break;
+
+      if (fds[p->nr_rings].revents != 0)
+        break;
+
+      /* a ring crossed its watermark */
+      for (i = 0; i < p->nr_rings; i++)
+        if (fds[i].revents & POLLIN)
+          {
+            libperf_profiler_drain(p);
+            break;
+          }
+    }
+
+  free(fds);
+  return NULL;
+}
+
+static void
+stop_autodump(struct libperf_profiler *p)
+{
+  if (!p->running)
+    return;
+
+  close(p->stop[1]);
+  pthread_join(p->thread, NULL);
+  close(p->stop[0]);
+  p->stop[0] = p->stop[1] = -1;
+  free(p->path);
+  p->path = NULL;
+  p->running = 0;
+}
+
+int
+libperf_profiler_autodump(struct libperf_profiler *p, const char *path,
+                          unsigned int interval_ms)
+{
+  int saved_errno;
+
+  stop_autodump(p);
+
+  if (path == NULL)
+    return 0;
+
+  if (interval_ms == 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  p->path = strdup(path);
+  if (p->path == NULL)
+    return -1;
+
+  if (pipe2(p->stop, O_CLOEXEC) == -1)
+    goto fail;
+
+  p->interval_ms = interval_ms;
+  errno = pthread_create(&p->thread, NULL, autodump_main, p);
+  if (errno != 0)
+    {
+      saved_errno = errno;
+      close(p->stop[0]);
+      close(p->stop[1]);
+      p->stop[0] = p->stop[1] = -1;
+      errno = saved_errno;
+      goto fail;
+    }
+
+  p->running = 1;
+  return 0;
+
+fail:
+  free(p->path);
+  p->path = NULL;
+  return -1;
+}
+
+void
+libperf_profiler_reset(struct libperf_profiler *p)
+{
+  size_t i;
+
+  pthread_mutex_lock(&p->lock);
+
+  /* samples already in the rings belong to the old profile */
+  drain_locked(p);
+
+  for (i = 0; i < p->nr_stacks; i++)
+    p->stacks[i].count = 0;
+  memset(p->buckets, 0, p->nr_buckets * sizeof(*p->buckets));
+  p->nr_stacks = 0;
+  p->hand = 0;
+  p->evicted = 0;
+
+  pthread_mutex_unlock(&p->lock);
+}
+
+uint64_t
+libperf_profiler_lost(struct libperf_profiler *p)
+{
+  uint64_t lost;
+
+  pthread_mutex_lock(&p->lock);
+  lost = p->lost;
+  pthread_mutex_unlock(&p->lock);
+  return lost;
+}
+
+void
+libperf_profiler_close(struct libperf_profiler *p)
+{
+  if (p == NULL)
+    return;
+
+  stop_autodump(p);
+  close_rings(p);
+  free_stacks(p);
+  __libperf_symbols_close(p->symbols);
+  pthread_mutex_destroy(&p->lock);
+  free(p);
+}
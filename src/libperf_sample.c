@@ -0,0 +1,354 @@
+/******************************************************************************
+ * libperf_sample.c                                                           *
+ *                                                                            *
+ * This is the libperf sampling implementation.  A sampler programs one      *
+ * event with a sample period or frequency and drains the kernel's mmap'd     *
+ * ring buffer from user space.                                               *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_SAMPLE_PAGES 16              /* default data pages */
+#define __LIBPERF_SAMPLE_BATCH 256             /* records per write( ) */
+#define __LIBPERF_SAMPLE_TYPE \
+  (PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME)
+
+/* sampler struct */
+struct libperf_sampler
+{
+  int fd;
+  struct perf_event_mmap_page *page;    /* control page */
+  char *data;                           /* ring buffer after the page */
+  uint64_t size;                        /* ring buffer bytes, power of two */
+  size_t map_size;
+  uint64_t period;
+  uint64_t lost;
+};
+
+/* PERF_RECORD_SAMPLE layout for __LIBPERF_SAMPLE_TYPE */
+struct sample_record
+{
+  struct perf_event_header header;
+  uint64_t ip;
+  uint32_t pid, tid;
+  uint64_t time;
+};
+
+/* PERF_RECORD_LOST layout */
+struct lost_record
+{
+  struct perf_event_header header;
+  uint64_t id;
+  uint64_t lost;
+};
+
+struct libperf_sampler *
+libperf_sampler_open(int pid, int cpu, int counter, uint64_t period,
+                     int pages, int flags)
+{
+  struct libperf_sampler *s;
+
+  struct perf_event_attr attr;
+
+  long page_size = sysconf(_SC_PAGESIZE);
+
+  int saved_errno;
+
+  void *map;
+
+  if (pages == 0)
+    pages = __LIBPERF_SAMPLE_PAGES;
+
+  /* the kernel wants a power of two number of data pages */
+  if (pages < 0 || (pages & (pages - 1)) != 0 || period == 0 ||
+      __libperf_defaultattr(counter, &attr) == -1)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (pid == -1)
+    pid = sys_gettid();
+
+  attr.disabled = 1;
+  attr.sample_type = __LIBPERF_SAMPLE_TYPE;
+  attr.sample_id_all = 1;
+  attr.watermark = 1;
+  attr.wakeup_watermark = pages * page_size / 2;
+
+  if (flags & LIBPERF_SAMPLER_FREQ)
+    {
+      attr.freq = 1;
+      attr.sample_freq = period;
+    }
+  else
+    attr.sample_period = period;
+
+  /* the kernel refuses to mmap inherited per-task events */
+  attr.inherit = (cpu != -1);
+
+  if (flags & LIBPERF_SAMPLER_USER)
+    attr.exclude_kernel = attr.exclude_hv = 1;
+
+  s = malloc(sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->fd = sys_perf_event_open(&attr, pid, cpu, -1, 0);
+
+  /* unprivileged users may only sample user space */
+  if (s->fd < 0 && (errno == EACCES || errno == EPERM) &&
+      !attr.exclude_kernel)
+    {
+      attr.exclude_kernel = attr.exclude_hv = 1;
+      s->fd = sys_perf_event_open(&attr, pid, cpu, -1, 0);
+    }
+
+  if (s->fd < 0)
+    goto fail;
+
+  s->map_size = (pages + 1) * page_size;
+  map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+  if (map == MAP_FAILED)
+    goto fail;
+
+  s->page = map;
+  s->data = (char *) map + page_size;
+  s->size = (uint64_t) pages * page_size;
+  s->period = period;
+  s->lost = 0;
+  return s;
+
+fail:
+  saved_errno = errno;
+  if (s->fd >= 0)
+    close(s->fd);
+  free(s);
+  errno = saved_errno;
+  return NULL;
+}
+
+int
+libperf_sampler_enable(struct libperf_sampler *s)
+{
+  return ioctl(s->fd, PERF_EVENT_IOC_ENABLE);
+}
+
+int
+libperf_sampler_disable(struct libperf_sampler *s)
+{
+  return ioctl(s->fd, PERF_EVENT_IOC_DISABLE);
+}
+
+int
+libperf_sampler_fd(struct libperf_sampler *s)
+{
+  return s->fd;
+}
+
+uint64_t
+libperf_sampler_lost(struct libperf_sampler *s)
+{
+  return s->lost;
+}
+
+int
+libperf_sampler_drain(struct libperf_sampler *s, libperf_sample_fn fn,
+                      void *arg)
+{
+  union
+  {
+    struct perf_event_header header;
+    struct sample_record sample;
+    struct lost_record lost;
+    char bytes[512];
+  } copy;
+
+  const struct perf_event_header *header;
+
+  struct libperf_sample sample;
+
+  uint64_t head, tail, offset, mask = s->size - 1;
+
+  int n = 0;
+
+  /* the kernel publishes data_head after writing the records it covers */
+  head = __atomic_load_n(&s->page->data_head, __ATOMIC_ACQUIRE);
+  tail = s->page->data_tail;
+
+  while (tail < head)
+    {
+      offset = tail & mask;
+      header = (const struct perf_event_header *) (s->data + offset);
+
+      if (header->size == 0)
+        break;
+
+      /* records that wrap around the end are stitched together */
+      if (offset + header->size > s->size)
+        {
+          uint64_t first = s->size - offset;
+
+          if (header->size > sizeof(copy))
+            {
+              tail += header->size;
+              continue;
+            }
+
+          memcpy(copy.bytes, s->data + offset, first);
+          memcpy(copy.bytes + first, s->data, header->size - first);
+          header = &copy.header;
+        }
+
+      switch (header->type)
+        {
+        case PERF_RECORD_SAMPLE:
+          {
+            const struct sample_record *r =
+              (const struct sample_record *) header;
+
+            sample.ip = r->ip;
+            sample.pid = r->pid;
+            sample.tid = r->tid;
+            sample.time = r->time;
+            fn(&sample, arg);
+            n++;
+            break;
+          }
+
+        case PERF_RECORD_LOST:
+          s->lost += ((const struct lost_record *) header)->lost;
+          break;
+
+        default:
+          break;
+        }
+
+      tail += header->size;
+    }
+
+  /* hand the consumed space back only after we are done reading it */
+  __atomic_store_n(&s->page->data_tail, tail, __ATOMIC_RELEASE);
+  return n;
+}
+
+/* batches samples for libperf_sampler_write */
+struct write_batch
+{
+  int fd;
+  int n;
+  int error;
+  struct libperf_sample records[__LIBPERF_SAMPLE_BATCH];
+};
+
+static int
+flush_batch(struct write_batch *batch)
+{
+  size_t size = batch->n * sizeof(batch->records[0]);
+
+  char *p = (char *) batch->records;
+
+  ssize_t result;
+
+  while (size > 0)
+    {
+      result = write(batch->fd, p, size);
+      if (result < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          batch->error = 1;
+          return -1;
+        }
+      p += result;
+      size -= result;
+    }
+
+  batch->n = 0;
+  return 0;
+}
+
+static void
+batch_sample(const struct libperf_sample *sample, void *arg)
+{
+  struct write_batch *batch = arg;
+
+  if (batch->error)
+    return;
+
+  batch->records[batch->n++] = *sample;
+  if (batch->n == __LIBPERF_SAMPLE_BATCH)
+    flush_batch(batch);
+}
+
+int
+libperf_sampler_writeheader(struct libperf_sampler *s, int fd)
+{
+  struct libperf_sample_header header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LIBPERF_SAMPLE_MAGIC, sizeof(header.magic));
+  header.version = LIBPERF_SAMPLE_VERSION;
+  header.record_size = sizeof(struct libperf_sample);
+  header.period = s->period;
+
+  if (write(fd, &header, sizeof(header)) != sizeof(header))
+    return -1;
+
+  return 0;
+}
+
+int
+libperf_sampler_write(struct libperf_sampler *s, int fd)
+{
+  struct write_batch batch;
+
+  int n;
+
+  batch.fd = fd;
+  batch.n = 0;
+  batch.error = 0;
+
+  n = libperf_sampler_drain(s, batch_sample, &batch);
+
+  if (batch.error || flush_batch(&batch) == -1)
+    return -1;
+
+  return n;
+}
+
+void
+libperf_sampler_close(struct libperf_sampler *s)
+{
+  munmap(s->page, s->map_size);
+  close(s->fd);
+  free(s);
+}
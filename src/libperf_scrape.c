@@ -0,0 +1,274 @@
+/******************************************************************************
+ * libperf_scrape.c                                                           *
+ *                                                                            *
+ * This is the libperf scraper.  It prints consistent snapshots of the        *
+ * shared memory export segments of running processes.                        *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libperf.h"
+
+/* where glibc keeps POSIX shared memory objects */
+#define SHM_DIR "/dev/shm"
+
+enum format
+{
+  FORMAT_TEXT,
+  FORMAT_JSON
+};
+
+#define AT(h, offset) ((const void *) ((const char *) (h) + (offset)))
+
+static void
+print_json_string(const char *s)
+{
+  fputc('"', stdout);
+  for (; *s != '\0'; s++)
+    {
+      if (*s == '"' || *s == '\\')
+        fprintf(stdout, "\\%c", *s);
+      else if ((unsigned char) *s < 0x20)
+        fprintf(stdout, "\\u%04x", *s);
+      else
+        fputc(*s, stdout);
+    }
+  fputc('"', stdout);
+}
+
+/* JSON has no NaN, an undefined value is null */
+static void
+print_json_double(double value)
+{
+  if (isnan(value) || isinf(value))
+    fprintf(stdout, "null");
+  else
+    fprintf(stdout, "%.17g", value);
+}
+
+static void
+print_text(const char *name, const struct libperf_export_header *h)
+{
+  const struct libperf_export_event *events = AT(h, h->events_offset);
+
+  const struct libperf_export_region *regions = AT(h, h->regions_offset);
+
+  const struct libperf_export_metric *metrics = AT(h, h->metrics_offset);
+
+  const struct libperf_stats *stats;
+
+  uint32_t i, j;
+
+  fprintf(stdout, "%s: pid %" PRId32 " tid %" PRId32 " cpu %" PRId32
+          ", %" PRIu64 " updates\n", name, h->pid, h->tid, h->cpu,
+          h->nr_updates);
+
+  for (i = 0; i < h->nr_events; i++)
+    fprintf(stdout, "  %18" PRIu64 "  %-24s (%.2f%%)\n",
+            events[i].count.value, events[i].name,
+            100.0 * libperf_countratio(&events[i].count));
+
+  for (i = 0; i < h->nr_metrics; i++)
+    fprintf(stdout, "  %18.6g  %s\n", metrics[i].value, metrics[i].name);
+
+  for (i = 0; i < h->nr_regions; i++)
+    {
+      stats = AT(h, regions[i].stats_offset);
+      fprintf(stdout, "  region %s, %" PRIu64 " samples\n", regions[i].name,
+              stats[0].n);
+      for (j = 0; j < h->nr_events; j++)
+        if (stats[j].n > 0)
+          fprintf(stdout, "  %18.6g  %-24s +- %.6g\n", stats[j].mean,
+                  events[j].name, sqrt(stats[j].variance));
+    }
+}
+
+/* one object per segment */
+static void
+print_json(const char *name, const struct libperf_export_header *h)
+{
+  const struct libperf_export_event *events = AT(h, h->events_offset);
+
+  const struct libperf_export_region *regions = AT(h, h->regions_offset);
+
+  const struct libperf_export_metric *metrics = AT(h, h->metrics_offset);
+
+  const struct libperf_stats *stats;
+
+  uint32_t i, j;
+
+  fprintf(stdout, "{\"segment\":");
+  print_json_string(name);
+  fprintf(stdout, ",\"pid\":%" PRId32 ",\"tid\":%" PRId32 ",\"cpu\":%" PRId32
+          ",\"start_time\":%" PRIu64 ",\"update_time\":%" PRIu64
+          ",\"updates\":%" PRIu64 ",\"events\":{", h->pid, h->tid, h->cpu,
+          h->start_time, h->update_time, h->nr_updates);
+
+  for (i = 0; i < h->nr_events; i++)
+    {
+      fprintf(stdout, "%s", i > 0 ? "," : "");
+      print_json_string(events[i].name);
+      fprintf(stdout, ":{\"value\":%" PRIu64 ",\"enabled\":%" PRIu64
+              ",\"running\":%" PRIu64 "}", events[i].count.value,
+              events[i].count.time_enabled, events[i].count.time_running);
+    }
+
+  fprintf(stdout, "},\"metrics\":{");
+  for (i = 0; i < h->nr_metrics; i++)
+    {
+      fprintf(stdout, "%s", i > 0 ? "," : "");
+      print_json_string(metrics[i].name);
+      fputc(':', stdout);
+      print_json_double(metrics[i].value);
+    }
+
+  fprintf(stdout, "},\"regions\":{");
+  for (i = 0; i < h->nr_regions; i++)
+    {
+      stats = AT(h, regions[i].stats_offset);
+      fprintf(stdout, "%s", i > 0 ? "," : "");
+      print_json_string(regions[i].name);
+      fprintf(stdout, ":{");
+      for (j = 0; j < h->nr_events; j++)
+        {
+          fprintf(stdout, "%s", j > 0 ? "," : "");
+          print_json_string(events[j].name);
+          fprintf(stdout, ":{\"n\":%" PRIu64 ",\"mean\":%.17g,"
+                  "\"stddev\":%.17g,\"min\":%.17g,\"max\":%.17g}",
+                  stats[j].n, stats[j].mean, sqrt(stats[j].variance),
+                  stats[j].min, stats[j].max);
+        }
+      fputc('}', stdout);
+    }
+
+  fprintf(stdout, "}}\n");
+}
+
+static int
+scrape(const char *name, enum format format)
+{
+  struct libperf_export_reader *r = libperf_export_attach(name);
+
+  const struct libperf_export_header *h;
+
+  if (r == NULL)
+    {
+      fprintf(stderr, "libperf-scrape: %s: %s\n", name, strerror(errno));
+      return -1;
+    }
+
+  h = libperf_export_snapshot(r);
+  if (h == NULL)
+    {
+      fprintf(stderr, "libperf-scrape: %s: %s\n", name, strerror(errno));
+      libperf_export_detach(r);
+      return -1;
+    }
+
+  if (format == FORMAT_JSON)
+    print_json(name, h);
+  else
+    print_text(name, h);
+
+  libperf_export_detach(r);
+  return 0;
+}
+
+/* scrapes every segment with the default name prefix */
+static int
+scrape_all(enum format format)
+{
+  struct dirent *entry;
+
+  DIR *dir = opendir(SHM_DIR);
+
+  int result = 0;
+
+  if (dir == NULL)
+    {
+      perror(SHM_DIR);
+      return -1;
+    }
+
+  while ((entry = readdir(dir)) != NULL)
+    if (strncmp(entry->d_name, LIBPERF_EXPORT_PREFIX,
+                strlen(LIBPERF_EXPORT_PREFIX)) == 0 &&
+        scrape(entry->d_name, format) == -1)
+      result = -1;
+
+  closedir(dir);
+  return result;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-f text|json] [segment...]\n"
+          "  -f  output format\n"
+          "  without segments, every " SHM_DIR "/" LIBPERF_EXPORT_PREFIX
+          "* segment is read\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  enum format format = FORMAT_TEXT;
+
+  int opt, i, result = 0;
+
+  while ((opt = getopt(argc, argv, "f:h")) != -1)
+    {
+      switch (opt)
+        {
+        case 'f':
+          if (strcmp(optarg, "text") == 0)
+            format = FORMAT_TEXT;
+          else if (strcmp(optarg, "json") == 0)
+            format = FORMAT_JSON;
+          else
+            {
+              usage(argv[0]);
+              return EXIT_FAILURE;
+            }
+          break;
+        default:
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (optind == argc)
+    result = scrape_all(format);
+
+  for (i = optind; i < argc; i++)
+    if (scrape(argv[i], format) == -1)
+      result = -1;
+
+  return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
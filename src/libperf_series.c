@@ -0,0 +1,386 @@
+/******************************************************************************
+ * libperf_series.c                                                           *
+ *                                                                            *
+ * This is the libperf time series.  A background thread snapshots a          *
+ * context at a fixed interval and keeps the counter deltas of the latest     *
+ * intervals in a ring, optionally streaming each one to a file or callback.  *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+/* series struct */
+struct libperf_series
+{
+  struct libperf_data *pd;
+  unsigned int interval_ms;
+
+  /* ring of the latest intervals, guarded by lock */
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;
+  struct libperf_interval *ring;
+  size_t capacity;
+  uint64_t nr_intervals;
+  int stopping;
+  pthread_t thread;
+
+  /* consumers of new intervals, guarded by output_lock, which the
+     sampling thread holds while it feeds them */
+  pthread_mutex_t output_lock;
+  libperf_interval_fn fn;
+  void *arg;
+  int fd;
+
+  /* sampling thread only */
+  uint64_t last[LIBPERF_NR_COUNTERS];
+  uint64_t mask;
+};
+
+static void
+timespec_add_ms(struct timespec *ts, unsigned int ms)
+{
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L)
+    {
+      ts->tv_sec++;
+      ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int
+timespec_before(const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int
+write_all(int fd, const char *p, size_t left)
+{
+  ssize_t result;
+
+  while (left > 0)
+    {
+      result = write(fd, p, left);
+      if (result < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      p += result;
+      left -= result;
+    }
+
+  return 0;
+}
+
+/* encodes one interval as a values record in schema order */
+static void
+write_interval(struct libperf_series *s, const struct libperf_interval *iv)
+{
+  struct __libperf_logbuf b = { NULL, 0, 0, 0 };
+
+  uint64_t *values;
+
+  int nr = 0, i;
+
+  values = __libperf_logbuf_record(&b, LIBPERF_LOG_VALUES, iv->timestamp,
+                                   __libperf_pid(s->pd), LIBPERF_LOG_NOREGION,
+                                   s->nr_intervals,
+                                   (__builtin_popcountll(s->mask) + 1) *
+                                   sizeof(uint64_t));
+  if (values != NULL)
+    {
+      for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+        if (s->mask & LIBPERF_MASK(i))
+          values[nr++] = iv->deltas[i];
+      values[nr] = iv->duration;
+
+      /* a failed write is dropped, the ring still has the interval */
+      write_all(s->fd, b.data, b.len);
+    }
+
+  __libperf_logbuf_free(&b);
+}
+
+/* takes one snapshot and publishes the deltas since the previous one */
+static void
+sample(struct libperf_series *s)
+{
+  struct libperf_interval iv;
+
+  uint64_t now[LIBPERF_NR_COUNTERS];
+
+  int i;
+
+  if (__libperf_readsyscall(s->pd, now) == -1)
+    return;
+
+  iv.timestamp = __libperf_realtime();
+  iv.duration = now[LIBPERF_LIB_SW_WALL_TIME] -
+                s->last[LIBPERF_LIB_SW_WALL_TIME];
+
+  /* a counter that went backwards was reset, count from zero */
+  for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+    iv.deltas[i] = now[i] >= s->last[i] ? now[i] - s->last[i] : now[i];
+  iv.deltas[LIBPERF_LIB_SW_WALL_TIME] = iv.duration;
+  memcpy(s->last, now, sizeof(now));
+
+  pthread_mutex_lock(&s->lock);
+  s->ring[s->nr_intervals % s->capacity] = iv;
+  s->nr_intervals++;
+  pthread_mutex_unlock(&s->lock);
+
+  pthread_mutex_lock(&s->output_lock);
+  if (s->fn != NULL)
+    s->fn(&iv, s->arg);
+  if (s->fd != -1)
+    write_interval(s, &iv);
+  pthread_mutex_unlock(&s->output_lock);
+}
+
+static void *
+sampler_main(void *arg)
+{
+  struct libperf_series *s = arg;
+
+  struct timespec deadline, now;
+
+  /* deadlines advance by whole intervals so the cadence does not drift
+     with the time each snapshot takes */
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  pthread_mutex_lock(&s->lock);
+  while (!s->stopping)
+    {
+      timespec_add_ms(&deadline, s->interval_ms);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      /* fell behind by a whole interval, skip the missed ones */
+      if (timespec_before(&deadline, &now))
+        deadline = now;
+
+      while (!s->stopping &&
+             pthread_cond_timedwait(&s->wakeup, &s->lock, &deadline) !=
+             ETIMEDOUT)
+        ;
+
+      if (s->stopping)
+        break;
+
+      pthread_mutex_unlock(&s->lock);
+      sample(s);
+      pthread_mutex_lock(&s->lock);
+    }
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+}
+
+struct libperf_series *
+libperf_series_start(struct libperf_data *pd, unsigned int interval_ms,
+                     size_t capacity)
+{
+  struct libperf_series *s;
+
+  pthread_condattr_t attr;
+
+  int saved_errno;
+
+  if (pd == NULL || interval_ms == 0 || capacity == 0 ||
+      capacity > SIZE_MAX / sizeof(struct libperf_interval))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->ring = malloc(capacity * sizeof(*s->ring));
+  if (s->ring == NULL)
+    {
+      free(s);
+      return NULL;
+    }
+
+  s->pd = pd;
+  s->interval_ms = interval_ms;
+  s->capacity = capacity;
+  s->fd = -1;
+  s->mask = __libperf_openmask(pd);
+
+  /* the first interval starts now */
+  if (__libperf_readsyscall(pd, s->last) == -1)
+    {
+      saved_errno = errno;
+      free(s->ring);
+      free(s);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_mutex_init(&s->output_lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&s->wakeup, &attr);
+  pthread_condattr_destroy(&attr);
+
+  errno = pthread_create(&s->thread, NULL, sampler_main, s);
+  if (errno != 0)
+    {
+      saved_errno = errno;
+      pthread_cond_destroy(&s->wakeup);
+      pthread_mutex_destroy(&s->output_lock);
+      pthread_mutex_destroy(&s->lock);
+      free(s->ring);
+      free(s);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  return s;
+}
+
+size_t
+libperf_series_last(struct libperf_series *s, struct libperf_interval *out,
+                    size_t n)
+{
+  uint64_t first;
+
+  size_t i;
+
+  pthread_mutex_lock(&s->lock);
+
+  if (n > s->capacity)
+    n = s->capacity;
+  if (n > s->nr_intervals)
+    n = s->nr_intervals;
+
+  first = s->nr_intervals - n;
+  for (i = 0; i < n; i++)
+    out[i] = s->ring[(first + i) % s->capacity];
+
+  pthread_mutex_unlock(&s->lock);
+  return n;
+}
+
+uint64_t
+libperf_series_count(struct libperf_series *s)
+{
+  uint64_t nr;
+
+  pthread_mutex_lock(&s->lock);
+  nr = s->nr_intervals;
+  pthread_mutex_unlock(&s->lock);
+  return nr;
+}
+
+void
+libperf_series_stream(struct libperf_series *s, libperf_interval_fn fn,
+                      void *arg)
+{
+  pthread_mutex_lock(&s->output_lock);
+  s->fn = fn;
+  s->arg = arg;
+  pthread_mutex_unlock(&s->output_lock);
+}
+
+int
+libperf_series_tofile(struct libperf_series *s, const char *path)
+{
+  struct __libperf_logbuf b = { NULL, 0, 0, 0 };
+
+  const char *names[LIBPERF_NR_COUNTERS];
+
+  int fd = -1, nr = 0, i, saved_errno;
+
+  if (path != NULL)
+    {
+      fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+      if (fd == -1)
+        return -1;
+
+      for (i = 0; i < LIBPERF_NR_COUNTERS; i++)
+        if (s->mask & LIBPERF_MASK(i))
+          names[nr++] = libperf_countername(s->pd, i);
+      names[nr++] = libperf_countername(s->pd, LIBPERF_LIB_SW_WALL_TIME);
+
+      __libperf_logbuf_schema(&b, nr, names);
+      if (b.error)
+        errno = ENOMEM;
+
+      if (b.error || write_all(fd, b.data, b.len) == -1)
+        {
+          saved_errno = errno;
+          __libperf_logbuf_free(&b);
+          close(fd);
+          errno = saved_errno;
+          return -1;
+        }
+      __libperf_logbuf_free(&b);
+    }
+
+  pthread_mutex_lock(&s->output_lock);
+  if (s->fd != -1)
+    close(s->fd);
+  s->fd = fd;
+  pthread_mutex_unlock(&s->output_lock);
+
+  return 0;
+}
+
+void
+libperf_series_stop(struct libperf_series *s)
+{
+  if (s == NULL)
+    return;
+
+  pthread_mutex_lock(&s->lock);
+  s->stopping = 1;
+  pthread_cond_signal(&s->wakeup);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+
+  if (s->fd != -1)
+    close(s->fd);
+
+  pthread_cond_destroy(&s->wakeup);
+  pthread_mutex_destroy(&s->output_lock);
+  pthread_mutex_destroy(&s->lock);
+  free(s->ring);
+  free(s);
+}
@@ -0,0 +1,172 @@
+/******************************************************************************
+ * libperf_spawn.c                                                            *
+ *                                                                            *
+ * This is the libperf launcher.  It forks a child that waits on a pipe until *
+ * its counters are open with enable_on_exec, so counting covers exactly the  *
+ * program the child execs.                                                   *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+/* child side: wait for the go byte, then exec, reporting a failed exec
+   as its errno on the close-on-exec error pipe */
+static void
+child(int go, int error, char *const argv[])
+{
+  char c;
+
+  ssize_t result;
+
+  int saved_errno;
+
+  do
+    result = read(go, &c, 1);
+  while (result == -1 && errno == EINTR);
+
+  /* the parent closed the pipe without a go: its counters failed */
+  if (result != 1)
+    _exit(127);
+
+  close(go);
+  execvp(argv[0], argv);
+
+  saved_errno = errno;
+  while (write(error, &saved_errno, sizeof(saved_errno)) == -1 &&
+         errno == EINTR)
+    ;
+  _exit(127);
+}
+
+/* reaps a child that never reached exec */
+static void
+reap(pid_t pid)
+{
+  while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+    ;
+}
+
+struct libperf_data *
+libperf_spawn(char *const argv[], const char *events, int flags, int *pid)
+{
+  struct libperf_data *pd;
+
+  int go[2], error[2], child_errno, saved_errno;
+
+  ssize_t result;
+
+  pid_t p;
+
+  if (argv == NULL || argv[0] == NULL)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  if (pipe2(go, O_CLOEXEC) == -1)
+    return NULL;
+
+  if (pipe2(error, O_CLOEXEC) == -1)
+    {
+      close(go[0]);
+      close(go[1]);
+      return NULL;
+    }
+
+  p = fork();
+  if (p == -1)
+    {
+      saved_errno = errno;
+      close(go[0]);
+      close(go[1]);
+      close(error[0]);
+      close(error[1]);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  if (p == 0)
+    {
+      close(go[1]);
+      close(error[0]);
+      child(go[0], error[1], argv);
+    }
+
+  close(go[0]);
+  close(error[1]);
+
+  /* counters of another task can neither be mapped nor queued from here,
+     and lazy ones would miss the exec */
+  flags &= ~(LIBPERF_FLAG_MMAP | LIBPERF_FLAG_LAZY | LIBPERF_FLAG_ASYNCLOG);
+  flags |= __LIBPERF_FLAG_ENABLE_ON_EXEC;
+
+  if (events != NULL)
+    pd = libperf_initialize_events(p, -1, events, flags);
+  else
+    pd = libperf_initialize_mask(p, -1, LIBPERF_MASK_ALL, flags);
+
+  if (pd == NULL)
+    {
+      saved_errno = errno;
+      close(go[1]);
+      close(error[0]);
+      reap(p);
+      errno = saved_errno;
+      return NULL;
+    }
+
+  /* release the child, then learn whether its exec worked */
+  do
+    result = write(go[1], "x", 1);
+  while (result == -1 && errno == EINTR);
+  close(go[1]);
+
+  if (result != 1)
+    child_errno = errno;
+  else
+    {
+      do
+        result = read(error[0], &child_errno, sizeof(child_errno));
+      while (result == -1 && errno == EINTR);
+      result = (result == sizeof(child_errno)) ? -1 : 1;
+    }
+  close(error[0]);
+
+  if (result == -1)
+    {
+      reap(p);
+      libperf_close(pd);
+      errno = child_errno;
+      return NULL;
+    }
+
+  *pid = p;
+  return pd;
+}
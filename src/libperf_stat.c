@@ -0,0 +1,547 @@
+/******************************************************************************
+ * libperf_stat.c                                                             *
+ *                                                                            *
+ * This is libperf-stat, a perf stat style launcher.  It runs a command with  *
+ * counters attached through libperf_spawn and reports the counts as text,    *
+ * CSV or JSON, optionally over repeated runs and at fixed intervals.         *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "libperf.h"
+
+#define DEFAULT_EVENTS "task-clock,context-switches,cpu-migrations," \
+                       "page-faults,cycles,instructions,branches,branch-misses"
+#define MAX_SPEC 256
+
+enum format
+{
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+/* one event of the list and its counts over all runs */
+struct event
+{
+  char name[MAX_SPEC];
+  int id;                       /* counter id in every run's context */
+  uint64_t last;                /* value at the previous interval */
+  double n, mean, M2;           /* runs it was counted in */
+  double ratio;                 /* summed time_running / time_enabled */
+};
+
+struct options
+{
+  const char *events;
+  int runs;
+  long interval_ms;
+  int flags;
+  enum format format;
+  FILE *out;
+};
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+update(struct event *e, double value)
+{
+  double delta;
+
+  e->n++;
+  delta = value - e->mean;
+  e->mean += delta / e->n;
+  e->M2 += delta * (value - e->mean);
+}
+
+static double
+stddev(const struct event *e)
+{
+  return e->n < 2 ? 0.0 : sqrt(e->M2 / (e->n - 1));
+}
+
+/* splits the list like libperf_initialize_events: commas between a pmu's
+   slashes belong to the spec; builtin names keep their enum id, the other
+   specs are added in list order after LIBPERF_NR_COUNTERS */
+static int
+parse_events(const char *list, struct event **events)
+{
+  struct event *ev = NULL, *grown;
+
+  const char *p = list, *start;
+
+  int nr = 0, added = 0, slash, counter;
+
+  size_t len;
+
+  while (*p != '\0')
+    {
+      while (*p == ',' || *p == ' ')
+        p++;
+      if (*p == '\0')
+        break;
+
+      for (start = p, slash = 0; *p != '\0' && (*p != ',' || slash); p++)
+        if (*p == '/')
+          slash = !slash;
+
+      len = p - start;
+      if (len >= MAX_SPEC)
+        {
+          free(ev);
+          return -1;
+        }
+
+      grown = realloc(ev, (nr + 2) * sizeof(*ev));
+      if (grown == NULL)
+        {
+          free(ev);
+          return -1;
+        }
+      ev = grown;
+
+      memset(&ev[nr], 0, sizeof(ev[nr]));
+      memcpy(ev[nr].name, start, len);
+      ev[nr].name[len] = '\0';
+
+      counter = libperf_eventbyname(ev[nr].name);
+      if (counter >= 0 && counter < LIBPERF_LIB_SW_WALL_TIME &&
+          counter != LIBPERF_COUNT_HW_CACHE_BPU_LOADS_MISSES)
+        ev[nr].id = counter;
+      else
+        ev[nr].id = LIBPERF_NR_COUNTERS + added++;
+      nr++;
+    }
+
+  if (ev == NULL)
+    return -1;
+
+  /* wall time closes the list */
+  memset(&ev[nr], 0, sizeof(ev[nr]));
+  strcpy(ev[nr].name, "wall-time");
+  ev[nr].id = LIBPERF_LIB_SW_WALL_TIME;
+
+  *events = ev;
+  return nr + 1;
+}
+
+/* waits up to timeout_ms for the child, -1 waits for good; returns 1 once
+   it is reaped */
+static int
+wait_child(pid_t pid, int pidfd, long timeout_ms, int *status)
+{
+  struct pollfd pfd = { pidfd, POLLIN, 0 };
+
+  pid_t result;
+
+  if (timeout_ms >= 0)
+    {
+      if (pidfd >= 0)
+        poll(&pfd, 1, timeout_ms);
+      else
+        poll(NULL, 0, timeout_ms);
+
+      result = waitpid(pid, status, WNOHANG);
+    }
+  else
+    result = waitpid(pid, status, 0);
+
+  if (result == -1 && errno == EINTR)
+    return 0;
+
+  return result == pid || result == -1;
+}
+
+/* RFC 4180 field, since event specs may hold commas */
+static void
+print_csv_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s != '\0'; s++)
+    {
+      if (*s == '"')
+        fputc('"', out);
+      fputc(*s, out);
+    }
+  fputc('"', out);
+}
+
+static void
+print_interval(const struct options *o, double t, const char *name,
+               uint64_t value)
+{
+  switch (o->format)
+    {
+    case FORMAT_TEXT:
+      fprintf(o->out, "%16.9f %18" PRIu64 "      %s\n", t, value, name);
+      break;
+    case FORMAT_CSV:
+      fprintf(o->out, "%.9f,", t);
+      print_csv_string(o->out, name);
+      fprintf(o->out, ",%" PRIu64 ",,\n", value);
+      break;
+    case FORMAT_JSON:
+      break;
+    }
+}
+
+/* prints the change of every event since the last interval */
+static void
+interval(struct libperf_data *pd, struct event *ev, int nr,
+         const struct options *o, double t)
+{
+  struct libperf_count count;
+
+  int i;
+
+  if (o->format == FORMAT_JSON)
+    fprintf(o->out, "{\"time\":%.9f,\"events\":{", t);
+
+  for (i = 0; i < nr; i++)
+    {
+      if (libperf_readcount(pd, ev[i].id, &count) == -1)
+        count.value = ev[i].last;
+
+      if (o->format == FORMAT_JSON)
+        fprintf(o->out, "%s\"%s\":%" PRIu64, i > 0 ? "," : "", ev[i].name,
+                count.value - ev[i].last);
+      else
+        print_interval(o, t, ev[i].name, count.value - ev[i].last);
+
+      ev[i].last = count.value;
+    }
+
+  if (o->format == FORMAT_JSON)
+    fprintf(o->out, "}}\n");
+  fflush(o->out);
+}
+
+/* one run of the command, returns its exit status or -1 */
+static int
+run(char *argv[], struct event *ev, int nr, const struct options *o)
+{
+  struct libperf_count count;
+
+  struct libperf_data *pd;
+
+  double start, next;
+
+  int i, pid, pidfd = -1, status = 0;
+
+  long timeout = -1;
+
+  /* the child may already run, or even be done, when libperf_spawn
+     returns; the fork and the counter opens are the smaller error */
+  start = now();
+
+  pd = libperf_spawn(argv, o->events, o->flags, &pid);
+  if (pd == NULL)
+    {
+      fprintf(stderr, "libperf-stat: %s: %s\n", argv[0], strerror(errno));
+      return -1;
+    }
+
+  next = start + o->interval_ms / 1e3;
+
+  for (i = 0; i < nr; i++)
+    ev[i].last = 0;
+
+#ifdef SYS_pidfd_open
+  if (o->interval_ms > 0)
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+
+  for (;;)
+    {
+      if (o->interval_ms > 0)
+        {
+          timeout = (long) ((next - now()) * 1e3);
+          if (timeout < 0)
+            timeout = 0;
+        }
+
+      if (wait_child(pid, pidfd, timeout, &status))
+        break;
+
+      if (o->interval_ms > 0 && now() >= next)
+        {
+          interval(pd, ev, nr, o, now() - start);
+          next += o->interval_ms / 1e3;
+        }
+    }
+
+  if (pidfd >= 0)
+    close(pidfd);
+
+  for (i = 0; i < nr; i++)
+    {
+      /* the child is gone, so wall time ends now rather than at the read */
+      if (ev[i].id == LIBPERF_LIB_SW_WALL_TIME)
+        {
+          update(&ev[i], (now() - start) * 1e9);
+          ev[i].ratio += 1.0;
+          continue;
+        }
+
+      if (libperf_readcount(pd, ev[i].id, &count) == -1 ||
+          count.time_enabled == 0)
+        continue;
+
+      update(&ev[i], count.value);
+      ev[i].ratio += libperf_countratio(&count);
+    }
+
+  libperf_close(pd);
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+static void
+print_text(char *argv[], const struct event *ev, int nr,
+           const struct options *o)
+{
+  int i;
+
+  fprintf(o->out, "\n Performance counter stats for '");
+  for (i = 0; argv[i] != NULL; i++)
+    fprintf(o->out, "%s%s", i > 0 ? " " : "", argv[i]);
+  if (o->runs > 1)
+    fprintf(o->out, "' (%d runs):\n\n", o->runs);
+  else
+    fprintf(o->out, "':\n\n");
+
+  for (i = 0; i < nr; i++)
+    {
+      if (ev[i].id == LIBPERF_LIB_SW_WALL_TIME)
+        fprintf(o->out, "\n%18.9f      seconds time elapsed", ev[i].mean / 1e9);
+      else if (ev[i].n == 0)
+        fprintf(o->out, "%18s      %-24s", "<not counted>", ev[i].name);
+      else
+        fprintf(o->out, "%18.0f      %-24s", ev[i].mean, ev[i].name);
+
+      /* perf stat's "+-": the standard error relative to the mean */
+      if (ev[i].n > 1 && ev[i].mean > 0)
+        fprintf(o->out, "  ( +- %5.2f%% )",
+                100.0 * stddev(&ev[i]) / sqrt(ev[i].n) / ev[i].mean);
+
+      if (ev[i].n > 0 && ev[i].ratio / ev[i].n < 0.9999)
+        fprintf(o->out, "  (%.2f%%)", 100.0 * ev[i].ratio / ev[i].n);
+
+      fputc('\n', o->out);
+    }
+
+  fputc('\n', o->out);
+}
+
+static void
+print_csv(const struct event *ev, int nr, const struct options *o)
+{
+  int i;
+
+  for (i = 0; i < nr; i++)
+    {
+      fputc(',', o->out);
+      print_csv_string(o->out, ev[i].name);
+      if (ev[i].n == 0)
+        fprintf(o->out, ",,,\n");
+      else
+        fprintf(o->out, ",%.0f,%.6g,%.6f\n", ev[i].mean, stddev(&ev[i]),
+                ev[i].ratio / ev[i].n);
+    }
+}
+
+static void
+print_json(char *argv[], const struct event *ev, int nr, int status,
+           const struct options *o)
+{
+  const char *s;
+
+  int i;
+
+  fprintf(o->out, "{\"command\":[");
+  for (i = 0; argv[i] != NULL; i++)
+    {
+      fprintf(o->out, "%s\"", i > 0 ? "," : "");
+      for (s = argv[i]; *s != '\0'; s++)
+        if (*s == '"' || *s == '\\')
+          fprintf(o->out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+          fprintf(o->out, "\\u%04x", *s);
+        else
+          fputc(*s, o->out);
+      fputc('"', o->out);
+    }
+
+  fprintf(o->out, "],\"runs\":%d,\"status\":%d,\"events\":{", o->runs, status);
+
+  for (i = 0; i < nr; i++)
+    {
+      fprintf(o->out, "%s\"%s\":", i > 0 ? "," : "", ev[i].name);
+      if (ev[i].n == 0)
+        fprintf(o->out, "null");
+      else
+        fprintf(o->out, "{\"value\":%.0f,\"stddev\":%.17g,\"running\":%.6f}",
+                ev[i].mean, stddev(&ev[i]), ev[i].ratio / ev[i].n);
+    }
+
+  fprintf(o->out, "}}\n");
+}
+
+static void
+ignore(int sig)
+{
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-e events] [-r runs] [-I ms] [-f text|csv|json] [-g]\n"
+          "       [-o file] [--] command [args...]\n"
+          "  -e  comma separated counters and event specs (default "
+          DEFAULT_EVENTS ")\n"
+          "  -r  run the command this many times and report mean and spread\n"
+          "  -I  also print the change of every event each ms milliseconds\n"
+          "  -f  output format\n"
+          "  -g  open the events as one group\n"
+          "  -o  write the report to file instead of stderr\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct options o = { DEFAULT_EVENTS, 1, 0, 0, FORMAT_TEXT, stderr };
+
+  struct event *ev;
+
+  struct sigaction sa;
+
+  int opt, nr, i, status = 0;
+
+  /* + stops at the command so its own options are left alone */
+  while ((opt = getopt(argc, argv, "+e:r:I:f:go:h")) != -1)
+    {
+      switch (opt)
+        {
+        case 'e':
+          o.events = optarg;
+          break;
+        case 'r':
+          o.runs = atoi(optarg);
+          break;
+        case 'I':
+          o.interval_ms = atol(optarg);
+          break;
+        case 'f':
+          if (strcmp(optarg, "text") == 0)
+            o.format = FORMAT_TEXT;
+          else if (strcmp(optarg, "csv") == 0)
+            o.format = FORMAT_CSV;
+          else if (strcmp(optarg, "json") == 0)
+            o.format = FORMAT_JSON;
+          else
+            {
+              usage(argv[0]);
+              return EXIT_FAILURE;
+            }
+          break;
+        case 'g':
+          o.flags |= LIBPERF_FLAG_GROUP;
+          break;
+        case 'o':
+          o.out = fopen(optarg, "w");
+          if (o.out == NULL)
+            {
+              perror(optarg);
+              return EXIT_FAILURE;
+            }
+          break;
+        default:
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (optind == argc || o.runs < 1 || o.interval_ms < 0)
+    {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  nr = parse_events(o.events, &ev);
+  if (nr == -1)
+    {
+      fprintf(stderr, "libperf-stat: bad event list '%s'\n", o.events);
+      return EXIT_FAILURE;
+    }
+
+  /* the child gets the terminal's ^C, we stay to report; a handler
+     rather than SIG_IGN, which would survive the child's exec */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = ignore;
+  sigaction(SIGINT, &sa, NULL);
+
+  if (o.format == FORMAT_CSV)
+    fprintf(o.out, "time,event,value,stddev,running\n");
+
+  for (i = 0; i < o.runs; i++)
+    {
+      status = run(argv + optind, ev, nr, &o);
+      if (status == -1)
+        {
+          free(ev);
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (o.format == FORMAT_TEXT)
+    print_text(argv + optind, ev, nr, &o);
+  else if (o.format == FORMAT_CSV)
+    print_csv(ev, nr, &o);
+  else
+    print_json(argv + optind, ev, nr, status, &o);
+
+  if (o.out != stderr)
+    fclose(o.out);
+  free(ev);
+  return status;
+}
@@ -0,0 +1,511 @@
+/******************************************************************************
+ * libperf_symbols.c                                                          *
+ *                                                                            *
+ * This is the libperf symbolizer.  It names code addresses of a process     *
+ * from its /proc/<pid>/maps and the ELF symbol tables of the mapped files,  *
+ * loading each file's table the first time one of its addresses is named.  *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_MAPS "/proc/%d/maps"
+
+/* kernel addresses live in the upper half on every 64 bit layout */
+#define __LIBPERF_KERNEL_START 0x8000000000000000ULL
+
+struct elf_symbol
+{
+  uint64_t addr;
+  uint64_t size;
+  uint32_t name;                        /* offset into strings */
+};
+
+/* a PT_LOAD segment, to turn file offsets into symbol addresses */
+struct elf_load
+{
+  uint64_t offset;
+  uint64_t vaddr;
+  uint64_t size;
+};
+
+/* symbol table of one mapped file, loaded on first use */
+struct elf_file
+{
+  char *path;
+  const char *base;                     /* basename of path */
+  int loaded;
+  struct elf_symbol *symbols;           /* sorted by addr */
+  size_t nr_symbols;
+  char *strings;
+  struct elf_load *loads;
+  int nr_loads;
+  struct elf_file *next;
+};
+
+/* an executable mapping */
+struct mapping
+{
+  uint64_t start;
+  uint64_t end;
+  uint64_t offset;
+  struct elf_file *file;                /* NULL for anonymous or [vdso] */
+  char *name;                           /* only without a file */
+};
+
+/* symbolizer struct */
+struct __libperf_symbols
+{
+  pid_t pid;
+  struct mapping *maps;                 /* sorted by start */
+  int nr_maps;
+  struct elf_file *files;
+};
+
+static int
+compare_symbols(const void *a, const void *b)
+{
+  const struct elf_symbol *x = a, *y = b;
+
+  return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int
+compare_maps(const void *a, const void *b)
+{
+  const struct mapping *x = a, *y = b;
+
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* checks that [offset, offset + size) lies within a file of length len */
+static int
+in_file(uint64_t offset, uint64_t size, size_t len)
+{
+  return offset <= len && size <= len - offset;
+}
+
+/* copies the function symbols of the symbol table section at index i */
+static int
+load_symtab(struct elf_file *f, const char *image, size_t len,
+            const Elf64_Shdr *shdrs, int nr_sections, int i)
+{
+  const Elf64_Shdr *symtab = &shdrs[i], *strtab;
+
+  const Elf64_Sym *sym;
+
+  size_t nr, j, n = 0;
+
+  if (symtab->sh_link >= (Elf64_Word) nr_sections ||
+      symtab->sh_entsize != sizeof(Elf64_Sym))
+    return -1;
+
+  strtab = &shdrs[symtab->sh_link];
+  if (!in_file(symtab->sh_offset, symtab->sh_size, len) ||
+      !in_file(strtab->sh_offset, strtab->sh_size, len) ||
+      strtab->sh_size == 0)
+    return -1;
+
+  nr = symtab->sh_size / sizeof(Elf64_Sym);
+  f->symbols = malloc(nr * sizeof(*f->symbols));
+  f->strings = malloc(strtab->sh_size + 1);
+  if (f->symbols == NULL || f->strings == NULL)
+    return -1;
+
+  memcpy(f->strings, image + strtab->sh_offset, strtab->sh_size);
+  f->strings[strtab->sh_size] = '\0';
+
+  sym = (const Elf64_Sym *) (image + symtab->sh_offset);
+  for (j = 0; j < nr; j++)
+    {
+      if ((ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC &&
+           ELF64_ST_TYPE(sym[j].st_info) != STT_GNU_IFUNC) ||
+          sym[j].st_shndx == SHN_UNDEF || sym[j].st_value == 0 ||
+          sym[j].st_name >= strtab->sh_size)
+        continue;
+
+      f->symbols[n].addr = sym[j].st_value;
+      f->symbols[n].size = sym[j].st_size;
+      f->symbols[n].name = sym[j].st_name;
+      n++;
+    }
+
+  f->nr_symbols = n;
+  qsort(f->symbols, n, sizeof(*f->symbols), compare_symbols);
+  return 0;
+}
+
+/* reads the load segments and the full or, failing that, the dynamic
+   symbol table of an ELF64 file; other files just have no symbols */
+static void
+load_file(struct elf_file *f)
+{
+  const Elf64_Ehdr *ehdr;
+
+  const Elf64_Phdr *phdrs;
+
+  const Elf64_Shdr *shdrs;
+
+  const char *image;
+
+  struct stat st;
+
+  int fd, i, symtab = -1, dynsym = -1;
+
+  f->loaded = 1;
+
+  fd = open(f->path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return;
+
+  if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*ehdr))
+    {
+      close(fd);
+      return;
+    }
+
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return;
+
+  ehdr = (const Elf64_Ehdr *) image;
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_phentsize != sizeof(Elf64_Phdr) ||
+      ehdr->e_shentsize != sizeof(Elf64_Shdr) ||
+      !in_file(ehdr->e_phoff, (uint64_t) ehdr->e_phnum * sizeof(*phdrs),
+               st.st_size) ||
+      !in_file(ehdr->e_shoff, (uint64_t) ehdr->e_shnum * sizeof(*shdrs),
+               st.st_size))
+    goto out;
+
+  phdrs = (const Elf64_Phdr *) (image + ehdr->e_phoff);
+  f->loads = malloc(ehdr->e_phnum * sizeof(*f->loads) + 1);
+  if (f->loads == NULL)
+    goto out;
+
+  for (i = 0; i < ehdr->e_phnum; i++)
+    if (phdrs[i].p_type == PT_LOAD)
+      {
+        f->loads[f->nr_loads].offset = phdrs[i].p_offset;
+        f->loads[f->nr_loads].vaddr = phdrs[i].p_vaddr;
+        f->loads[f->nr_loads].size = phdrs[i].p_filesz;
+        f->nr_loads++;
+      }
+
+  shdrs = (const Elf64_Shdr *) (image + ehdr->e_shoff);
+  for (i = 0; i < ehdr->e_shnum; i++)
+    if (shdrs[i].sh_type == SHT_SYMTAB)
+      symtab = i;
+    else if (shdrs[i].sh_type == SHT_DYNSYM)
+      dynsym = i;
+
+  /* stripped files still export their dynamic symbols */
+  if (symtab != -1 &&
+      load_symtab(f, image, st.st_size, shdrs, ehdr->e_shnum, symtab) == 0 &&
+      f->nr_symbols > 0)
+    goto out;
+
+  free(f->symbols);
+  free(f->strings);
+  f->symbols = NULL;
+  f->strings = NULL;
+  f->nr_symbols = 0;
+
+  if (dynsym != -1 &&
+      load_symtab(f, image, st.st_size, shdrs, ehdr->e_shnum, dynsym) == -1)
+    {
+      free(f->symbols);
+      free(f->strings);
+      f->symbols = NULL;
+      f->strings = NULL;
+      f->nr_symbols = 0;
+    }
+
+out:
+  munmap((void *) image, st.st_size);
+}
+
+static struct elf_file *
+find_file(struct __libperf_symbols *s, const char *path)
+{
+  struct elf_file *f;
+
+  const char *slash;
+
+  for (f = s->files; f != NULL; f = f->next)
+    if (strcmp(f->path, path) == 0)
+      return f;
+
+  f = calloc(1, sizeof(*f));
+  if (f == NULL)
+    return NULL;
+
+  f->path = strdup(path);
+  if (f->path == NULL)
+    {
+      free(f);
+      return NULL;
+    }
+
+  slash = strrchr(f->path, '/');
+  f->base = slash != NULL ? slash + 1 : f->path;
+  f->next = s->files;
+  s->files = f;
+  return f;
+}
+
+static void
+free_maps(struct __libperf_symbols *s)
+{
+  int i;
+
+  for (i = 0; i < s->nr_maps; i++)
+    free(s->maps[i].name);
+
+  free(s->maps);
+  s->maps = NULL;
+  s->nr_maps = 0;
+}
+
+struct __libperf_symbols *
+__libperf_symbols_open(pid_t pid)
+{
+  struct __libperf_symbols *s = calloc(1, sizeof(*s));
+
+  if (s == NULL)
+    return NULL;
+
+  s->pid = pid;
+  if (__libperf_symbols_reload(s) == -1)
+    {
+      __libperf_symbols_close(s);
+      return NULL;
+    }
+
+  return s;
+}
+
+int
+__libperf_symbols_reload(struct __libperf_symbols *s)
+{
+  struct mapping *maps = NULL, *grown, *m;
+
+  char path[64], line[PATH_MAX + 128], perms[8], *name;
+
+  unsigned long long start, end, offset;
+
+  int n = 0, size = 0, length;
+
+  FILE *f;
+
+  snprintf(path, sizeof(path), __LIBPERF_MAPS, (int) s->pid);
+  f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL)
+    {
+      line[strcspn(line, "\n")] = '\0';
+
+      /* start-end perms offset dev inode path; %n is not counted, and it
+         is never reached on a line cut short before the inode */
+      length = -1;
+      if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms,
+                 &offset, &length) < 4 || length < 0 ||
+          strchr(perms, 'x') == NULL)
+        continue;
+
+      if (n == size)
+        {
+          size = size ? 2 * size : 64;
+          grown = realloc(maps, size * sizeof(*maps));
+          if (grown == NULL)
+            goto fail;
+          maps = grown;
+        }
+
+      m = &maps[n];
+      memset(m, 0, sizeof(*m));
+      m->start = start;
+      m->end = end;
+      m->offset = offset;
+
+      name = line + length;
+      if (name[0] == '/')
+        {
+          m->file = find_file(s, name);
+          if (m->file == NULL)
+            goto fail;
+        }
+      else if (name[0] != '\0' && (m->name = strdup(name)) == NULL)
+        goto fail;
+
+      n++;
+    }
+
+  fclose(f);
+  qsort(maps, n, sizeof(*maps), compare_maps);
+
+  free_maps(s);
+  s->maps = maps;
+  s->nr_maps = n;
+  return 0;
+
+fail:
+  fclose(f);
+  while (n-- > 0)
+    free(maps[n].name);
+  free(maps);
+  return -1;
+}
+
+static const struct mapping *
+find_mapping(struct __libperf_symbols *s, uint64_t ip)
+{
+  int low = 0, high = s->nr_maps - 1, mid;
+
+  while (low <= high)
+    {
+      mid = (low + high) / 2;
+      if (ip < s->maps[mid].start)
+        high = mid - 1;
+      else if (ip >= s->maps[mid].end)
+        low = mid + 1;
+      else
+        return &s->maps[mid];
+    }
+
+  return NULL;
+}
+
+/* the symbol covering a link time address, or the closest one below it
+   when the table has no sizes */
+static const struct elf_symbol *
+find_symbol(const struct elf_file *f, uint64_t addr)
+{
+  size_t low = 0, high = f->nr_symbols;
+
+  const struct elf_symbol *sym;
+
+  while (low < high)
+    {
+      size_t mid = (low + high) / 2;
+
+      if (f->symbols[mid].addr <= addr)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  if (low == 0)
+    return NULL;
+
+  sym = &f->symbols[low - 1];
+  if (sym->size != 0 && addr >= sym->addr + sym->size)
+    return NULL;
+
+  return sym;
+}
+
+const char *
+__libperf_symbols_name(struct __libperf_symbols *s, uint64_t ip, char *buf,
+                       size_t size)
+{
+  const struct mapping *m;
+
+  const struct elf_symbol *sym;
+
+  uint64_t offset;
+
+  int i;
+
+  if (ip >= __LIBPERF_KERNEL_START)
+    return "[kernel]";
+
+  m = find_mapping(s, ip);
+  if (m == NULL)
+    {
+      snprintf(buf, size, "0x%" PRIx64, ip);
+      return buf;
+    }
+
+  if (m->file == NULL)
+    return m->name != NULL ? m->name : "[anon]";
+
+  if (!m->file->loaded)
+    load_file(m->file);
+
+  /* runtime address -> file offset -> link time address */
+  offset = ip - m->start + m->offset;
+  for (i = 0; i < m->file->nr_loads; i++)
+    {
+      const struct elf_load *load = &m->file->loads[i];
+
+      if (offset >= load->offset && offset - load->offset < load->size)
+        {
+          sym = find_symbol(m->file, offset - load->offset + load->vaddr);
+          if (sym != NULL)
+            return m->file->strings + sym->name;
+          break;
+        }
+    }
+
+  snprintf(buf, size, "%s+0x%" PRIx64, m->file->base, offset);
+  return buf;
+}
+
+void
+__libperf_symbols_close(struct __libperf_symbols *s)
+{
+  struct elf_file *f, *next;
+
+  if (s == NULL)
+    return;
+
+  free_maps(s);
+
+  for (f = s->files; f != NULL; f = next)
+    {
+      next = f->next;
+      free(f->path);
+      free(f->symbols);
+      free(f->strings);
+      free(f->loads);
+      free(f);
+    }
+
+  free(s);
+}
@@ -0,0 +1,488 @@
+/******************************************************************************
+ * libperf_threads.c                                                          *
+ *                                                                            *
+ * This is the libperf thread registry.  It attaches a non-inherited context *
+ * to every thread of the process, including threads created later, and      *
+ * reports per-thread and aggregate counter values.                           *
+ *                                                                            *
+ * libperf interfaces with the kernel performance counters subsystem          *
+ * Copyright (C) 2010 Wolfgang Richter, Ekaterina Taralova, Karl Naden        *
+ *                                                                            *
+ * This program is free software; you can redistribute it and/or              *
+ * modify it under the terms of the GNU General Public License                *
+ * as published by the Free Software Foundation; either version 2             *
+ * of the License, or (at your option) any later version.                     *
+ *                                                                            *
+ * This program is distributed in the hope that it will be useful,            *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU General Public License for more details.                               *
+ *                                                                            *
+ * You should have received a copy of the GNU General Public License          *
+ * along with this program; if not, write to the Free Software                *
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA              *
+ * 02110-1301, USA.                                                           *
+ ******************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libperf.h"
+#include "libperf_private.h"
+
+#define __LIBPERF_TASK_DIR "/proc/self/task"
+#define __LIBPERF_TASK_COMM "/proc/self/task/%d/comm"
+#define __LIBPERF_TASK_STAT "/proc/self/task/%d/stat"
+
+/* one monitored thread */
+struct registry_thread
+{
+  pid_t tid;
+  unsigned long long starttime;         /* tells a reused tid apart */
+  int alive;
+  char name[16];
+  struct libperf_data *pd;              /* NULL once the thread exited */
+  uint64_t values[LIBPERF_NR_COUNTERS];    /* as of the last read */
+};
+
+/* registry struct */
+struct libperf_threads
+{
+  pthread_mutex_t lock;
+  uint64_t mask;
+  int flags;
+  int enabled;
+  struct registry_thread *threads;
+  int nr_threads;
+  uint64_t closed[LIBPERF_NR_COUNTERS];    /* folded in exited threads */
+
+  /* optional watcher picking up new threads */
+  pthread_t watcher;
+  pthread_cond_t wakeup;
+  pid_t watcher_tid;
+  unsigned int interval_ms;
+  int stopping;
+};
+
+static void
+thread_name(pid_t tid, char *name, size_t size)
+{
+  char path[64];
+
+  FILE *f;
+
+  name[0] = '\0';
+
+  snprintf(path, sizeof(path), __LIBPERF_TASK_COMM, (int) tid);
+  f = fopen(path, "r");
+  if (f == NULL)
+    return;
+
+  if (fgets(name, size, f) != NULL)
+    name[strcspn(name, "\n")] = '\0';
+
+  fclose(f);
+}
+
+/* start time in clock ticks after boot, 0 if the thread is gone */
+static unsigned long long
+thread_starttime(pid_t tid)
+{
+  char path[64], line[1024], *p;
+
+  unsigned long long starttime = 0;
+
+  FILE *f;
+
+  snprintf(path, sizeof(path), __LIBPERF_TASK_STAT, (int) tid);
+  f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+
+  /* the comm in parentheses may contain spaces and parentheses itself */
+  if (fgets(line, sizeof(line), f) != NULL &&
+      (p = strrchr(line, ')')) != NULL &&
+      sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u"
+             " %*d %*d %*d %*d %*d %*d %llu", &starttime) != 1)
+    starttime = 0;
+
+  fclose(f);
+  return starttime;
+}
+
+/* adds values to a sum the way libperf_threads_total does */
+static void
+add_values(uint64_t *sum, const uint64_t *values)
+{
+  int j;
+
+  for (j = 0; j < LIBPERF_NR_COUNTERS; j++)
+    {
+      /* wall time overlaps between threads, not additive */
+      if (j == LIBPERF_LIB_SW_WALL_TIME)
+        {
+          if (values[j] > sum[j])
+            sum[j] = values[j];
+        }
+      else
+        sum[j] += values[j];
+    }
+}
+
+/* takes the final counts of an exited thread and closes its context, so
+   a long running process does not collect fds of dead threads */
+static void
+retire_thread(struct libperf_threads *t, struct registry_thread *rt)
+{
+  libperf_readall(rt->pd, rt->values);
+  libperf_close(rt->pd);
+  rt->pd = NULL;
+  rt->alive = 0;
+  add_values(t->closed, rt->values);
+}
+
+/* attaches one thread, called with t->lock held */
+static int
+attach_thread(struct libperf_threads *t, pid_t tid,
+              unsigned long long starttime)
+{
+  struct registry_thread *threads, *rt;
+
+  struct libperf_data *pd;
+
+  pd = libperf_initialize_mask(tid, -1, t->mask, t->flags);
+  if (pd == NULL)
+    {
+      /* the thread exited between the scan and the open */
+      return errno == ESRCH ? 0 : -1;
+    }
+
+  /* threads that start later join in the current state */
+  if (t->enabled && libperf_enableall(pd) == -1)
+    {
+      libperf_close(pd);
+      return -1;
+    }
+
+  threads = realloc(t->threads, (t->nr_threads + 1) * sizeof(*threads));
+  if (threads == NULL)
+    {
+      libperf_close(pd);
+      return -1;
+    }
+  t->threads = threads;
+
+  rt = &threads[t->nr_threads++];
+  memset(rt, 0, sizeof(*rt));
+  rt->tid = tid;
+  rt->starttime = starttime;
+  rt->alive = 1;
+  rt->pd = pd;
+  thread_name(tid, rt->name, sizeof(rt->name));
+  return 0;
+}
+
+/* scans the task directory, called with t->lock held */
+static int
+rescan(struct libperf_threads *t)
+{
+  struct dirent *entry;
+
+  unsigned long long starttime;
+
+  pid_t tid;
+
+  DIR *dir;
+
+  int i, n, result = 0;
+
+  dir = opendir(__LIBPERF_TASK_DIR);
+  if (dir == NULL)
+    return -1;
+
+  /* threads retired by the previous scan are only in the closed sum now */
+  for (i = n = 0; i < t->nr_threads; i++)
+    if (t->threads[i].pd != NULL)
+      {
+        t->threads[n] = t->threads[i];
+        t->threads[n++].alive = 0;
+      }
+  t->nr_threads = n;
+
+  while ((entry = readdir(dir)) != NULL)
+    {
+      tid = atoi(entry->d_name);
+      if (tid <= 0 || tid == t->watcher_tid)
+        continue;
+
+      starttime = thread_starttime(tid);
+      if (starttime == 0)
+        continue;
+
+      for (i = 0; i < n; i++)
+        if (t->threads[i].tid == tid)
+          break;
+
+      /* a tid that came back with another start time is a new thread */
+      if (i < n && t->threads[i].starttime == starttime)
+        {
+          t->threads[i].alive = 1;
+          continue;
+        }
+
+      if (i < n)
+        retire_thread(t, &t->threads[i]);
+
+      if (attach_thread(t, tid, starttime) == -1)
+        result = -1;
+    }
+
+  closedir(dir);
+
+  for (i = 0; i < n; i++)
+    if (!t->threads[i].alive && t->threads[i].pd != NULL)
+      retire_thread(t, &t->threads[i]);
+
+  return result;
+}
+
+static void *
+watcher_main(void *arg)
+{
+  struct libperf_threads *t = arg;
+
+  struct timespec deadline;
+
+  pthread_mutex_lock(&t->lock);
+  t->watcher_tid = sys_gettid();
+
+  while (!t->stopping)
+    {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += t->interval_ms / 1000;
+      deadline.tv_nsec += (t->interval_ms % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000L;
+        }
+
+      pthread_cond_timedwait(&t->wakeup, &t->lock, &deadline);
+      if (!t->stopping)
+        rescan(t);
+    }
+
+  pthread_mutex_unlock(&t->lock);
+  return NULL;
+}
+
+struct libperf_threads *
+libperf_threads_open(const char *events, unsigned int interval_ms, int flags)
+{
+  struct libperf_threads *t;
+
+  uint64_t mask = LIBPERF_MASK_ALL;
+
+  int saved_errno;
+
+  if (events != NULL && libperf_parseevents(events, &mask) == -1)
+    return NULL;
+
+  t = calloc(1, sizeof(*t));
+  if (t == NULL)
+    return NULL;
+
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->wakeup, NULL);
+  t->mask = mask;
+  t->interval_ms = interval_ms;
+  t->watcher_tid = -1;
+
+  /* children must not fold into a thread's counts, and the reads come
+     from whichever thread asks, so rdpmc and async logging are out */
+  t->flags = (flags & ~(LIBPERF_FLAG_MMAP | LIBPERF_FLAG_LAZY |
+                        LIBPERF_FLAG_ASYNCLOG)) | __LIBPERF_FLAG_NOINHERIT;
+
+  if (libperf_threads_rescan(t) == -1)
+    goto fail;
+
+  if (interval_ms > 0)
+    {
+      errno = pthread_create(&t->watcher, NULL, watcher_main, t);
+      if (errno != 0)
+        {
+          t->interval_ms = 0;
+          goto fail;
+        }
+    }
+
+  return t;
+
+fail:
+  saved_errno = errno;
+  libperf_threads_close(t);
+  errno = saved_errno;
+  return NULL;
+}
+
+int
+libperf_threads_rescan(struct libperf_threads *t)
+{
+  int result;
+
+  pthread_mutex_lock(&t->lock);
+  result = rescan(t);
+  pthread_mutex_unlock(&t->lock);
+  return result;
+}
+
+/* applies fn to every thread's context */
+static int
+threads_all(struct libperf_threads *t, int (*fn)(struct libperf_data *pd))
+{
+  int i, result = 0;
+
+  pthread_mutex_lock(&t->lock);
+
+  if (fn == libperf_enableall)
+    t->enabled = 1;
+  else if (fn == libperf_disableall)
+    t->enabled = 0;
+
+  for (i = 0; i < t->nr_threads; i++)
+    if (t->threads[i].pd != NULL && fn(t->threads[i].pd) == -1)
+      result = -1;
+
+  pthread_mutex_unlock(&t->lock);
+  return result;
+}
+
+int
+libperf_threads_enable(struct libperf_threads *t)
+{
+  return threads_all(t, libperf_enableall);
+}
+
+int
+libperf_threads_disable(struct libperf_threads *t)
+{
+  return threads_all(t, libperf_disableall);
+}
+
+int
+libperf_threads_reset(struct libperf_threads *t)
+{
+  return threads_all(t, libperf_resetall);
+}
+
+int
+libperf_threads_read(struct libperf_threads *t)
+{
+  int i, result = 0;
+
+  pthread_mutex_lock(&t->lock);
+
+  for (i = 0; i < t->nr_threads; i++)
+    if (t->threads[i].pd != NULL &&
+        libperf_readall(t->threads[i].pd, t->threads[i].values) == -1)
+      result = -1;
+
+  pthread_mutex_unlock(&t->lock);
+  return result;
+}
+
+int
+libperf_threads_count(struct libperf_threads *t)
+{
+  int n;
+
+  pthread_mutex_lock(&t->lock);
+  n = t->nr_threads;
+  pthread_mutex_unlock(&t->lock);
+  return n;
+}
+
+int
+libperf_threads_info(struct libperf_threads *t, int index,
+                     struct libperf_threadinfo *info)
+{
+  int result = -1;
+
+  pthread_mutex_lock(&t->lock);
+
+  if (index >= 0 && index < t->nr_threads)
+    {
+      info->tid = t->threads[index].tid;
+      info->alive = t->threads[index].alive;
+      memcpy(info->name, t->threads[index].name, sizeof(info->name));
+      result = 0;
+    }
+
+  pthread_mutex_unlock(&t->lock);
+  return result;
+}
+
+int
+libperf_threads_values(struct libperf_threads *t, int index, uint64_t *out)
+{
+  int result = -1;
+
+  pthread_mutex_lock(&t->lock);
+
+  if (index >= 0 && index < t->nr_threads)
+    {
+      memcpy(out, t->threads[index].values, sizeof(t->threads[index].values));
+      result = 0;
+    }
+
+  pthread_mutex_unlock(&t->lock);
+  return result;
+}
+
+int
+libperf_threads_total(struct libperf_threads *t, uint64_t *out)
+{
+  int i;
+
+  pthread_mutex_lock(&t->lock);
+
+  memcpy(out, t->closed, sizeof(t->closed));
+
+  /* retired threads are already in the closed sum */
+  for (i = 0; i < t->nr_threads; i++)
+    if (t->threads[i].pd != NULL)
+      add_values(out, t->threads[i].values);
+
+  pthread_mutex_unlock(&t->lock);
+  return 0;
+}
+
+void
+libperf_threads_close(struct libperf_threads *t)
+{
+  int i;
+
+  if (t->interval_ms > 0)
+    {
+      pthread_mutex_lock(&t->lock);
+      t->stopping = 1;
+      pthread_cond_signal(&t->wakeup);
+      pthread_mutex_unlock(&t->lock);
+      pthread_join(t->watcher, NULL);
+    }
+
+  for (i = 0; i < t->nr_threads; i++)
+    if (t->threads[i].pd != NULL)
+      libperf_close(t->threads[i].pd);
+
+  pthread_cond_destroy(&t->wakeup);
+  pthread_mutex_destroy(&t->lock);
+  free(t->threads);
+  free(t);
+}